@@ -0,0 +1,180 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "shared_world_capability.h"
+
+// system includes
+#include <moveit/planning_scene_monitor/planning_scene_monitor.h>
+
+// project includes
+#include "../collision/collision_world_sbpl.h"
+
+namespace sbpl_interface {
+
+static const char* LOG = "shared_world";
+
+SharedWorldCapability::SharedWorldCapability() :
+    MoveGroupCapability("SharedWorldCapability")
+{
+}
+
+void SharedWorldCapability::initialize()
+{
+    m_predicted_sub = root_node_handle_.subscribe(
+            "predicted_obstacles",
+            1,
+            &SharedWorldCapability::predictedObstaclesCallback,
+            this);
+
+    double rate;
+    node_handle_.param("shared_world/consume_rate", rate, 30.0);
+    if (rate <= 0.0) {
+        ROS_INFO_NAMED(LOG, "Shared voxel updates are not consumed");
+        return;
+    }
+
+    m_consume_timer = root_node_handle_.createTimer(
+            ros::Duration(1.0 / rate),
+            &SharedWorldCapability::consumeVoxelUpdates,
+            this);
+}
+
+void SharedWorldCapability::consumeVoxelUpdates(const ros::TimerEvent& e)
+{
+    using collision_detection::CollisionWorldSBPL;
+    auto& monitor = context_->planning_scene_monitor_;
+
+    // avoid taking the write lock, and blocking readers, when there is
+    // nothing to apply
+    {
+        planning_scene_monitor::LockedPlanningSceneRO scene(monitor);
+        auto* cworld = dynamic_cast<const CollisionWorldSBPL*>(
+                scene->getCollisionWorld().get());
+        if (!cworld || !cworld->voxelUpdatesPending()) {
+            return;
+        }
+    }
+
+    bool updated = false;
+    {
+        planning_scene_monitor::LockedPlanningSceneRW scene(monitor);
+        auto* cworld = dynamic_cast<const CollisionWorldSBPL*>(
+                scene->getCollisionWorld().get());
+        if (!cworld) {
+            return;
+        }
+
+        // the write lock grants exclusive access to the collision world, which
+        // the planning scene only exposes as const
+        updated = const_cast<CollisionWorldSBPL*>(cworld)->consumeVoxelUpdates();
+    }
+
+    if (updated) {
+        monitor->triggerSceneUpdateEvent(
+                planning_scene_monitor::PlanningSceneMonitor::UPDATE_GEOMETRY);
+    }
+}
+
+void SharedWorldCapability::predictedObstaclesCallback(
+    const visualization_msgs::MarkerArray::ConstPtr& msg)
+{
+    using collision_detection::CollisionWorldSBPL;
+    using visualization_msgs::Marker;
+
+    auto clear = msg->markers.empty();
+    for (auto& marker : msg->markers) {
+        if (marker.action == Marker::DELETEALL) {
+            clear = true;
+        }
+    }
+
+    CollisionWorldSBPL::PredictedObstacles obstacles;
+    if (!clear) {
+        auto& first = msg->markers.front();
+        obstacles.stamp = first.header.stamp;
+        obstacles.dt = first.lifetime.toSec();
+        for (auto& marker : msg->markers) {
+            if (marker.type != Marker::SPHERE_LIST ||
+                marker.header.frame_id != first.header.frame_id ||
+                marker.lifetime != first.lifetime)
+            {
+                ROS_WARN_NAMED(LOG, "Predicted obstacles must be sphere lists with a common frame and lifetime");
+                return;
+            }
+
+            std::vector<CollisionWorldSBPL::PredictedObstacles::Sphere> layer;
+            layer.reserve(marker.points.size());
+            for (auto& p : marker.points) {
+                CollisionWorldSBPL::PredictedObstacles::Sphere s;
+                s.center = Eigen::Vector3d(p.x, p.y, p.z);
+                s.radius = 0.5 * marker.scale.x;
+                layer.push_back(s);
+            }
+            obstacles.layers.push_back(std::move(layer));
+        }
+
+        if (obstacles.dt <= 0.0) {
+            ROS_WARN_NAMED(LOG, "Predicted obstacles require a positive marker lifetime");
+            return;
+        }
+    }
+
+    planning_scene_monitor::LockedPlanningSceneRW scene(
+            context_->planning_scene_monitor_);
+    auto* cworld = dynamic_cast<const CollisionWorldSBPL*>(
+            scene->getCollisionWorld().get());
+    if (!cworld) {
+        ROS_WARN_ONCE_NAMED(LOG, "Predicted obstacles require the sbpl collision detector");
+        return;
+    }
+
+    // see consumeVoxelUpdates()
+    auto* mworld = const_cast<CollisionWorldSBPL*>(cworld);
+    if (clear) {
+        mworld->clearPredictedObstacles();
+        return;
+    }
+
+    auto& frame_id = msg->markers.front().header.frame_id;
+    if (frame_id != scene->getPlanningFrame()) {
+        ROS_WARN_NAMED(LOG, "Predicted obstacles are in frame '%s'. Expected planning frame '%s'", frame_id.c_str(), scene->getPlanningFrame().c_str());
+        return;
+    }
+
+    mworld->setPredictedObstacles(std::move(obstacles));
+}
+
+} // namespace sbpl_interface
+
+#include <pluginlib/class_list_macros.h>
+PLUGINLIB_EXPORT_CLASS(sbpl_interface::SharedWorldCapability, move_group::MoveGroupCapability);
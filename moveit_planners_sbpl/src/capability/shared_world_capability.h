@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_shared_world_capability_h
+#define sbpl_interface_shared_world_capability_h
+
+// system includes
+#include <moveit/move_group/move_group_capability.h>
+#include <ros/ros.h>
+#include <visualization_msgs/MarkerArray.h>
+
+namespace sbpl_interface {
+
+/// \brief move_group capability that applies updates from outside the
+///     planning scene monitor to the sbpl collision world
+///
+/// Voxel updates written to the shared voxel ring are consumed at the rate
+/// given by the "shared_world/consume_rate" parameter, under the planning
+/// scene monitor's write lock, so that planners and other readers of the
+/// scene, which hold its read lock, never observe a partially updated world.
+///
+/// Predicted occupancy of moving obstacles is received on the
+/// "predicted_obstacles" topic as a marker array. Each SPHERE_LIST marker is
+/// one layer, in order, with spheres of diameter scale.x. The stamp of the
+/// first marker is the start of the first layer and the lifetime of each
+/// marker is the duration of every layer. Markers must be given in the
+/// planning frame. An empty array, or a DELETEALL marker, clears the
+/// predictions.
+///
+/// Planners that time their solutions around the predictions set the
+/// trajectory timing themselves, so the planning pipeline must not run a
+/// time parameterization adapter after them.
+///
+/// Load with the move_group "capabilities" parameter.
+class SharedWorldCapability : public move_group::MoveGroupCapability
+{
+public:
+
+    SharedWorldCapability();
+
+    void initialize() override;
+
+private:
+
+    ros::Timer m_consume_timer;
+    ros::Subscriber m_predicted_sub;
+
+    void consumeVoxelUpdates(const ros::TimerEvent& e);
+
+    void predictedObstaclesCallback(
+        const visualization_msgs::MarkerArray::ConstPtr& msg);
+};
+
+} // namespace sbpl_interface
+
+#endif
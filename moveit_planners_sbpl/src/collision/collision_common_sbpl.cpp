@@ -32,12 +32,15 @@
 #include "collision_common_sbpl.h"
 
 // standard includes
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 
 // system includes
 #include <eigen_conversions/eigen_msg.h>
+#include <moveit/distance_field/propagation_distance_field.h>
 #include <smpl/console/nonstd.h>
+#include <smpl/debug/visualize.h>
 
 namespace collision_detection {
 
@@ -517,6 +520,17 @@ void ConvertObjectToCollisionObjectShallow(
     collision_object->shape_poses = std::move(shape_poses);
 }
 
+auto GridMemoryUsage(const smpl::OccupancyGrid& grid) -> size_t
+{
+    // each cell stores its distance, the position of its nearest obstacle, and
+    // propagation bookkeeping, comparable to a propagation distance field voxel
+    const size_t cell_size = sizeof(distance_field::PropDistanceFieldVoxel);
+    return (size_t)grid.numCellsX() *
+            (size_t)grid.numCellsY() *
+            (size_t)grid.numCellsZ() *
+            cell_size;
+}
+
 auto GetCollisionMarkers(smpl::collision::RobotCollisionState& rcs)
     -> visualization_msgs::MarkerArray
 {
@@ -563,4 +577,49 @@ auto GetCollisionMarkers(
     return ma;
 }
 
+auto GetCollisionMarkersBuilder(
+    const smpl::collision::RobotCollisionModelConstPtr& rcm,
+    const std::vector<double>& variables,
+    smpl::collision::AttachedBodiesCollisionState& abcs,
+    int gidx)
+    -> MarkerBuilder
+{
+    auto abma = GetCollisionMarkers(abcs, gidx);
+    return [rcm, variables, abma, gidx]()
+    {
+        smpl::collision::RobotCollisionState rcs(rcm.get());
+        rcs.setJointVarPositions(variables.data());
+        auto ma = GetCollisionMarkers(rcs, gidx);
+        ma.markers.insert(
+                ma.markers.end(), abma.markers.begin(), abma.markers.end());
+
+        int id = 0;
+        for (auto& m : ma.markers) {
+            m.id = id++;
+        }
+        return ma;
+    };
+}
+
+static std::mutex g_deferred_visualizer_mutex;
+static DeferredVisualizer g_deferred_visualizer;
+
+void SetDeferredVisualizer(DeferredVisualizer visualizer)
+{
+    std::lock_guard<std::mutex> lock(g_deferred_visualizer_mutex);
+    g_deferred_visualizer = std::move(visualizer);
+}
+
+void ShowDeferred(const std::string& ns, MarkerBuilder build)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_deferred_visualizer_mutex);
+        if (g_deferred_visualizer) {
+            g_deferred_visualizer(ns, std::move(build));
+            return;
+        }
+    }
+    SV_SHOW_INFO(build());
+}
+
 } // namespace collision_detection
@@ -33,6 +33,7 @@
 #define collision_detection_collision_common_sbpl_h
 
 // standard includes
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -52,6 +53,7 @@
 #include <sbpl_collision_checking/robot_collision_model.h>
 #include <sbpl_collision_checking/robot_collision_state.h>
 #include <sbpl_collision_checking/shapes.h>
+#include <smpl/occupancy_grid.h>
 
 namespace collision_detection {
 
@@ -220,6 +222,79 @@ private:
     const TouchLinkSet& m_touch_link_map;
 };
 
+// proxy class to additionally allow collisions between link pairs whose
+// collision status has already been decided by other means. decided pairs are
+// keyed on their link names in lexicographic order
+class AllowedCollisionsAndDecidedPairsInterface :
+    public smpl::collision::AllowedCollisionsInterface
+{
+public:
+
+    AllowedCollisionsAndDecidedPairsInterface(
+        const smpl::collision::AllowedCollisionsInterface& aci,
+        const TouchLinkSet& decided_pairs)
+    :
+        AllowedCollisionsInterface(),
+        m_aci(aci),
+        m_decided_pairs(decided_pairs)
+    { }
+
+    virtual bool getEntry(
+        const std::string& name1,
+        const std::string& name2,
+        smpl::collision::AllowedCollision::Type& type) const override
+    {
+        if (!m_decided_pairs.empty()) {
+            auto key = name1 < name2 ?
+                    std::make_pair(name1, name2) :
+                    std::make_pair(name2, name1);
+            if (m_decided_pairs.find(key) != m_decided_pairs.end()) {
+                type = smpl::collision::AllowedCollision::Type::ALWAYS;
+                return true;
+            }
+        }
+        return m_aci.getEntry(name1, name2, type);
+    }
+
+private:
+
+    const smpl::collision::AllowedCollisionsInterface& m_aci;
+    const TouchLinkSet& m_decided_pairs;
+};
+
+// proxy class to additionally allow collisions between link pairs in a set
+class AllowedCollisionsAndPairSetInterface :
+    public smpl::collision::AllowedCollisionsInterface
+{
+public:
+
+    AllowedCollisionsAndPairSetInterface(
+        const smpl::collision::AllowedCollisionsInterface& aci,
+        const TouchLinkSet& pairs)
+    :
+        AllowedCollisionsInterface(),
+        m_aci(aci),
+        m_pairs(pairs)
+    { }
+
+    virtual bool getEntry(
+        const std::string& name1,
+        const std::string& name2,
+        smpl::collision::AllowedCollision::Type& type) const override
+    {
+        if (m_pairs.find(std::make_pair(name1, name2)) != m_pairs.end()) {
+            type = smpl::collision::AllowedCollision::Type::ALWAYS;
+            return true;
+        }
+        return m_aci.getEntry(name1, name2, type);
+    }
+
+private:
+
+    const smpl::collision::AllowedCollisionsInterface& m_aci;
+    const TouchLinkSet& m_pairs;
+};
+
 bool WorldObjectToCollisionObjectMsgFull(
     const World::Object& object,
     moveit_msgs::CollisionObject& collision_object);
@@ -233,6 +308,9 @@ void ConvertObjectToCollisionObjectShallow(
     std::vector<std::unique_ptr<smpl::collision::CollisionShape>>& collision_shapes,
     std::unique_ptr<smpl::collision::CollisionObject>& collision_object);
 
+/// Return an estimate of the memory, in bytes, held by the cells of a grid
+auto GridMemoryUsage(const smpl::OccupancyGrid& grid) -> size_t;
+
 auto GetCollisionMarkers(smpl::collision::RobotCollisionState& rcs)
     -> visualization_msgs::MarkerArray;
 
@@ -250,6 +328,30 @@ auto GetCollisionMarkers(
     int gidx)
     -> visualization_msgs::MarkerArray;
 
+typedef std::function<visualization_msgs::MarkerArray()> MarkerBuilder;
+
+/// Return a function that builds the collision markers of a group with the
+/// joint variables of the robot collision model set to \p variables. The
+/// markers of the attached bodies are built immediately since their model may
+/// change before the function is called.
+auto GetCollisionMarkersBuilder(
+    const smpl::collision::RobotCollisionModelConstPtr& rcm,
+    const std::vector<double>& variables,
+    smpl::collision::AttachedBodiesCollisionState& abcs,
+    int gidx)
+    -> MarkerBuilder;
+
+typedef std::function<void(const std::string&, MarkerBuilder)>
+DeferredVisualizer;
+
+/// Set the function that receives marker builders to call and publish off the
+/// checking thread. An empty function restores immediate visualization.
+void SetDeferredVisualizer(DeferredVisualizer visualizer);
+
+/// Hand the builder of the markers of a namespace to the deferred visualizer,
+/// or build and show the markers now if none is set
+void ShowDeferred(const std::string& ns, MarkerBuilder build);
+
 } // namespace collision_detection
 
 #endif
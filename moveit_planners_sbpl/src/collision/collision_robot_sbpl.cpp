@@ -33,8 +33,11 @@
 
 #include <ros/ros.h>
 
+#include <smpl/angles.h>
 #include <smpl/debug/visualize.h>
 
+#include "trace.h"
+
 namespace collision_detection {
 
 // crp = collision robot plugin
@@ -97,11 +100,16 @@ CollisionRobotSBPL::CollisionRobotSBPL(
         ROS_ERROR_NAMED(CRP_LOGGER, "%s", msg);
         throw std::runtime_error(msg);
     }
+    m_updater_initialized = true;
 
     // ok! store the robot collision model
     m_rcm = rcm;
     m_rmcm = std::make_shared<smpl::collision::RobotMotionCollisionModel>(m_rcm.get());
 
+    loadSelfCollisionTable(ph, model, rcm_config.toXml());
+
+    ph.param("self_collision/prune_static_pairs", m_prune_static_pairs, true);
+
     ros::NodeHandle nh;
 }
 
@@ -113,7 +121,14 @@ CollisionRobotSBPL::CollisionRobotSBPL(const CollisionRobotSBPL& other) :
     m_jcgm_map = other.m_jcgm_map;
     m_rcm = other.m_rcm;
     m_rmcm = other.m_rmcm;
-    m_updater = other.m_updater;
+
+    // the updater holds the mutable collision state. Each copy gets its own,
+    // so that copies may be checked from different threads, but only when it
+    // is first checked, since most copies made by diff() never are
+    m_updater_initialized = false;
+    m_sc_table = other.m_sc_table;
+    m_sc_table_group_pairs = other.m_sc_table_group_pairs;
+    m_prune_static_pairs = other.m_prune_static_pairs;
 }
 
 CollisionRobotSBPL::~CollisionRobotSBPL()
@@ -133,6 +148,18 @@ CollisionRobotSBPL::robotMotionCollisionModel() const
     return m_rmcm;
 }
 
+auto CollisionRobotSBPL::memoryUsage() const -> size_t
+{
+    size_t usage = 0;
+    if (m_grid) {
+        usage += GridMemoryUsage(*m_grid);
+    }
+    if (m_sc_table) {
+        usage += m_sc_table->memoryUsage();
+    }
+    return usage;
+}
+
 void CollisionRobotSBPL::checkOtherCollision(
     const CollisionRequest& req,
     CollisionResult& res,
@@ -198,6 +225,8 @@ void CollisionRobotSBPL::checkSelfCollision(
     const robot_state::RobotState& state,
     const AllowedCollisionMatrix& acm) const
 {
+    SBPL_TRACE_SPAN("CollisionRobotSBPL::checkSelfCollision");
+
     const_cast<CollisionRobotSBPL*>(this)->checkSelfCollisionMutable(
             req, res, state, acm);
 }
@@ -219,6 +248,8 @@ void CollisionRobotSBPL::checkSelfCollision(
     const robot_state::RobotState& state2,
     const AllowedCollisionMatrix& acm) const
 {
+    SBPL_TRACE_SPAN("CollisionRobotSBPL::checkSelfCollision");
+
     // TODO: implement
     const_cast<CollisionRobotSBPL*>(this)->checkSelfCollisionMutable(
             req, res, state1, state2, acm);
@@ -288,6 +319,40 @@ void CollisionRobotSBPL::updatedPaddingOrScaling(
     CollisionRobot::updatedPaddingOrScaling(links);
 }
 
+// Lazily initialize the collision state updater and the self collision model,
+// on the first check of this collision robot rather than when it is created or
+// copied
+bool CollisionRobotSBPL::initSelfCollisionModel()
+{
+    using smpl::collision::SelfCollisionModel;
+
+    if (m_scm) {
+        return true;
+    }
+
+    if (!m_updater_initialized) {
+        if (!m_updater.init(*robot_model_, m_rcm)) {
+            ROS_ERROR_NAMED(CRP_LOGGER, "Failed to initialize collision state updater");
+            return false;
+        }
+        m_updater_initialized = true;
+    }
+
+    ROS_DEBUG_NAMED(CRP_LOGGER, "Initialize self collision model");
+
+    m_grid = createGridFor(m_scm_config);
+    m_grid->setReferenceFrame(m_rcm->modelFrame());
+
+    auto bbm = m_grid->getOccupiedVoxelsVisualization();
+    bbm.ns = "self_collision_model_bounds";
+    SV_SHOW_INFO(bbm);
+
+    // the self collision model refers to the updater's attached bodies model
+    m_scm = std::make_shared<SelfCollisionModel>(
+            m_grid.get(), m_rcm.get(), m_updater.attachedBodiesCollisionModel().get());
+    return true;
+}
+
 void CollisionRobotSBPL::setVacuousCollision(CollisionResult& res) const
 {
     res.collision = true;
@@ -325,19 +390,9 @@ void CollisionRobotSBPL::checkSelfCollisionMutable(
         return;
     }
 
-    if (!m_grid) {
-        ROS_DEBUG_NAMED(CRP_LOGGER, "Initialize self collision model");
-
-        // lazily initialize self collision model
-        m_grid = createGridFor(m_scm_config);
-        m_grid->setReferenceFrame(m_rcm->modelFrame());
-
-        auto bbm = m_grid->getOccupiedVoxelsVisualization();
-        bbm.ns = "self_collision_model_bounds";
-        SV_SHOW_INFO(bbm);
-
-        m_scm = std::make_shared<SelfCollisionModel>(
-                m_grid.get(), m_rcm.get(), m_updater.attachedBodiesCollisionModel().get());
+    if (!initSelfCollisionModel()) {
+        setVacuousCollision(res);
+        return;
     }
 
     int gidx = m_rcm->groupIndex(collision_group_name);
@@ -348,31 +403,60 @@ void CollisionRobotSBPL::checkSelfCollisionMutable(
             Eigen::Affine3d::Identity());
     m_updater.update(state_copy);
 
+    AllowedCollisionMatrixAndTouchLinksInterface touch_aci(
+            acm, m_updater.touchLinkSet());
+
+    // static pairs are skipped once they are known to be clear. the distance
+    // to them is not retained, so distance queries check every pair
+    StaticPairs* static_pairs = nullptr;
+    if (m_prune_static_pairs && !req.distance) {
+        static_pairs = getStaticPairs(
+                *state.getRobotModel(), req.group_name, gidx);
+        if (static_pairs &&
+            !checkStaticPairs(*static_pairs, state_copy, touch_aci, acm))
+        {
+            static_pairs = nullptr;
+        }
+    }
+
+    static const TouchLinkSet no_pairs;
+    AllowedCollisionsAndPairSetInterface static_aci(
+            touch_aci, static_pairs ? static_pairs->pairs : no_pairs);
+    const smpl::collision::AllowedCollisionsInterface& aci = static_pairs ?
+            static_cast<const smpl::collision::AllowedCollisionsInterface&>(static_aci) :
+            static_cast<const smpl::collision::AllowedCollisionsInterface&>(touch_aci);
+
+    // the tables decide pairs without measuring their distance, so distance
+    // queries check every pair geometrically
     double dist;
-    bool valid = m_scm->checkCollision(
-            *m_updater.collisionState(),
-            *m_updater.attachedBodiesCollisionState(),
-            AllowedCollisionMatrixAndTouchLinksInterface(
-                    acm, m_updater.touchLinkSet()),
-            gidx,
-            dist);
+    bool valid;
+    m_sc_table_decided.clear();
+    if (m_sc_table && !req.distance &&
+        !checkSelfCollisionTable(state_copy, aci, gidx))
+    {
+        valid = false;
+        dist = 0.0;
+    } else {
+        // pairs decided by the lookup tables are skipped by the geometric check
+        valid = m_scm->checkCollision(
+                *m_updater.collisionState(),
+                *m_updater.attachedBodiesCollisionState(),
+                AllowedCollisionsAndDecidedPairsInterface(
+                        aci, m_sc_table_decided),
+                gidx,
+                dist);
+    }
 
     ROS_INFO_STREAM_COND_NAMED(req.verbose, CRP_LOGGER, "self valid: " << std::boolalpha << valid << ", dist: " << dist);
     ROS_DEBUG_STREAM_COND_NAMED(!req.verbose, CRP_LOGGER, "self valid: " << std::boolalpha << valid << ", dist: " << dist);
 
     const bool visualize = req.verbose;
     if (visualize) {
-        auto ma = getCollisionRobotVisualization(
+        ShowDeferred("self_collision", getCollisionRobotVisualization(
                 *m_updater.collisionState(),
                 *m_updater.attachedBodiesCollisionState(),
-                gidx);
-        if (!valid) {
-            for (auto& m : ma.markers) {
-                m.color.r = 1.0;
-                m.color.g = m.color.b = 0.0;
-            }
-        }
-        SV_SHOW_INFO(ma);
+                gidx,
+                valid));
     }
 
     if (!valid) {
@@ -415,19 +499,9 @@ void CollisionRobotSBPL::checkSelfCollisionMutable(
         return;
     }
 
-    if (!m_grid) {
-        ROS_DEBUG_NAMED(CRP_LOGGER, "Initialize self collision model");
-
-        // lazily initialize self collision model
-        m_grid = createGridFor(m_scm_config);
-        m_grid->setReferenceFrame(m_rcm->modelFrame());
-
-        auto bbma = m_grid->getOccupiedVoxelsVisualization();
-        bbma.ns = "self_collision_model_bounds";
-        SV_SHOW_INFO(bbma);
-
-        m_scm = std::make_shared<SelfCollisionModel>(
-                m_grid.get(), m_rcm.get(), m_updater.attachedBodiesCollisionModel().get());
+    if (!initSelfCollisionModel()) {
+        setVacuousCollision(res);
+        return;
     }
 
     int gidx = m_rcm->groupIndex(collision_group_name);
@@ -460,18 +534,12 @@ void CollisionRobotSBPL::checkSelfCollisionMutable(
 
     const bool visualize = req.verbose;
     if (visualize) {
-        auto ma = getCollisionRobotVisualization(
+        SV_SHOW_INFO(m_grid->getOccupiedVoxelsVisualization());
+        ShowDeferred("self_collision", getCollisionRobotVisualization(
                 *m_updater.collisionState(),
                 *m_updater.attachedBodiesCollisionState(),
-                gidx);
-        if (!valid) {
-            for (auto& m : ma.markers) {
-                m.color.r = 1.0;
-                m.color.g = m.color.b = 0.0;
-            }
-        }
-        SV_SHOW_INFO(m_grid->getOccupiedVoxelsVisualization());
-        SV_SHOW_INFO(ma);
+                gidx,
+                valid));
     }
 
     if (!valid) {
@@ -488,6 +556,275 @@ void CollisionRobotSBPL::checkSelfCollisionMutable(
     }
 }
 
+/// Load the self collision lookup tables, building them first if requested and
+/// no valid table file exists for \p model_config, the serialized robot
+/// collision model configuration. The tables are optional; they are enabled by
+/// setting the 'self_collision_table/path' parameter.
+void CollisionRobotSBPL::loadSelfCollisionTable(
+    const ros::NodeHandle& ph,
+    const robot_model::RobotModelConstPtr& model,
+    const std::string& model_config)
+{
+    std::string table_path;
+    if (!ph.getParam("self_collision_table/path", table_path) ||
+        table_path.empty())
+    {
+        return;
+    }
+
+    SelfCollisionTableConfig config;
+    double revolute_res_deg;
+    ph.param("self_collision_table/revolute_res_deg", revolute_res_deg, 1.0);
+    config.revolute_res = smpl::angles::to_radians(revolute_res_deg);
+    ph.param("self_collision_table/prismatic_res", config.prismatic_res, config.prismatic_res);
+    ph.param("self_collision_table/max_dims", config.max_dims, config.max_dims);
+    ph.param("self_collision_table/threads", config.thread_count, config.thread_count);
+    config.model_config = model_config;
+
+    auto table = std::make_shared<SelfCollisionTable>();
+    if (table->load(table_path, *model, config)) {
+        m_sc_table = table;
+        return;
+    }
+
+    bool build;
+    ph.param("self_collision_table/build", build, false);
+    if (!build) {
+        ROS_WARN_NAMED(CRP_LOGGER, "Self collision table '%s' unavailable. Set 'self_collision_table/build' to generate it", table_path.c_str());
+        return;
+    }
+
+    ROS_INFO_NAMED(CRP_LOGGER, "Build self collision table '%s'", table_path.c_str());
+    auto create_grid = [this]() { return createGridFor(m_scm_config); };
+    if (!table->build(model, m_rcm, create_grid, config)) {
+        ROS_WARN_NAMED(CRP_LOGGER, "Failed to build self collision table");
+        return;
+    }
+
+    if (!table->save(table_path)) {
+        ROS_WARN_NAMED(CRP_LOGGER, "Failed to save self collision table to '%s'", table_path.c_str());
+    }
+
+    m_sc_table = table;
+}
+
+/// Decide the status of tabulated link pairs within a collision group. Pairs
+/// found to be collision-free are recorded so the geometric check may skip
+/// them. Return false if any tabulated pair is in collision.
+bool CollisionRobotSBPL::checkSelfCollisionTable(
+    const moveit::core::RobotState& state,
+    const smpl::collision::AllowedCollisionsInterface& aci,
+    int gidx)
+{
+    auto it = m_sc_table_group_pairs.find(gidx);
+    if (it == end(m_sc_table_group_pairs)) {
+        // only pairs with both links in the group are checked sphere-to-sphere
+        auto& group_links = m_rcm->groupLinkIndices(gidx);
+        auto in_group = [&](const std::string& name) {
+            return m_rcm->hasLink(name) &&
+                    std::find(
+                            begin(group_links), end(group_links),
+                            m_rcm->linkIndex(name)) != end(group_links);
+        };
+
+        std::vector<TablePairRef> pairs;
+        for (size_t pidx = 0; pidx < m_sc_table->pairCount(); ++pidx) {
+            TablePairRef ref;
+            ref.pidx = pidx;
+            ref.link_name1 = m_sc_table->linkName1(pidx);
+            ref.link_name2 = m_sc_table->linkName2(pidx);
+            if (ref.link_name2 < ref.link_name1) {
+                std::swap(ref.link_name1, ref.link_name2);
+            }
+            if (in_group(ref.link_name1) && in_group(ref.link_name2)) {
+                pairs.push_back(std::move(ref));
+            }
+        }
+        ROS_DEBUG_NAMED(CRP_LOGGER, "%zu tabulated link pairs in collision group %d", pairs.size(), gidx);
+        it = m_sc_table_group_pairs.insert(
+                std::make_pair(gidx, std::move(pairs))).first;
+    }
+
+    for (auto& ref : it->second) {
+        // pairs allowed to collide are never checked; explicitly disallowed
+        // pairs are checked as usual
+        smpl::collision::AllowedCollision::Type type;
+        if (aci.getEntry(ref.link_name1, ref.link_name2, type) &&
+            type != smpl::collision::AllowedCollision::Type::NEVER)
+        {
+            continue;
+        }
+
+        switch (m_sc_table->pairStatus(ref.pidx, state)) {
+        case SelfCollisionTable::Status::Free:
+            m_sc_table_decided.emplace(ref.link_name1, ref.link_name2);
+            break;
+        case SelfCollisionTable::Status::Collision:
+            ROS_DEBUG_NAMED(CRP_LOGGER, "Tabulated collision between '%s' and '%s'", ref.link_name1.c_str(), ref.link_name2.c_str());
+            return false;
+        case SelfCollisionTable::Status::Unknown:
+            break;
+        }
+    }
+
+    return true;
+}
+
+// Return the self collision pairs of the collision group between links that
+// are not moved by the variables of the joint group, or nullptr if there are
+// none
+auto CollisionRobotSBPL::getStaticPairs(
+    const moveit::core::RobotModel& model,
+    const std::string& group_name,
+    int gidx)
+    -> StaticPairs*
+{
+    auto it = m_static_pairs.find(group_name);
+    if (it == end(m_static_pairs)) {
+        StaticPairs static_pairs;
+        static_pairs.evaluated = false;
+        static_pairs.valid = false;
+
+        auto* jmg = model.getJointModelGroup(group_name);
+        if (jmg) {
+            auto& moving_links = jmg->getUpdatedLinkModelsSet();
+            std::vector<std::string> static_links;
+            for (auto lidx : m_rcm->groupLinkIndices(gidx)) {
+                auto& name = m_rcm->linkName(lidx);
+                auto* link = model.getLinkModel(name);
+                if (link && moving_links.find(link) == end(moving_links)) {
+                    static_links.push_back(name);
+                }
+            }
+
+            for (size_t i = 0; i < static_links.size(); ++i) {
+                for (size_t j = i + 1; j < static_links.size(); ++j) {
+                    static_pairs.pairs.emplace(static_links[i], static_links[j]);
+                    static_pairs.pairs.emplace(static_links[j], static_links[i]);
+                    static_pairs.pair_list.emplace_back(
+                            static_links[i], static_links[j]);
+                }
+            }
+
+            auto& group_vars = jmg->getVariableIndexList();
+            for (size_t vidx = 0; vidx < model.getVariableCount(); ++vidx) {
+                if (std::find(begin(group_vars), end(group_vars), (int)vidx) ==
+                        end(group_vars))
+                {
+                    static_pairs.fixed_var_indices.push_back((int)vidx);
+                }
+            }
+        }
+
+        ROS_DEBUG_NAMED(CRP_LOGGER, "%zu static link pairs for group '%s'", static_pairs.pairs.size() / 2, group_name.c_str());
+        it = m_static_pairs.insert(
+                std::make_pair(group_name, std::move(static_pairs))).first;
+    }
+
+    return it->second.pairs.empty() ? nullptr : &it->second;
+}
+
+// Return whether the static pairs are clear, checking them only if the
+// variables outside the joint group or the allowed collision matrix entries
+// for the pairs have changed since the last check
+bool CollisionRobotSBPL::checkStaticPairs(
+    StaticPairs& static_pairs,
+    moveit::core::RobotState& state,
+    const smpl::collision::AllowedCollisionsInterface& aci,
+    const AllowedCollisionMatrix& acm)
+{
+    // conditional entries may change their answer without any change to the
+    // matrix, so results are never reused with them
+    bool cacheable = true;
+    m_acm_entries.resize(static_pairs.pair_list.size());
+    for (size_t i = 0; i < static_pairs.pair_list.size(); ++i) {
+        auto& pair = static_pairs.pair_list[i];
+        AllowedCollision::Type type;
+        if (!acm.getAllowedCollision(pair.first, pair.second, type)) {
+            m_acm_entries[i] = -1;
+        } else {
+            m_acm_entries[i] = (int)type;
+            cacheable &= type != AllowedCollision::CONDITIONAL;
+        }
+    }
+
+    auto& indices = static_pairs.fixed_var_indices;
+    auto same = cacheable &&
+            static_pairs.evaluated &&
+            static_pairs.acm_entries == m_acm_entries;
+    for (size_t i = 0; same && i < indices.size(); ++i) {
+        same = state.getVariablePosition(indices[i]) == static_pairs.fixed_vars[i];
+    }
+
+    if (same) {
+        return static_pairs.valid;
+    }
+
+    SBPL_TRACE_SPAN("CollisionRobotSBPL::checkStaticPairs");
+
+    static_pairs.fixed_vars.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        static_pairs.fixed_vars[i] = state.getVariablePosition(indices[i]);
+    }
+    static_pairs.acm_entries = m_acm_entries;
+    static_pairs.evaluated = cacheable;
+
+    // the pairs are checked sphere to sphere rather than with the self
+    // collision model, whose checks against the voxelized links outside the
+    // group can not be restricted to the pairs
+    static_pairs.valid = true;
+    for (auto& pair : static_pairs.pair_list) {
+        smpl::collision::AllowedCollision::Type type;
+        if (aci.getEntry(pair.first, pair.second, type) &&
+            type == smpl::collision::AllowedCollision::Type::ALWAYS)
+        {
+            continue;
+        }
+        if (linkSpheresCollide(state, pair.first, pair.second)) {
+            static_pairs.valid = false;
+            break;
+        }
+    }
+    ROS_DEBUG_NAMED(CRP_LOGGER, "Static link pairs clear: %s", static_pairs.valid ? "true" : "false");
+    return static_pairs.valid;
+}
+
+// Return whether any leaf spheres of two links of the robot collision model
+// overlap
+bool CollisionRobotSBPL::linkSpheresCollide(
+    moveit::core::RobotState& state,
+    const std::string& link_name1,
+    const std::string& link_name2) const
+{
+    if (!m_rcm->hasLink(link_name1) || !m_rcm->hasLink(link_name2)) {
+        return false;
+    }
+    auto* spheres1 = m_rcm->linkSpheresModel(m_rcm->linkIndex(link_name1));
+    auto* spheres2 = m_rcm->linkSpheresModel(m_rcm->linkIndex(link_name2));
+    if (!spheres1 || !spheres2) {
+        return false;
+    }
+
+    auto& T1 = state.getGlobalLinkTransform(link_name1);
+    auto& T2 = state.getGlobalLinkTransform(link_name2);
+    for (auto& s1 : spheres1->spheres) {
+        if (!s1.isLeaf()) {
+            continue;
+        }
+        Eigen::Vector3d c1 = T1 * s1.center;
+        for (auto& s2 : spheres2->spheres) {
+            if (!s2.isLeaf()) {
+                continue;
+            }
+            double r = s1.radius + s2.radius;
+            if ((T2 * s2.center - c1).squaredNorm() < r * r) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 double CollisionRobotSBPL::getSelfCollisionPropagationDistance() const
 {
     // TODO: include the attached object models when computing the max expansion
@@ -540,18 +877,29 @@ smpl::OccupancyGridPtr CollisionRobotSBPL::createGridFor(
             ref_counted);
 }
 
-visualization_msgs::MarkerArray
+MarkerBuilder
 CollisionRobotSBPL::getCollisionRobotVisualization(
-    smpl::collision::RobotCollisionState& rcs,
+    const smpl::collision::RobotCollisionState& rcs,
     smpl::collision::AttachedBodiesCollisionState& abcs,
-    int gidx) const
+    int gidx,
+    bool valid) const
 {
-    auto ma = GetCollisionMarkers(rcs, abcs, gidx);
-    for (auto& m : ma.markers) {
-        m.ns = "self_collision";
-        m.header.frame_id = m_rcm->modelFrame();
-    }
-    return ma;
+    auto build = GetCollisionMarkersBuilder(
+            m_rcm, rcs.getJointVarPositions(), abcs, gidx);
+    auto frame_id = m_rcm->modelFrame();
+    return [build, frame_id, valid]()
+    {
+        auto ma = build();
+        for (auto& m : ma.markers) {
+            m.ns = "self_collision";
+            m.header.frame_id = frame_id;
+            if (!valid) {
+                m.color.r = 1.0;
+                m.color.g = m.color.b = 0.0;
+            }
+        }
+        return ma;
+    };
 }
 
 } // namespace collision_detection
@@ -44,6 +44,7 @@
 // module includes
 #include "collision_common_sbpl.h"
 #include "config.h"
+#include "self_collision_table.h"
 
 namespace smpl {
 SBPL_CLASS_FORWARD(OccupancyGrid);
@@ -69,6 +70,10 @@ public:
     auto robotMotionCollisionModel() const
         -> const smpl::collision::RobotMotionCollisionModelConstPtr&;
 
+    /// Return an estimate of the memory, in bytes, held by the self collision
+    /// grid and the self collision tables
+    auto memoryUsage() const -> size_t;
+
     /// \name CollisionRobot Interface
     ///@{
     void checkSelfCollision(
@@ -185,14 +190,92 @@ private:
     smpl::collision::RobotCollisionModelConstPtr m_rcm;
     smpl::collision::RobotMotionCollisionModelConstPtr m_rmcm;
 
+    // initialized on the first check of a copy; see initSelfCollisionModel()
     CollisionStateUpdater m_updater;
+    bool m_updater_initialized;
 
     // self colllision models
     smpl::OccupancyGridPtr m_grid;
     smpl::collision::SelfCollisionModelPtr m_scm;
 
+    // joint-space lookup tables for near-adjacent link pairs, shared between
+    // copies
+    std::shared_ptr<const SelfCollisionTable> m_sc_table;
+
+    // link names in lexicographic order
+    struct TablePairRef
+    {
+        size_t pidx;
+        std::string link_name1;
+        std::string link_name2;
+    };
+
+    // collision group index -> tabulated pairs within the group
+    std::unordered_map<int, std::vector<TablePairRef>> m_sc_table_group_pairs;
+
+    // scratch list of pairs decided by the table during a single check
+    TouchLinkSet m_sc_table_decided;
+
+    // self collision pairs, within the collision group of a joint group,
+    // between links that do not move with the joint group
+    struct StaticPairs
+    {
+        // both orderings of each pair
+        TouchLinkSet pairs;
+
+        // one ordering of each pair
+        std::vector<std::pair<std::string, std::string>> pair_list;
+
+        // variables outside the joint group
+        std::vector<int> fixed_var_indices;
+
+        // the inputs and result of the last check of the pairs. the allowed
+        // collision matrix is recorded by its entries for the pairs, since it
+        // may be modified in place
+        bool evaluated;
+        std::vector<double> fixed_vars;
+        std::vector<int> acm_entries;
+        bool valid;
+    };
+
+    // skip self collision checks of static pairs known to be clear
+    bool m_prune_static_pairs;
+
+    // joint group name -> static pairs; not shared with copies
+    std::unordered_map<std::string, StaticPairs> m_static_pairs;
+    std::vector<int> m_acm_entries;
+
+    bool initSelfCollisionModel();
+
     void setVacuousCollision(CollisionResult& res) const;
 
+    auto getStaticPairs(
+        const moveit::core::RobotModel& model,
+        const std::string& group_name,
+        int gidx)
+        -> StaticPairs*;
+
+    bool checkStaticPairs(
+        StaticPairs& static_pairs,
+        moveit::core::RobotState& state,
+        const smpl::collision::AllowedCollisionsInterface& aci,
+        const AllowedCollisionMatrix& acm);
+
+    bool linkSpheresCollide(
+        moveit::core::RobotState& state,
+        const std::string& link_name1,
+        const std::string& link_name2) const;
+
+    void loadSelfCollisionTable(
+        const ros::NodeHandle& ph,
+        const robot_model::RobotModelConstPtr& model,
+        const std::string& model_config);
+
+    bool checkSelfCollisionTable(
+        const moveit::core::RobotState& state,
+        const smpl::collision::AllowedCollisionsInterface& aci,
+        int gidx);
+
     void checkSelfCollisionMutable(
         const CollisionRequest& req,
         CollisionResult& res,
@@ -213,11 +296,11 @@ private:
     smpl::OccupancyGridPtr createGridFor(
         const CollisionGridConfig& config) const;
 
-    visualization_msgs::MarkerArray
-    getCollisionRobotVisualization(
-        smpl::collision::RobotCollisionState& rcs,
+    MarkerBuilder getCollisionRobotVisualization(
+        const smpl::collision::RobotCollisionState& rcs,
         smpl::collision::AttachedBodiesCollisionState& abcs,
-        int gidx) const;
+        int gidx,
+        bool valid) const;
 };
 
 } // namespace collision_detection
@@ -32,15 +32,21 @@
 #include "collision_world_sbpl.h"
 
 // standard includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <stdexcept>
+#include <thread>
 
 // system includes
 #include <ros/ros.h>
 #include <geometric_shapes/shape_operations.h>
+#include <sbpl_collision_checking/voxelize_world_object.h>
 #include <smpl/debug/visualize.h>
 
 // module includes
 #include "collision_common_sbpl.h"
+#include "trace.h"
 
 namespace collision_detection {
 
@@ -73,8 +79,19 @@ CollisionWorldSBPL::CollisionWorldSBPL(
 
     m_parent_grid = other.m_grid ? other.m_grid : other.m_parent_grid;
     m_parent_wcm = other.m_wcm ? other.m_wcm : other.m_parent_wcm;
+    m_parent_pyramid = other.m_pyramid ? other.m_pyramid : other.m_parent_pyramid;
+    m_broad_phase = other.m_broad_phase;
+    m_broad_phase_padding = other.m_broad_phase_padding;
 
-    m_updaters = other.m_updaters;
+    // NOTE: the shared voxel ring is consumed only by the original world
+    m_voxels = other.m_voxels;
+    m_voxel_version = other.m_voxel_version;
+    m_voxel_decay = other.m_voxel_decay;
+
+    m_predicted = other.m_predicted;
+
+    // NOTE: collision state updaters are created on demand rather than shared
+    // with the parent, so that copies may be checked from different threads
     // NOTE: no need to copy observer handle
     registerWorldCallback();
     // NOTE: no need to copy node handle
@@ -103,12 +120,182 @@ auto CollisionWorldSBPL::distanceField(
     }
 }
 
+auto CollisionWorldSBPL::sharedDistanceField() const
+    -> std::shared_ptr<const smpl::DistanceMapInterface>
+{
+    if (m_grid) {
+        return m_grid->getDistanceField();
+    } else if (m_parent_grid) {
+        return m_parent_grid->getDistanceField();
+    } else {
+        return nullptr;
+    }
+}
+
+auto CollisionWorldSBPL::memoryUsage() const -> size_t
+{
+    size_t pyramid_size = 0;
+    if (m_pyramid) {
+        pyramid_size = m_pyramid->memoryUsage();
+    } else if (m_parent_pyramid) {
+        pyramid_size = m_parent_pyramid->memoryUsage();
+    }
+
+    if (m_grid) {
+        return GridMemoryUsage(*m_grid) + pyramid_size;
+    } else if (m_parent_grid) {
+        return GridMemoryUsage(*m_parent_grid) + pyramid_size;
+    } else {
+        return 0;
+    }
+}
+
+int CollisionWorldSBPL::checkTrajectoryCollision(
+    const CollisionRequest& req,
+    const CollisionRobot& robot,
+    const robot_trajectory::RobotTrajectory& traj,
+    const AllowedCollisionMatrix& acm,
+    size_t start_index,
+    int thread_count) const
+{
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::checkTrajectoryCollision");
+
+    return const_cast<CollisionWorldSBPL*>(this)->checkTrajectoryCollisionMutable(
+            req, robot, traj, acm, start_index, thread_count);
+}
+
+void CollisionWorldSBPL::setMonitoredTrajectory(
+    const CollisionRobotConstPtr& robot,
+    const robot_trajectory::RobotTrajectoryConstPtr& traj,
+    const std::string& group_name,
+    const TrajectoryInvalidatedCallback& callback,
+    double index_res)
+{
+    if (!robot || !traj || traj->empty()) {
+        clearMonitoredTrajectory();
+        return;
+    }
+
+    m_monitor.reset(new TrajectoryMonitor);
+    m_monitor->robot = robot;
+    m_monitor->traj = traj;
+    m_monitor->group_name = group_name;
+    m_monitor->callback = callback;
+    m_monitor->res = index_res;
+
+    indexMonitoredTrajectory();
+
+    const int segment_count = (int)m_monitor->invalid.size();
+    m_monitor->first_invalid = -1;
+    for (int sidx = 0; sidx < segment_count; ++sidx) {
+        if (!checkMonitoredSegment(sidx)) {
+            m_monitor->invalid[sidx] = true;
+            if (m_monitor->first_invalid < 0) {
+                m_monitor->first_invalid = sidx;
+            }
+        }
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Monitor trajectory of %d segments in %zu cells", segment_count, m_monitor->index.size());
+}
+
+void CollisionWorldSBPL::clearMonitoredTrajectory()
+{
+    m_monitor.reset();
+}
+
+int CollisionWorldSBPL::monitoredTrajectoryFirstInvalid() const
+{
+    return m_monitor ? m_monitor->first_invalid : -1;
+}
+
+bool CollisionWorldSBPL::consumeVoxelUpdates()
+{
+    if (!m_voxel_ring) {
+        return false;
+    }
+
+    if (!m_voxel_ring->isOpen() && !m_voxel_ring->open(m_voxel_ring_name)) {
+        return false;
+    }
+
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::consumeVoxelUpdates");
+
+    copyOnWrite();
+
+    // bound the work done per call in case the producer outpaces us
+    const int max_batches = 1024;
+
+    auto now = VoxelClock::now();
+
+    int count = 0;
+    SharedVoxelRing::Batch batch;
+    while (count < max_batches && m_voxel_ring->peek(batch)) {
+        applyVoxelBatch(batch, now);
+        m_voxel_ring->pop();
+        ++count;
+    }
+
+    if (count > 0) {
+        ROS_DEBUG_NAMED(LOG, "Applied %d voxel batches (%zu occupied cells)", count, m_voxels->size());
+    }
+
+    auto expired = m_voxel_decay > 0.0 ? expireVoxels(now) : 0;
+
+    if (count > 0 || expired > 0) {
+        ++m_voxel_version;
+    }
+    return count > 0 || expired > 0;
+}
+
+bool CollisionWorldSBPL::voxelUpdatesPending() const
+{
+    if (!m_voxel_ring) {
+        return false;
+    }
+
+    // the ring may not have been created when this world was constructed.
+    // attaching to it does not modify the world.
+    if (!m_voxel_ring->isOpen() && !m_voxel_ring->open(m_voxel_ring_name)) {
+        return false;
+    }
+
+    if (m_voxel_ring->pending()) {
+        return true;
+    }
+
+    if (m_voxel_decay > 0.0 && !m_voxel_expiry.empty()) {
+        auto decay = std::chrono::duration_cast<VoxelClock::duration>(
+                std::chrono::duration<double>(m_voxel_decay));
+        return m_voxel_expiry.front().first + decay <= VoxelClock::now();
+    }
+    return false;
+}
+
+void CollisionWorldSBPL::setPredictedObstacles(PredictedObstacles obstacles)
+{
+    if (obstacles.dt <= 0.0 || obstacles.layers.empty()) {
+        clearPredictedObstacles();
+        return;
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Set %zu layers of predicted obstacles", obstacles.layers.size());
+    m_predicted = std::make_shared<const PredictedObstacles>(std::move(obstacles));
+}
+
+void CollisionWorldSBPL::clearPredictedObstacles()
+{
+    m_predicted.reset();
+}
+
 void CollisionWorldSBPL::checkRobotCollision(
     const CollisionRequest& req,
     CollisionResult& res,
     const CollisionRobot& robot,
     const robot_state::RobotState& state) const
 {
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::checkRobotCollision");
+
     ROS_INFO_NAMED(LOG, "checkRobotCollision(req, res, robot, state)");
 
     const_cast<CollisionWorldSBPL*>(this)->checkRobotCollisionMutable(
@@ -122,6 +309,8 @@ void CollisionWorldSBPL::checkRobotCollision(
     const robot_state::RobotState& state,
     const AllowedCollisionMatrix& acm) const
 {
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::checkRobotCollision");
+
     const_cast<CollisionWorldSBPL*>(this)->checkRobotCollisionMutable(
             req, res, robot, state, acm);
 }
@@ -133,6 +322,8 @@ void CollisionWorldSBPL::checkRobotCollision(
     const robot_state::RobotState& state1,
     const robot_state::RobotState& state2) const
 {
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::checkRobotCollision");
+
     ROS_INFO_NAMED(LOG, "checkRobotCollision(req, res, robot, state1, state2)");
 
     const_cast<CollisionWorldSBPL*>(this)->checkRobotCollisionMutable(
@@ -147,6 +338,8 @@ void CollisionWorldSBPL::checkRobotCollision(
     const robot_state::RobotState& state2,
     const AllowedCollisionMatrix& acm) const
 {
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::checkRobotCollision");
+
     const_cast<CollisionWorldSBPL*>(this)->checkRobotCollisionMutable(
             req, res, robot, state1, state2, acm);
 }
@@ -259,6 +452,21 @@ void CollisionWorldSBPL::construct()
     m_grid = createGridFor(m_wcm_config);
     m_wcm = std::make_shared<smpl::collision::WorldCollisionModel>(m_grid.get());
 
+    // built on the first check
+    m_pyramid = std::make_shared<OccupancyPyramid>();
+    ph.param("broad_phase/enabled", m_broad_phase, true);
+    ph.param("broad_phase/padding", m_broad_phase_padding, 0.05);
+
+    m_voxels = std::make_shared<VoxelStampMap>();
+    m_voxel_version = 0;
+    ph.param("shared_world/name", m_voxel_ring_name, std::string());
+    ph.param("shared_world/voxel_decay", m_voxel_decay, 0.0);
+    if (!m_voxel_ring_name.empty()) {
+        // the producer may not have created the ring yet; retry on consume
+        m_voxel_ring.reset(new SharedVoxelRing);
+        m_voxel_ring->open(m_voxel_ring_name);
+    }
+
     // TODO: allowed collisions matrix
 
     ROS_INFO("Sleep to allow publish to set up");
@@ -286,6 +494,30 @@ void CollisionWorldSBPL::copyOnWrite()
             m_parent_grid.reset();
             m_parent_wcm.reset();
         }
+
+        // the new grid starts with the parent's occupancy, and the copy of
+        // the parent's pyramid is updated with the object that prompted the
+        // copy
+        if (m_parent_pyramid && m_parent_pyramid->valid()) {
+            m_pyramid = std::make_shared<OccupancyPyramid>(*m_parent_pyramid);
+        } else {
+            m_pyramid = std::make_shared<OccupancyPyramid>();
+        }
+        m_parent_pyramid.reset();
+
+        // carry over voxels from the shared voxel ring
+        if (m_voxels && !m_voxels->empty()) {
+            m_voxel_points.clear();
+            for (auto& entry : *m_voxels) {
+                int gx = (int)((entry.first >> 42) & ((1 << 21) - 1));
+                int gy = (int)((entry.first >> 21) & ((1 << 21) - 1));
+                int gz = (int)(entry.first & ((1 << 21) - 1));
+                double wx, wy, wz;
+                m_grid->gridToWorld(gx, gy, gz, wx, wy, wz);
+                m_voxel_points.emplace_back(wx, wy, wz);
+            }
+            m_grid->addPointsToField(m_voxel_points);
+        }
     }
 }
 
@@ -358,6 +590,8 @@ void CollisionWorldSBPL::worldUpdate(
     const World::ObjectConstPtr& object,
     World::Action action)
 {
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::worldUpdate");
+
     ROS_DEBUG_NAMED(LOG, "CollisionWorldSBPL::worldUpdate()");
     ROS_DEBUG_NAMED(LOG, "  id: %s", object->id_.c_str());
     ROS_DEBUG_NAMED(LOG, "  shapes: %zu", object->shapes_.size());
@@ -386,6 +620,59 @@ void CollisionWorldSBPL::worldUpdate(
         ROS_DEBUG_NAMED(LOG, "  action: REMOVE_SHAPE");
         processWorldUpdateRemoveShape(object);
     }
+
+    if (m_pyramid && m_pyramid->valid()) {
+        updatePyramid(object, action);
+    }
+
+    if (m_monitor && !(action & World::ActionBits::UNINITIALIZED)) {
+        const bool removed =
+                (action & World::ActionBits::DESTROY) ||
+                (action & World::ActionBits::REMOVE_SHAPE);
+        // the segments invalidated by the object at its old pose may have
+        // become valid
+        const bool moved = action & World::ActionBits::MOVE_SHAPE;
+        updateMonitoredTrajectory(removed ? nullptr : object, moved);
+    }
+}
+
+// Update the pyramid for the cells of an object that was created, destroyed,
+// or given new shapes. The cells an object occupied before it was moved or
+// lost a shape are not known here, so those changes invalidate the pyramid,
+// as do shapes without a bounded voxelization.
+void CollisionWorldSBPL::updatePyramid(
+    const World::ObjectConstPtr& object,
+    World::Action action)
+{
+    if (action & World::ActionBits::UNINITIALIZED) {
+        return;
+    }
+
+    const bool known =
+            (action & World::ActionBits::CREATE) ||
+            (action & World::ActionBits::DESTROY) ||
+            (!(action & World::ActionBits::MOVE_SHAPE) &&
+                    (action & World::ActionBits::ADD_SHAPE));
+    if (!known) {
+        m_pyramid->invalidate();
+        return;
+    }
+
+    for (auto& shape : object->shapes_) {
+        if (shape->type == shapes::OCTREE || shape->type == shapes::PLANE) {
+            m_pyramid->invalidate();
+            return;
+        }
+    }
+
+    Eigen::Vector3d grid_origin(
+            m_grid->originX(), m_grid->originY(), m_grid->originZ());
+    std::vector<std::vector<Eigen::Vector3d>> voxelses;
+    smpl::collision::VoxelizeObject(
+            *object, m_grid->resolution(), grid_origin, voxelses);
+    for (auto& voxels : voxelses) {
+        m_pyramid->update(*m_grid, voxels);
+    }
 }
 
 void CollisionWorldSBPL::setVacuousCollision(CollisionResult& res) const
@@ -460,6 +747,130 @@ bool CollisionWorldSBPL::emptyBoundingBox(
     return bb.extents.x == 0.0 && bb.extents.y == 0.0 && bb.extents.z == 0.0;
 }
 
+// Return true if the bounding spheres of the collision spheres of the links of
+// the collision group, and the padded bounding spheres of the bodies attached
+// to the robot, are clear of occupied cells. The spheres are first cleared
+// together by their enclosing sphere.
+bool CollisionWorldSBPL::checkBroadPhase(
+    const smpl::collision::RobotCollisionModel& rcm,
+    const moveit::core::RobotState& state,
+    const std::string& collision_group_name,
+    int gidx)
+{
+    const smpl::OccupancyGrid* grid;
+    OccupancyPyramid* pyramid;
+    if (m_grid) {
+        grid = m_grid.get();
+        pyramid = m_pyramid.get();
+    } else if (m_parent_grid) {
+        grid = m_parent_grid.get();
+        pyramid = m_parent_pyramid.get();
+    } else {
+        return false;
+    }
+
+    if (!pyramid || state.dirty()) {
+        return false;
+    }
+
+    if (!pyramid->valid()) {
+        // the pyramid may be shared with copies checked from other threads
+        SBPL_TRACE_SPAN("CollisionWorldSBPL::buildPyramid");
+        pyramid->buildIfInvalid(*grid);
+    }
+
+    auto it = m_broad_phase_spheres.find(collision_group_name);
+    if (it == end(m_broad_phase_spheres)) {
+        // bound the spheres of each link in the robot collision model, which
+        // are what the per-sphere check tests, rather than the link's
+        // collision geometry, which a link may not have
+        std::vector<BroadPhaseSphere> spheres;
+        auto& model = *state.getRobotModel();
+        for (auto lidx : rcm.groupLinkIndices(gidx)) {
+            auto* spheres_model = rcm.linkSpheresModel(lidx);
+            if (!spheres_model) {
+                continue;
+            }
+            auto* link = model.getLinkModel(rcm.linkName(lidx));
+            if (!link) {
+                // the link's spheres can not be placed; check every sphere
+                return false;
+            }
+
+            Eigen::Vector3d center(Eigen::Vector3d::Zero());
+            size_t count = 0;
+            for (auto& sphere : spheres_model->spheres) {
+                center += sphere.center;
+                ++count;
+            }
+            if (count == 0) {
+                continue;
+            }
+            center /= (double)count;
+
+            double radius = 0.0;
+            for (auto& sphere : spheres_model->spheres) {
+                radius = std::max(
+                        radius, (sphere.center - center).norm() + sphere.radius);
+            }
+            spheres.push_back({ link, center, radius });
+        }
+        it = m_broad_phase_spheres.insert(
+                std::make_pair(collision_group_name, std::move(spheres))).first;
+    }
+
+    // spheres in the world frame
+    m_broad_phase_scratch.clear();
+    for (auto& sphere : it->second) {
+        m_broad_phase_scratch.push_back({
+                sphere.link,
+                state.getGlobalLinkTransform(sphere.link) * sphere.center,
+                sphere.radius });
+    }
+
+    std::vector<const moveit::core::AttachedBody*> attached_bodies;
+    state.getAttachedBodies(attached_bodies);
+    for (auto* ab : attached_bodies) {
+        auto& shapes = ab->getShapes();
+        auto& transforms = ab->getGlobalCollisionBodyTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            m_broad_phase_scratch.push_back({
+                    ab->getAttachedLink(),
+                    transforms[i] * center,
+                    radius + m_broad_phase_padding });
+        }
+    }
+
+    if (m_broad_phase_scratch.empty()) {
+        return false;
+    }
+
+    Eigen::Vector3d center(Eigen::Vector3d::Zero());
+    for (auto& sphere : m_broad_phase_scratch) {
+        center += sphere.center;
+    }
+    center /= (double)m_broad_phase_scratch.size();
+
+    double radius = 0.0;
+    for (auto& sphere : m_broad_phase_scratch) {
+        radius = std::max(radius, (sphere.center - center).norm() + sphere.radius);
+    }
+
+    if (pyramid->isSphereFree(*grid, center, radius)) {
+        return true;
+    }
+
+    for (auto& sphere : m_broad_phase_scratch) {
+        if (!pyramid->isSphereFree(*grid, sphere.center, sphere.radius)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void CollisionWorldSBPL::checkRobotCollisionMutable(
     const CollisionRequest& req,
     CollisionResult& res,
@@ -508,6 +919,13 @@ void CollisionWorldSBPL::checkRobotCollisionMutable(
 
     int gidx = rcm->groupIndex(collision_group_name);
 
+    // distances and visualizations require the per-sphere check
+    if (m_broad_phase && !req.distance && !req.verbose &&
+        checkBroadPhase(*rcm, state, collision_group_name, gidx))
+    {
+        return;
+    }
+
     gm->update(state);
 
     smpl::collision::WorldCollisionModelConstPtr ewcm;
@@ -534,17 +952,12 @@ void CollisionWorldSBPL::checkRobotCollisionMutable(
 
     const bool visualize = req.verbose;
     if (visualize) {
-        auto ma = getCollisionRobotVisualization(
+        ShowDeferred("world_collision", getCollisionRobotVisualization(
+                rcm,
                 *gm->collisionState(),
                 *gm->attachedBodiesCollisionState(),
-                gidx);
-        if (!valid) {
-            for (auto& m : ma.markers) {
-                m.color.r = 1.0;
-                m.color.g = m.color.b = 0.0;
-            }
-        }
-        SV_SHOW_INFO(ma);
+                gidx,
+                valid));
     }
 
     if (!valid) {
@@ -636,17 +1049,12 @@ void CollisionWorldSBPL::checkRobotCollisionMutable(
 
     const bool visualize = req.verbose;
     if (visualize) {
-        auto ma = getCollisionRobotVisualization(
+        ShowDeferred("world_collision", getCollisionRobotVisualization(
+                rcm,
                 *gm->collisionState(),
                 *gm->attachedBodiesCollisionState(),
-                gidx);
-        if (!valid) {
-            for (auto& m : ma.markers) {
-                m.color.r = 1.0;
-                m.color.g = m.color.b = 0.0;
-            }
-        }
-        SV_SHOW_INFO(ma);
+                gidx,
+                valid));
     }
 
     if (!valid) {
@@ -663,6 +1071,487 @@ void CollisionWorldSBPL::checkRobotCollisionMutable(
     }
 }
 
+int CollisionWorldSBPL::checkTrajectoryCollisionMutable(
+    const CollisionRequest& req,
+    const CollisionRobot& robot,
+    const robot_trajectory::RobotTrajectory& traj,
+    const AllowedCollisionMatrix& acm,
+    size_t start_index,
+    int thread_count)
+{
+    const size_t waypoint_count = traj.getWayPointCount();
+    if (start_index >= waypoint_count) {
+        return -1;
+    }
+
+    if (waypoint_count - start_index == 1) {
+        CollisionResult res;
+        checkRobotCollisionMutable(
+                req, res, robot, traj.getWayPoint(start_index), acm);
+        return res.collision ? (int)start_index : -1;
+    }
+
+    const CollisionRobotSBPL& crobot = (const CollisionRobotSBPL&)robot;
+    const auto& rcm = crobot.robotCollisionModel();
+    const auto& rmcm = crobot.robotMotionCollisionModel();
+    auto& robot_model = *traj.getRobotModel();
+
+    if (robot_model.getName() != rcm->name()) {
+        ROS_ERROR_NAMED(LOG, "Collision Robot Model does not match Robot Model");
+        return (int)start_index;
+    }
+
+    auto jgcgit = m_jcgm_map.find(req.group_name);
+    auto& collision_group_name = jgcgit == end(m_jcgm_map) ?
+            req.group_name : jgcgit->second;
+
+    if (!rcm->hasGroup(collision_group_name)) {
+        ROS_ERROR_NAMED(LOG, "No group '%s' found in the Robot Collision Model", collision_group_name.c_str());
+        return (int)start_index;
+    }
+
+    int gidx = rcm->groupIndex(collision_group_name);
+
+    smpl::collision::WorldCollisionModelConstPtr ewcm;
+    if (m_wcm) {
+        ewcm = m_wcm;
+    } else if (m_parent_wcm) {
+        ewcm = m_parent_wcm;
+    } else {
+        ROS_ERROR_NAMED(LOG, "Neither local nor parent world collision model valid");
+        return (int)start_index;
+    }
+
+    const size_t segment_count = waypoint_count - start_index - 1;
+
+    if (thread_count <= 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    thread_count = (int)std::min<size_t>(thread_count, segment_count);
+
+    // each thread owns its own collision state
+    auto& updaters = m_traj_updaters[robot_model.getName()];
+    while (updaters.size() < (size_t)thread_count) {
+        auto gm = std::make_shared<CollisionStateUpdater>();
+        if (!gm->init(robot_model, rcm)) {
+            ROS_ERROR_NAMED(LOG, "Failed to initialize collision state updater for trajectory validation");
+            return (int)start_index;
+        }
+        updaters.push_back(std::move(gm));
+    }
+
+    // segments are claimed in order, so once a segment is found invalid, only
+    // segments that were claimed before it need to be finished
+    std::atomic<size_t> next_segment(0);
+    std::atomic<size_t> first_invalid(segment_count);
+
+    auto check_segments = [&](CollisionStateUpdater& gm)
+    {
+        smpl::collision::WorldCollisionDetector wcd(rcm.get(), ewcm.get());
+
+        // attached bodies do not change along the trajectory
+        gm.update(traj.getWayPoint(start_index));
+
+        std::vector<double> startvars;
+        std::vector<double> goalvars;
+        while (true) {
+            size_t sidx = next_segment++;
+            if (sidx >= first_invalid.load()) {
+                break;
+            }
+
+            size_t widx = start_index + sidx;
+            startvars = gm.getVariablesFor(traj.getWayPoint(widx));
+            goalvars = gm.getVariablesFor(traj.getWayPoint(widx + 1));
+
+            double dist;
+            bool valid = wcd.checkMotionCollision(
+                    *gm.collisionState(),
+                    *gm.attachedBodiesCollisionState(),
+                    *rmcm,
+                    startvars,
+                    goalvars,
+                    gidx,
+                    dist);
+            if (!valid) {
+                size_t curr = first_invalid.load();
+                while (sidx < curr &&
+                    !first_invalid.compare_exchange_weak(curr, sidx))
+                {
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (int tidx = 1; tidx < thread_count; ++tidx) {
+        threads.emplace_back(check_segments, std::ref(*updaters[tidx]));
+    }
+    check_segments(*updaters[0]);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (first_invalid.load() == segment_count) {
+        return -1;
+    }
+
+    int invalid_index = (int)(start_index + first_invalid.load());
+    ROS_DEBUG_NAMED(LOG, "Trajectory segment %d is in collision", invalid_index);
+    return invalid_index;
+}
+
+void CollisionWorldSBPL::applyVoxelBatch(
+    const SharedVoxelRing::Batch& batch,
+    VoxelClock::time_point now)
+{
+    if (m_voxels.use_count() > 1) {
+        m_voxels = std::make_shared<VoxelStampMap>(*m_voxels);
+    }
+
+    const bool add = batch.op == SharedVoxelRing::Op::Add;
+
+    std::vector<uint64_t>* added = nullptr;
+    if (add && m_voxel_decay > 0.0) {
+        if (m_voxel_expiry.empty() || m_voxel_expiry.back().first != now) {
+            m_voxel_expiry.emplace_back(now, std::vector<uint64_t>());
+        }
+        added = &m_voxel_expiry.back().second;
+    }
+
+    // only cells that become occupied or free are passed on to the grid
+    m_voxel_points.clear();
+    for (uint32_t i = 0; i < batch.count; ++i) {
+        double wx = batch.points[3 * i + 0];
+        double wy = batch.points[3 * i + 1];
+        double wz = batch.points[3 * i + 2];
+        int gx, gy, gz;
+        m_grid->worldToGrid(wx, wy, wz, gx, gy, gz);
+        if (!m_grid->isInBounds(gx, gy, gz)) {
+            continue;
+        }
+
+        uint64_t key = ((uint64_t)gx << 42) | ((uint64_t)gy << 21) | (uint64_t)gz;
+        if (add) {
+            auto ent = m_voxels->emplace(key, now);
+            if (ent.second) {
+                m_voxel_points.emplace_back(wx, wy, wz);
+            }
+            if (added && (ent.second || ent.first->second != now)) {
+                added->push_back(key);
+            }
+            ent.first->second = now;
+        } else if (m_voxels->erase(key)) {
+            m_voxel_points.emplace_back(wx, wy, wz);
+        }
+    }
+
+    if (m_voxel_points.empty()) {
+        return;
+    }
+
+    if (add) {
+        m_grid->addPointsToField(m_voxel_points);
+        m_pyramid->update(*m_grid, m_voxel_points);
+    } else {
+        removeVoxelCells(m_voxel_points);
+    }
+}
+
+// Remove cells no longer occupied by voxels from the grid. The grid is
+// ref-counted, so the cells also occupied by world objects remain occupied.
+void CollisionWorldSBPL::removeVoxelCells(
+    const std::vector<Eigen::Vector3d>& points)
+{
+    m_grid->removePointsFromField(points);
+    m_pyramid->update(*m_grid, points);
+}
+
+// Remove the cells not added since the decay time and return the number of
+// cells removed
+auto CollisionWorldSBPL::expireVoxels(VoxelClock::time_point now) -> size_t
+{
+    auto decay = std::chrono::duration_cast<VoxelClock::duration>(
+            std::chrono::duration<double>(m_voxel_decay));
+
+    if (m_voxel_expiry.empty() || m_voxel_expiry.front().first + decay > now) {
+        return 0;
+    }
+
+    SBPL_TRACE_SPAN("CollisionWorldSBPL::expireVoxels");
+
+    if (m_voxels.use_count() > 1) {
+        m_voxels = std::make_shared<VoxelStampMap>(*m_voxels);
+    }
+
+    size_t expired = 0;
+    m_voxel_points.clear();
+    while (!m_voxel_expiry.empty() &&
+        m_voxel_expiry.front().first + decay <= now)
+    {
+        for (auto key : m_voxel_expiry.front().second) {
+            // cells added again since are also listed in a later bucket
+            auto it = m_voxels->find(key);
+            if (it == end(*m_voxels) || it->second + decay > now) {
+                continue;
+            }
+
+            int gx = (int)((key >> 42) & ((1 << 21) - 1));
+            int gy = (int)((key >> 21) & ((1 << 21) - 1));
+            int gz = (int)(key & ((1 << 21) - 1));
+            double wx, wy, wz;
+            m_grid->gridToWorld(gx, gy, gz, wx, wy, wz);
+            m_voxel_points.emplace_back(wx, wy, wz);
+            m_voxels->erase(it);
+            ++expired;
+        }
+        m_voxel_expiry.pop_front();
+    }
+
+    if (!m_voxel_points.empty()) {
+        removeVoxelCells(m_voxel_points);
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Expired %zu voxels (%zu occupied cells)", expired, m_voxels->size());
+    return expired;
+}
+
+auto CollisionWorldSBPL::monitorCellKey(const Eigen::Vector3d& p) const
+    -> uint64_t
+{
+    const int64_t offset = 1 << 20;
+    const uint64_t mask = (1 << 21) - 1;
+    uint64_t x = (uint64_t)((int64_t)std::floor(p.x() / m_monitor->res) + offset) & mask;
+    uint64_t y = (uint64_t)((int64_t)std::floor(p.y() / m_monitor->res) + offset) & mask;
+    uint64_t z = (uint64_t)((int64_t)std::floor(p.z() / m_monitor->res) + offset) & mask;
+    return (x << 42) | (y << 21) | z;
+}
+
+// Record the coarse cells touched by the swept volume of each segment of the
+// monitored trajectory. The swept volume of a segment is approximated by the
+// bounding spheres of each collision shape at both endpoints, inflated by half
+// the distance traveled by the sphere over the segment.
+void CollisionWorldSBPL::indexMonitoredTrajectory()
+{
+    auto& traj = *m_monitor->traj;
+    auto& model = *traj.getRobotModel();
+
+    struct BodySphere
+    {
+        const moveit::core::LinkModel* link;
+        Eigen::Vector3d center; // in the link frame
+        double radius;
+    };
+
+    std::vector<BodySphere> body_spheres;
+    for (auto* link : model.getLinkModelsWithCollisionGeometry()) {
+        auto& shapes = link->getShapes();
+        auto& origins = link->getCollisionOriginTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            body_spheres.push_back({ link, origins[i] * center, radius });
+        }
+    }
+
+    std::vector<const moveit::core::AttachedBody*> attached_bodies;
+    traj.getWayPoint(0).getAttachedBodies(attached_bodies);
+    for (auto* ab : attached_bodies) {
+        auto& shapes = ab->getShapes();
+        auto& transforms = ab->getFixedTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            body_spheres.push_back(
+                    { ab->getAttachedLink(), transforms[i] * center, radius });
+        }
+    }
+
+    const size_t waypoint_count = traj.getWayPointCount();
+    const size_t segment_count = std::max<size_t>(1, waypoint_count - 1);
+
+    m_monitor->index.clear();
+    m_monitor->invalid.assign(segment_count, false);
+
+    auto sphere_centers = [&](size_t widx, std::vector<Eigen::Vector3d>& centers)
+    {
+        moveit::core::RobotState state(traj.getWayPoint(widx));
+        state.updateLinkTransforms();
+        centers.clear();
+        for (auto& bs : body_spheres) {
+            centers.push_back(state.getGlobalLinkTransform(bs.link) * bs.center);
+        }
+    };
+
+    std::vector<Eigen::Vector3d> prev_centers;
+    std::vector<Eigen::Vector3d> curr_centers;
+    sphere_centers(0, prev_centers);
+    for (size_t sidx = 0; sidx < segment_count; ++sidx) {
+        if (sidx + 1 < waypoint_count) {
+            sphere_centers(sidx + 1, curr_centers);
+        } else {
+            curr_centers = prev_centers;
+        }
+
+        for (size_t bidx = 0; bidx < body_spheres.size(); ++bidx) {
+            auto& c0 = prev_centers[bidx];
+            auto& c1 = curr_centers[bidx];
+            double r = body_spheres[bidx].radius + 0.5 * (c1 - c0).norm();
+            Eigen::Vector3d min = c0.cwiseMin(c1) - Eigen::Vector3d::Constant(r);
+            Eigen::Vector3d max = c0.cwiseMax(c1) + Eigen::Vector3d::Constant(r);
+
+            const double res = m_monitor->res;
+            for (double x = min.x(); x < max.x() + res; x += res) {
+            for (double y = min.y(); y < max.y() + res; y += res) {
+            for (double z = min.z(); z < max.z() + res; z += res) {
+                Eigen::Vector3d p(
+                        std::min(x, max.x()),
+                        std::min(y, max.y()),
+                        std::min(z, max.z()));
+                auto& segments = m_monitor->index[monitorCellKey(p)];
+                if (segments.empty() || segments.back() != (int)sidx) {
+                    segments.push_back((int)sidx);
+                }
+            }
+            }
+            }
+        }
+
+        std::swap(prev_centers, curr_centers);
+    }
+}
+
+// Recheck the segments of the monitored trajectory affected by a change to an
+// object. Objects that were added or moved may only invalidate segments whose
+// swept volume intersects them; removals (indicated by a null object) may
+// only revalidate segments that are currently invalid.
+// Recheck the segments of the monitored trajectory whose swept volume touches
+// the bounding spheres of the shapes of object, and, if recheck_invalid is set
+// or object is null, i.e. removed, the segments currently invalid
+void CollisionWorldSBPL::updateMonitoredTrajectory(
+    const World::ObjectConstPtr& object,
+    bool recheck_invalid)
+{
+    const int segment_count = (int)m_monitor->invalid.size();
+    std::vector<bool> affected(segment_count, false);
+    if (!object || recheck_invalid) {
+        affected = m_monitor->invalid;
+    }
+
+    if (object) {
+        for (size_t i = 0; i < object->shapes_.size(); ++i) {
+            auto& shape = object->shapes_[i];
+            if (shape->type == shapes::OCTREE || shape->type == shapes::PLANE) {
+                // no useful bound on the changed region
+                affected.assign(segment_count, true);
+                break;
+            }
+
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shape.get(), center, radius);
+            center = object->shape_poses_[i] * center;
+
+            const double res = m_monitor->res;
+            for (double x = center.x() - radius; x < center.x() + radius + res; x += res) {
+            for (double y = center.y() - radius; y < center.y() + radius + res; y += res) {
+            for (double z = center.z() - radius; z < center.z() + radius + res; z += res) {
+                Eigen::Vector3d p(
+                        std::min(x, center.x() + radius),
+                        std::min(y, center.y() + radius),
+                        std::min(z, center.z() + radius));
+                auto it = m_monitor->index.find(monitorCellKey(p));
+                if (it == end(m_monitor->index)) {
+                    continue;
+                }
+                for (int sidx : it->second) {
+                    affected[sidx] = true;
+                }
+            }
+            }
+            }
+        }
+    }
+
+    int recheck_count = 0;
+    for (int sidx = 0; sidx < segment_count; ++sidx) {
+        if (affected[sidx]) {
+            m_monitor->invalid[sidx] = !checkMonitoredSegment(sidx);
+            ++recheck_count;
+        }
+    }
+
+    int first_invalid = -1;
+    for (int sidx = 0; sidx < segment_count; ++sidx) {
+        if (m_monitor->invalid[sidx]) {
+            first_invalid = sidx;
+            break;
+        }
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Rechecked %d/%d monitored segments", recheck_count, segment_count);
+
+    if (first_invalid != m_monitor->first_invalid) {
+        m_monitor->first_invalid = first_invalid;
+        if (m_monitor->callback) {
+            m_monitor->callback(first_invalid);
+        }
+    }
+}
+
+bool CollisionWorldSBPL::checkMonitoredSegment(int sidx)
+{
+    auto& traj = *m_monitor->traj;
+    auto& state1 = traj.getWayPoint(sidx);
+    auto& state2 = traj.getWayPoint(
+            std::min<size_t>(sidx + 1, traj.getWayPointCount() - 1));
+
+    const CollisionRobotSBPL& crobot = (const CollisionRobotSBPL&)*m_monitor->robot;
+    const auto& rcm = crobot.robotCollisionModel();
+    const auto& rmcm = crobot.robotMotionCollisionModel();
+
+    auto gm = getCollisionStateUpdater(crobot, *traj.getRobotModel());
+    if (!gm) {
+        return false;
+    }
+
+    auto jgcgit = m_jcgm_map.find(m_monitor->group_name);
+    auto& collision_group_name = jgcgit == end(m_jcgm_map) ?
+            m_monitor->group_name : jgcgit->second;
+    if (!rcm->hasGroup(collision_group_name)) {
+        ROS_ERROR_NAMED(LOG, "No group '%s' found in the Robot Collision Model", collision_group_name.c_str());
+        return false;
+    }
+    int gidx = rcm->groupIndex(collision_group_name);
+
+    smpl::collision::WorldCollisionModelConstPtr ewcm;
+    if (m_wcm) {
+        ewcm = m_wcm;
+    } else if (m_parent_wcm) {
+        ewcm = m_parent_wcm;
+    } else {
+        return false;
+    }
+    smpl::collision::WorldCollisionDetector wcd(rcm.get(), ewcm.get());
+
+    gm->update(state1);
+
+    const std::vector<double> startvars(gm->getVariablesFor(state1));
+    const std::vector<double> goalvars(gm->getVariablesFor(state2));
+    double dist;
+    return wcd.checkMotionCollision(
+            *gm->collisionState(),
+            *gm->attachedBodiesCollisionState(),
+            *rmcm,
+            startvars,
+            goalvars,
+            gidx,
+            dist);
+}
+
 void CollisionWorldSBPL::processWorldUpdateUninitialized(
     const World::ObjectConstPtr& object)
 {
@@ -757,21 +1646,34 @@ void CollisionWorldSBPL::processWorldUpdateRemoveShape(
 }
 
 auto CollisionWorldSBPL::getCollisionRobotVisualization(
-    smpl::collision::RobotCollisionState& rcs,
+    const smpl::collision::RobotCollisionModelConstPtr& rcm,
+    const smpl::collision::RobotCollisionState& rcs,
     smpl::collision::AttachedBodiesCollisionState& abcs,
-    int gidx) const
-    -> visualization_msgs::MarkerArray
-{
-    auto ma = GetCollisionMarkers(rcs, abcs, gidx);
-    for (auto& m : ma.markers) {
-        m.ns = "world_collision";
-        if (m_grid) {
-            m.header.frame_id = m_grid->getReferenceFrame();
-        } else if (m_parent_grid) {
-            m.header.frame_id = m_parent_grid->getReferenceFrame();
-        }
+    int gidx,
+    bool valid) const
+    -> MarkerBuilder
+{
+    auto build = GetCollisionMarkersBuilder(
+            rcm, rcs.getJointVarPositions(), abcs, gidx);
+    std::string frame_id;
+    if (m_grid) {
+        frame_id = m_grid->getReferenceFrame();
+    } else if (m_parent_grid) {
+        frame_id = m_parent_grid->getReferenceFrame();
     }
-    return ma;
+    return [build, frame_id, valid]()
+    {
+        auto ma = build();
+        for (auto& m : ma.markers) {
+            m.ns = "world_collision";
+            m.header.frame_id = frame_id;
+            if (!valid) {
+                m.color.r = 1.0;
+                m.color.g = m.color.b = 0.0;
+            }
+        }
+        return ma;
+    };
 }
 
 } // collision_detection
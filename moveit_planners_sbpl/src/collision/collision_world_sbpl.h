@@ -33,14 +33,20 @@
 #define collision_detection_collision_world_sbpl_h
 
 // standard includes
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 // system includes
 #include <moveit/collision_detection/collision_world.h>
 #include <moveit/distance_field/propagation_distance_field.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
 #include <moveit_msgs/OrientedBoundingBox.h>
 #include <ros/ros.h>
 #include <sbpl_collision_checking/collision_space.h>
@@ -53,6 +59,8 @@
 // project includes
 #include "collision_robot_sbpl.h"
 #include "config.h"
+#include "occupancy_pyramid.h"
+#include "shared_voxel_ring.h"
 
 namespace smpl {
 SBPL_CLASS_FORWARD(OccupancyGrid);
@@ -75,6 +83,133 @@ public:
         const std::string& group_name) const
         -> const smpl::DistanceMapInterface*;
 
+    /// Return the world distance field, shared with its grid so that it
+    /// remains valid after this world copies its grid on write
+    auto sharedDistanceField() const
+        -> std::shared_ptr<const smpl::DistanceMapInterface>;
+
+    /// Return an estimate of the memory, in bytes, held by the world collision
+    /// grid. The grid may be shared with the world this world was copied from.
+    auto memoryUsage() const -> size_t;
+
+    /// \brief Check the motions between consecutive waypoints of a trajectory
+    ///     against the world
+    ///
+    /// Segments, beginning with the segment starting at waypoint \p
+    /// start_index, are checked in parallel using the motion collision model
+    /// of the robot. Checking stops early once an invalid segment is found and
+    /// all segments before it have been checked. Self collisions are not
+    /// checked.
+    ///
+    /// \param thread_count The number of threads to use; 0 => one per core
+    /// \return The index of the first waypoint whose motion to the next
+    ///     waypoint is in collision, or -1 if all segments are valid. A
+    ///     trajectory with a single remaining waypoint is checked as a single
+    ///     state.
+    int checkTrajectoryCollision(
+        const CollisionRequest& req,
+        const CollisionRobot& robot,
+        const robot_trajectory::RobotTrajectory& traj,
+        const AllowedCollisionMatrix& acm,
+        size_t start_index = 0,
+        int thread_count = 0) const;
+
+    /// Called with the index of the first segment of a monitored trajectory
+    /// that is in collision, or -1 if the trajectory has become valid again
+    typedef std::function<void(int)> TrajectoryInvalidatedCallback;
+
+    /// \brief Monitor a trajectory for invalidation by changes to the world
+    ///
+    /// The swept volume of each segment is approximated by the bounding
+    /// spheres of the robot's collision geometry and recorded in a coarse
+    /// voxel index. On each world update, only the segments whose swept
+    /// volume intersects the bounding spheres of the changed object's shapes
+    /// are rechecked, along with the segments currently invalid when the
+    /// object was moved or removed. \p callback is invoked whenever the
+    /// first invalid segment changes.
+    void setMonitoredTrajectory(
+        const CollisionRobotConstPtr& robot,
+        const robot_trajectory::RobotTrajectoryConstPtr& traj,
+        const std::string& group_name,
+        const TrajectoryInvalidatedCallback& callback,
+        double index_res = 0.2);
+
+    void clearMonitoredTrajectory();
+
+    /// Return the index of the first invalid segment of the monitored
+    /// trajectory or -1 if it is valid or no trajectory is monitored.
+    int monitoredTrajectoryFirstInvalid() const;
+
+    /// \brief Apply voxel updates written to the shared voxel ring
+    ///
+    /// The ring named by the "shared_world/name" parameter is consumed only by
+    /// the world that was constructed from it, not by its copies. A cell added
+    /// by any number of points is occupied by voxels until a point in it is
+    /// removed. Voxels hold one reference to their cells in the ref-counted
+    /// grid, so cells also occupied by world objects stay occupied. The voxels
+    /// are carried over to copies of this world that later modify their own
+    /// grid.
+    ///
+    /// If the "shared_world/voxel_decay" parameter is positive, cells that
+    /// have not been added again for that many seconds are removed in bulk,
+    /// and distances are repropagated only around the removed cells.
+    ///
+    /// The caller must have exclusive access to the world, e.g. hold the
+    /// planning scene monitor's write lock, as the shared world move_group
+    /// capability does.
+    ///
+    /// \return true if any updates were applied or voxels expired
+    bool consumeVoxelUpdates();
+
+    /// Return whether consumeVoxelUpdates() has any updates to apply or voxels
+    /// to expire. Requires only read access to the world.
+    bool voxelUpdatesPending() const;
+
+    /// Return a counter incremented whenever voxel updates are applied.
+    /// Copies of a world start with the counter of the original.
+    auto voxelVersion() const -> uint64_t { return m_voxel_version; }
+
+    /// Return whether any cells are currently occupied by voxels
+    bool hasVoxels() const { return m_voxels && !m_voxels->empty(); }
+
+    /// Spheres predicted to be occupied by moving obstacles, e.g. vehicles or
+    /// people, over a sequence of consecutive time intervals
+    struct PredictedObstacles
+    {
+        struct Sphere
+        {
+            Eigen::Vector3d center;
+            double radius;
+        };
+
+        // start of the first interval
+        ros::Time stamp;
+
+        // duration of each interval, in seconds
+        double dt;
+
+        // spheres occupied during [stamp + i * dt, stamp + (i + 1) * dt),
+        // in the planning frame
+        std::vector<std::vector<Sphere>> layers;
+    };
+
+    /// \brief Set the predicted occupancy of moving obstacles
+    ///
+    /// Predictions are kept apart from the static world and are not consulted
+    /// by checkRobotCollision(). They are shared with copies of this world made
+    /// after they are set. Planning contexts time their solutions so that the
+    /// robot passes the predicted obstacles rather than planning around the
+    /// entire region they sweep. In move_group, predictions are set by the
+    /// SharedWorldCapability from the "predicted_obstacles" topic.
+    void setPredictedObstacles(PredictedObstacles obstacles);
+    void clearPredictedObstacles();
+
+    /// Return the predicted occupancy of moving obstacles or nullptr if none
+    /// has been set.
+    auto predictedObstacles() const
+        -> const std::shared_ptr<const PredictedObstacles>&
+    { return m_predicted; }
+
     /// \name CollisionWorld Interface
     ///@{
     void checkRobotCollision(
@@ -164,8 +299,35 @@ private:
     smpl::OccupancyGridPtr m_grid;
     smpl::collision::WorldCollisionModelPtr m_wcm;
 
+    // max-pooled occupancy of the grid, or of the parent's grid, used to clear
+    // groups and links against the world before per-sphere checks
+    std::shared_ptr<OccupancyPyramid> m_parent_pyramid;
+    std::shared_ptr<OccupancyPyramid> m_pyramid;
+    bool m_broad_phase;
+
+    // added to the bounding spheres of attached bodies, to cover the spheres
+    // of the attached body model that extend beyond the bodies' geometry
+    double m_broad_phase_padding;
+
+    struct BroadPhaseSphere
+    {
+        const moveit::core::LinkModel* link;
+        Eigen::Vector3d center; // in the link frame
+        double radius;
+    };
+
+    // collision group name -> bounding spheres of the collision spheres of
+    // each of its links
+    std::unordered_map<std::string, std::vector<BroadPhaseSphere>>
+    m_broad_phase_spheres;
+    std::vector<BroadPhaseSphere> m_broad_phase_scratch;
+
     std::unordered_map<std::string, CollisionStateUpdaterPtr> m_updaters;
 
+    // per-thread updaters for trajectory validation, not shared with copies
+    std::unordered_map<std::string, std::vector<CollisionStateUpdaterPtr>>
+    m_traj_updaters;
+
     World::ObserverHandle m_observer_handle;
 
     struct ObjectRepPair {
@@ -184,6 +346,59 @@ private:
     // TODO: test the semantics of this during copy-on-write
     std::vector<ObjectRepPair> m_collision_objects;
 
+    struct TrajectoryMonitor
+    {
+        CollisionRobotConstPtr robot;
+        robot_trajectory::RobotTrajectoryConstPtr traj;
+        std::string group_name;
+        TrajectoryInvalidatedCallback callback;
+
+        // coarse cell -> indices of segments whose swept volume touches it
+        double res;
+        std::unordered_map<uint64_t, std::vector<int>> index;
+
+        std::vector<bool> invalid;
+        int first_invalid;
+    };
+
+    // not copied with the world
+    std::unique_ptr<TrajectoryMonitor> m_monitor;
+
+    // consumed only by the world constructed from it
+    std::unique_ptr<SharedVoxelRing> m_voxel_ring;
+    std::string m_voxel_ring_name;
+
+    typedef std::chrono::steady_clock VoxelClock;
+
+    // packed coordinates of the cells occupied by voxels -> time the cell was
+    // last added; shared between copies until modified. each cell holds one
+    // reference in the ref-counted grid, so that removing it leaves the cells
+    // also occupied by world objects
+    typedef std::unordered_map<uint64_t, VoxelClock::time_point> VoxelStampMap;
+    std::shared_ptr<VoxelStampMap> m_voxels;
+    uint64_t m_voxel_version;
+    std::vector<Eigen::Vector3d> m_voxel_points;
+
+    // voxels not added again within the decay time are removed; 0 => never
+    double m_voxel_decay;
+
+    // cells added by each call to consumeVoxelUpdates(), oldest first, so that
+    // expired cells are found without scanning every voxel. not copied with
+    // the world
+    std::deque<std::pair<VoxelClock::time_point, std::vector<uint64_t>>>
+    m_voxel_expiry;
+
+    void applyVoxelBatch(
+        const SharedVoxelRing::Batch& batch,
+        VoxelClock::time_point now);
+
+    auto expireVoxels(VoxelClock::time_point now) -> size_t;
+
+    void removeVoxelCells(const std::vector<Eigen::Vector3d>& points);
+
+    // shared with copies; replaced rather than modified
+    std::shared_ptr<const PredictedObstacles> m_predicted;
+
     void construct();
 
     void copyOnWrite();
@@ -200,6 +415,7 @@ private:
 
     void registerWorldCallback();
     void worldUpdate(const World::ObjectConstPtr& object, World::Action action);
+    void updatePyramid(const World::ObjectConstPtr& object, World::Action action);
 
     void setVacuousCollision(CollisionResult& res) const;
     void clearAllCollisions(CollisionResult& res) const;
@@ -207,6 +423,12 @@ private:
     moveit_msgs::OrientedBoundingBox computeWorldAABB(const World& world) const;
     bool emptyBoundingBox(const moveit_msgs::OrientedBoundingBox& bb) const;
 
+    bool checkBroadPhase(
+        const smpl::collision::RobotCollisionModel& rcm,
+        const moveit::core::RobotState& state,
+        const std::string& collision_group_name,
+        int gidx);
+
     void checkRobotCollisionMutable(
         const CollisionRequest& req,
         CollisionResult& res,
@@ -235,6 +457,21 @@ private:
         const robot_state::RobotState& state2,
         const AllowedCollisionMatrix& acm);
 
+    int checkTrajectoryCollisionMutable(
+        const CollisionRequest& req,
+        const CollisionRobot& robot,
+        const robot_trajectory::RobotTrajectory& traj,
+        const AllowedCollisionMatrix& acm,
+        size_t start_index,
+        int thread_count);
+
+    auto monitorCellKey(const Eigen::Vector3d& p) const -> uint64_t;
+    void indexMonitoredTrajectory();
+    void updateMonitoredTrajectory(
+        const World::ObjectConstPtr& object,
+        bool recheck_invalid);
+    bool checkMonitoredSegment(int sidx);
+
     void processWorldUpdateUninitialized(const World::ObjectConstPtr& object);
     void processWorldUpdateCreate(const World::ObjectConstPtr& object);
     void processWorldUpdateDestroy(const World::ObjectConstPtr& object);
@@ -243,10 +480,12 @@ private:
     void processWorldUpdateRemoveShape(const World::ObjectConstPtr& object);
 
     auto getCollisionRobotVisualization(
-        smpl::collision::RobotCollisionState& rcs,
+        const smpl::collision::RobotCollisionModelConstPtr& rcm,
+        const smpl::collision::RobotCollisionState& rcs,
         smpl::collision::AttachedBodiesCollisionState& abcs,
-        int gidx) const
-        -> visualization_msgs::MarkerArray;
+        int gidx,
+        bool valid) const
+        -> MarkerBuilder;
 };
 
 } // namespace collision_detection
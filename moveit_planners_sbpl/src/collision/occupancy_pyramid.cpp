@@ -0,0 +1,219 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "occupancy_pyramid.h"
+
+// standard includes
+#include <algorithm>
+
+namespace collision_detection {
+
+OccupancyPyramid::OccupancyPyramid() :
+    m_valid(false),
+    m_size_x(0),
+    m_size_y(0),
+    m_size_z(0)
+{
+}
+
+OccupancyPyramid::OccupancyPyramid(const OccupancyPyramid& o) :
+    m_valid(false)
+{
+    // o may be being built for a check of another world sharing it
+    std::lock_guard<std::mutex> lock(o.m_build_mutex);
+    m_occupied = o.m_occupied;
+    m_levels = o.m_levels;
+    m_size_x = o.m_size_x;
+    m_size_y = o.m_size_y;
+    m_size_z = o.m_size_z;
+    m_valid.store(o.m_valid.load(std::memory_order_relaxed));
+}
+
+void OccupancyPyramid::buildIfInvalid(const smpl::OccupancyGrid& grid)
+{
+    if (valid()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_build_mutex);
+    if (!m_valid.load(std::memory_order_relaxed)) {
+        build(grid);
+    }
+}
+
+void OccupancyPyramid::build(const smpl::OccupancyGrid& grid)
+{
+    m_size_x = grid.numCellsX();
+    m_size_y = grid.numCellsY();
+    m_size_z = grid.numCellsZ();
+
+    m_occupied.assign((size_t)m_size_x * m_size_y * m_size_z, 0);
+
+    // halve the resolution until a single cell covers the grid
+    m_levels.clear();
+    int sx = m_size_x, sy = m_size_y, sz = m_size_z;
+    while (sx > 1 || sy > 1 || sz > 1) {
+        sx = (sx + 1) / 2;
+        sy = (sy + 1) / 2;
+        sz = (sz + 1) / 2;
+        Level level;
+        level.size_x = sx;
+        level.size_y = sy;
+        level.size_z = sz;
+        level.counts.assign((size_t)sx * sy * sz, 0);
+        m_levels.push_back(std::move(level));
+    }
+
+    auto* dmap = grid.getDistanceField().get();
+    for (int x = 0; x < m_size_x; ++x) {
+    for (int y = 0; y < m_size_y; ++y) {
+    for (int z = 0; z < m_size_z; ++z) {
+        if (dmap->getCellDistance(x, y, z) <= 0.0) {
+            setOccupied(x, y, z, true);
+        }
+    }
+    }
+    }
+
+    m_valid.store(true, std::memory_order_release);
+}
+
+void OccupancyPyramid::update(
+    const smpl::OccupancyGrid& grid,
+    const std::vector<Eigen::Vector3d>& points)
+{
+    if (!m_valid) {
+        return;
+    }
+
+    auto* dmap = grid.getDistanceField().get();
+    for (auto& p : points) {
+        int gx, gy, gz;
+        grid.worldToGrid(p.x(), p.y(), p.z(), gx, gy, gz);
+        if (!grid.isInBounds(gx, gy, gz)) {
+            continue;
+        }
+        setOccupied(gx, gy, gz, dmap->getCellDistance(gx, gy, gz) <= 0.0);
+    }
+}
+
+bool OccupancyPyramid::isSphereFree(
+    const smpl::OccupancyGrid& grid,
+    const Eigen::Vector3d& center,
+    double radius) const
+{
+    if (!m_valid) {
+        return false;
+    }
+
+    // one cell of margin for the discretization of the sphere's center
+    auto r = radius + grid.getDistanceField()->resolution();
+
+    int lo[3], hi[3];
+    grid.worldToGrid(
+            center.x() - r, center.y() - r, center.z() - r,
+            lo[0], lo[1], lo[2]);
+    grid.worldToGrid(
+            center.x() + r, center.y() + r, center.z() + r,
+            hi[0], hi[1], hi[2]);
+    if (!grid.isInBounds(lo[0], lo[1], lo[2]) ||
+        !grid.isInBounds(hi[0], hi[1], hi[2]))
+    {
+        return false;
+    }
+
+    // the finest level at which the bounds span at most two cells per axis
+    size_t l = 0;
+    while (l < m_levels.size() &&
+        ((hi[0] >> l) - (lo[0] >> l) > 1 ||
+            (hi[1] >> l) - (lo[1] >> l) > 1 ||
+            (hi[2] >> l) - (lo[2] >> l) > 1))
+    {
+        ++l;
+    }
+
+    if (l == 0) {
+        for (int x = lo[0]; x <= hi[0]; ++x) {
+        for (int y = lo[1]; y <= hi[1]; ++y) {
+        for (int z = lo[2]; z <= hi[2]; ++z) {
+            if (m_occupied[((size_t)x * m_size_y + y) * m_size_z + z]) {
+                return false;
+            }
+        }
+        }
+        }
+        return true;
+    }
+
+    auto& level = m_levels[l - 1];
+    for (int x = lo[0] >> l; x <= (hi[0] >> l); ++x) {
+    for (int y = lo[1] >> l; y <= (hi[1] >> l); ++y) {
+    for (int z = lo[2] >> l; z <= (hi[2] >> l); ++z) {
+        if (level.counts[level.index(x, y, z)] != 0) {
+            return false;
+        }
+    }
+    }
+    }
+    return true;
+}
+
+auto OccupancyPyramid::memoryUsage() const -> size_t
+{
+    auto size = m_occupied.size() * sizeof(uint8_t);
+    for (auto& level : m_levels) {
+        size += level.counts.size() * sizeof(uint32_t);
+    }
+    return size;
+}
+
+void OccupancyPyramid::setOccupied(int x, int y, int z, bool occupied)
+{
+    auto& cell = m_occupied[((size_t)x * m_size_y + y) * m_size_z + z];
+    if ((cell != 0) == occupied) {
+        return;
+    }
+    cell = occupied ? 1 : 0;
+
+    for (size_t l = 1; l <= m_levels.size(); ++l) {
+        auto& level = m_levels[l - 1];
+        auto& count = level.counts[level.index(x >> l, y >> l, z >> l)];
+        if (occupied) {
+            ++count;
+        } else {
+            --count;
+        }
+    }
+}
+
+} // namespace collision_detection
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef collision_detection_occupancy_pyramid_h
+#define collision_detection_occupancy_pyramid_h
+
+// standard includes
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// system includes
+#include <Eigen/Dense>
+#include <smpl/occupancy_grid.h>
+
+namespace collision_detection {
+
+/// \brief Max-pooled occupancy of a grid at successively halved resolutions
+///
+/// Each cell of level l covers 2^l x 2^l x 2^l cells of the grid and counts
+/// the occupied cells beneath it, so that an empty region of any size is
+/// recognized with at most eight lookups. Cells of the grid are occupied when
+/// their distance is zero.
+///
+/// A pyramid may be shared by the copies of a collision world that share its
+/// grid and be built on demand from concurrent checks of those copies, so
+/// buildIfInvalid() is thread-safe. update() and invalidate() require
+/// exclusive access, as modifying the grid does.
+class OccupancyPyramid
+{
+public:
+
+    OccupancyPyramid();
+    OccupancyPyramid(const OccupancyPyramid& o);
+
+    OccupancyPyramid& operator=(const OccupancyPyramid&) = delete;
+
+    /// Rebuild the pyramid from every cell of \p grid
+    void build(const smpl::OccupancyGrid& grid);
+
+    /// Build the pyramid from \p grid if it is not valid. Concurrent callers
+    /// wait for a single build.
+    void buildIfInvalid(const smpl::OccupancyGrid& grid);
+
+    /// Update the pyramid for the cells of \p grid containing \p points, whose
+    /// occupancy may have changed since the last update
+    void update(
+        const smpl::OccupancyGrid& grid,
+        const std::vector<Eigen::Vector3d>& points);
+
+    /// Mark the pyramid for a rebuild, after changes to unknown cells
+    void invalidate() { m_valid = false; }
+
+    bool valid() const { return m_valid.load(std::memory_order_acquire); }
+
+    /// Return true if no occupied cell lies within \p radius, plus one cell,
+    /// of \p center. Returns false if the sphere leaves the grid.
+    bool isSphereFree(
+        const smpl::OccupancyGrid& grid,
+        const Eigen::Vector3d& center,
+        double radius) const;
+
+    /// Return the memory, in bytes, held by the pyramid
+    auto memoryUsage() const -> size_t;
+
+private:
+
+    std::atomic<bool> m_valid;
+    mutable std::mutex m_build_mutex;
+
+    // occupancy of the cells of the grid
+    std::vector<uint8_t> m_occupied;
+
+    struct Level
+    {
+        int size_x;
+        int size_y;
+        int size_z;
+        std::vector<uint32_t> counts;
+
+        auto index(int x, int y, int z) const -> size_t
+        { return ((size_t)x * size_y + y) * size_z + z; }
+    };
+
+    // levels[l - 1] => level l
+    std::vector<Level> m_levels;
+
+    int m_size_x;
+    int m_size_y;
+    int m_size_z;
+
+    void setOccupied(int x, int y, int z, bool occupied);
+};
+
+} // namespace collision_detection
+
+#endif
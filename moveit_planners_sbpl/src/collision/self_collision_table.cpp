@@ -0,0 +1,818 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "self_collision_table.h"
+
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+// system includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ros/ros.h>
+#include <sbpl_collision_checking/self_collision_model.h>
+#include <smpl/angles.h>
+
+// module includes
+#include "collision_common_sbpl.h"
+
+namespace collision_detection {
+
+static const char* LOG = "self_collision_table";
+
+static const char TABLE_MAGIC[8] = { 'S', 'B', 'P', 'L', 'S', 'C', 'T', '\0' };
+static const uint32_t TABLE_VERSION = 2;
+
+struct SelfCollisionTable::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t pair_count;
+    uint64_t robot_name;        // offset into the string table
+    uint64_t config_hash;       // see ConfigHash()
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t entries_offset;
+    uint64_t size;              // total size, including this header
+};
+
+struct SelfCollisionTable::Entry
+{
+    uint32_t link_name[2];      // offsets into the string table
+    uint32_t var_name[2];       // offsets into the string table
+    uint32_t dims;
+    uint32_t cell_count[2];
+    uint32_t wrap[2];
+    uint32_t reserved;
+    double min[2];
+    double res[2];
+    uint64_t cells_offset;      // 2 bits per cell, from the start of the data
+};
+
+namespace {
+
+// 64-bit FNV-1a, stable across processes so that it may be saved
+void HashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    auto* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+// Hash the parameters that determine the contents of the tables
+uint64_t ConfigHash(const SelfCollisionTableConfig& config)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    HashBytes(hash, config.model_config.data(), config.model_config.size());
+    HashBytes(hash, &config.revolute_res, sizeof(config.revolute_res));
+    HashBytes(hash, &config.prismatic_res, sizeof(config.prismatic_res));
+    HashBytes(hash, &config.max_dims, sizeof(config.max_dims));
+    return hash;
+}
+
+// A link pair whose relative transform is determined by at most two joint
+// variables, along with its tabulated status prior to serialization
+struct TablePair
+{
+    std::string link_name[2];
+    int gidx = -1;
+    int dims = 0;
+    int var_index[2] = { -1, -1 };
+    double min[2] = { 0.0, 0.0 };
+    double res[2] = { 1.0, 1.0 };
+    int cell_count[2] = { 1, 1 };
+    bool wrap[2] = { false, false };
+    std::vector<uint8_t> status;
+};
+
+// Allows every collision except those between a single pair of links
+class SinglePairCollisionsInterface :
+    public smpl::collision::AllowedCollisionsInterface
+{
+public:
+
+    SinglePairCollisionsInterface(const std::string& a, const std::string& b) :
+        m_a(a), m_b(b)
+    { }
+
+    bool getEntry(
+        const std::string& name1,
+        const std::string& name2,
+        smpl::collision::AllowedCollision::Type& type) const override
+    {
+        if ((name1 == m_a && name2 == m_b) || (name1 == m_b && name2 == m_a)) {
+            return false;
+        }
+        type = smpl::collision::AllowedCollision::Type::ALWAYS;
+        return true;
+    }
+
+private:
+
+    const std::string& m_a;
+    const std::string& m_b;
+};
+
+// Allows every collision, used to detect collisions that can not be filtered
+// out per link pair (i.e. against voxelized links outside the group)
+class AllCollisionsAllowedInterface :
+    public smpl::collision::AllowedCollisionsInterface
+{
+public:
+
+    bool getEntry(
+        const std::string& name1,
+        const std::string& name2,
+        smpl::collision::AllowedCollision::Type& type) const override
+    {
+        type = smpl::collision::AllowedCollision::Type::ALWAYS;
+        return true;
+    }
+};
+
+} // namespace
+
+// Gather the joints along the kinematic path between two links. Return false
+// if the links do not share a common ancestor.
+static bool GetSeparatingJoints(
+    const moveit::core::LinkModel* a,
+    const moveit::core::LinkModel* b,
+    std::vector<const moveit::core::JointModel*>& joints)
+{
+    auto parent_link = [](const moveit::core::LinkModel* l) {
+        auto* j = l->getParentJointModel();
+        return j ? j->getParentLinkModel() : nullptr;
+    };
+
+    std::vector<const moveit::core::LinkModel*> a_chain;
+    for (auto* l = a; l; l = parent_link(l)) {
+        a_chain.push_back(l);
+    }
+
+    const moveit::core::LinkModel* lca = nullptr;
+    for (auto* l = b; l; l = parent_link(l)) {
+        if (std::find(begin(a_chain), end(a_chain), l) != end(a_chain)) {
+            lca = l;
+            break;
+        }
+    }
+
+    if (!lca) {
+        return false;
+    }
+
+    joints.clear();
+    for (auto* l = a; l != lca; l = parent_link(l)) {
+        joints.push_back(l->getParentJointModel());
+    }
+    for (auto* l = b; l != lca; l = parent_link(l)) {
+        joints.push_back(l->getParentJointModel());
+    }
+    return true;
+}
+
+static bool ConfigureDimension(
+    const moveit::core::JointModel* joint,
+    const SelfCollisionTableConfig& config,
+    TablePair& pair,
+    int d)
+{
+    auto& bounds = joint->getVariableBounds()[0];
+
+    double min;
+    double range;
+    double res;
+    bool wrap;
+    switch (joint->getType()) {
+    case moveit::core::JointModel::REVOLUTE:
+        if (bounds.position_bounded_) {
+            min = bounds.min_position_;
+            range = bounds.max_position_ - bounds.min_position_;
+            wrap = false;
+        } else {
+            min = -M_PI;
+            range = 2.0 * M_PI;
+            wrap = true;
+        }
+        res = config.revolute_res;
+        break;
+    case moveit::core::JointModel::PRISMATIC:
+        if (!bounds.position_bounded_) {
+            return false;
+        }
+        min = bounds.min_position_;
+        range = bounds.max_position_ - bounds.min_position_;
+        wrap = false;
+        res = config.prismatic_res;
+        break;
+    default:
+        return false;
+    }
+
+    int cells = std::max(1, (int)std::ceil(range / res));
+    pair.var_index[d] = joint->getFirstVariableIndex();
+    pair.min[d] = min;
+    pair.res[d] = range > 0.0 ? range / cells : 1.0;
+    pair.cell_count[d] = cells;
+    pair.wrap[d] = wrap;
+    return true;
+}
+
+// Determine whether a pair of links may be tabulated and, if so, the
+// discretization of the variables separating them
+static bool MakeTablePair(
+    const moveit::core::LinkModel* a,
+    const moveit::core::LinkModel* b,
+    const SelfCollisionTableConfig& config,
+    TablePair& pair)
+{
+    std::vector<const moveit::core::JointModel*> joints;
+    if (!GetSeparatingJoints(a, b, joints)) {
+        return false;
+    }
+
+    pair.dims = 0;
+    for (auto* joint : joints) {
+        if (joint->getVariableCount() == 0) {
+            continue; // fixed
+        }
+        if (joint->getVariableCount() != 1 || joint->getMimic()) {
+            return false;
+        }
+        if (pair.dims == config.max_dims || pair.dims == 2) {
+            return false;
+        }
+        if (!ConfigureDimension(joint, config, pair, pair.dims)) {
+            return false;
+        }
+        ++pair.dims;
+    }
+
+    pair.link_name[0] = a->getName();
+    pair.link_name[1] = b->getName();
+    return true;
+}
+
+static size_t CellCount(const TablePair& pair)
+{
+    return (size_t)pair.cell_count[0] * (size_t)pair.cell_count[1];
+}
+
+// Sampling at cell centers misses collisions that only occur near cell
+// boundaries. Demote any cell whose neighborhood is not unanimous to unknown so
+// that the geometric check decides it.
+static void MarkBoundaryCells(TablePair& pair)
+{
+    typedef SelfCollisionTable::Status Status;
+
+    if (pair.dims == 0) {
+        return;
+    }
+
+    auto neighbor = [&](int c, int off, int d) {
+        int n = c + off;
+        if (pair.wrap[d]) {
+            return (n + pair.cell_count[d]) % pair.cell_count[d];
+        }
+        return n < 0 || n >= pair.cell_count[d] ? c : n;
+    };
+
+    std::vector<uint8_t> status(pair.status);
+    const int c0 = pair.cell_count[0];
+    const int c1 = pair.cell_count[1];
+    for (int i1 = 0; i1 < c1; ++i1) {
+    for (int i0 = 0; i0 < c0; ++i0) {
+        const uint8_t s = pair.status[i1 * c0 + i0];
+        if (s == (uint8_t)Status::Unknown) {
+            continue;
+        }
+        bool unanimous = true;
+        for (int o1 = -1; o1 <= 1 && unanimous; ++o1) {
+        for (int o0 = -1; o0 <= 1 && unanimous; ++o0) {
+            int n0 = neighbor(i0, o0, 0);
+            int n1 = pair.dims > 1 ? neighbor(i1, o1, 1) : i1;
+            unanimous = pair.status[n1 * c0 + n0] == s;
+        }
+        }
+        if (!unanimous) {
+            status[i1 * c0 + i0] = (uint8_t)Status::Unknown;
+        }
+    }
+    }
+    pair.status = std::move(status);
+}
+
+static void BuildPairs(
+    const moveit::core::RobotModelConstPtr& robot,
+    const smpl::collision::RobotCollisionModelConstPtr& rcm,
+    const SelfCollisionTable::GridFactory& create_grid,
+    std::vector<TablePair>& pairs,
+    std::atomic<size_t>& next,
+    std::atomic<bool>& ok)
+{
+    typedef SelfCollisionTable::Status Status;
+
+    // each worker owns its own collision state and self collision model; only
+    // the robot collision model is shared
+    CollisionStateUpdater updater;
+    if (!updater.init(*robot, rcm)) {
+        ok = false;
+        return;
+    }
+
+    auto grid = create_grid();
+    grid->setReferenceFrame(rcm->modelFrame());
+    smpl::collision::SelfCollisionModel scm(
+            grid.get(), rcm.get(), updater.attachedBodiesCollisionModel().get());
+
+    moveit::core::RobotState state(robot);
+    state.setToDefaultValues();
+    state.setJointPositions(robot->getRootJoint(), Eigen::Affine3d::Identity());
+    const moveit::core::RobotState default_state(state);
+
+    AllCollisionsAllowedInterface all_allowed;
+
+    for (size_t pidx = next++; pidx < pairs.size() && ok; pidx = next++) {
+        auto& pair = pairs[pidx];
+        SinglePairCollisionsInterface pair_only(
+                pair.link_name[0], pair.link_name[1]);
+
+        pair.status.resize(CellCount(pair));
+        for (int i1 = 0; i1 < pair.cell_count[1]; ++i1) {
+        for (int i0 = 0; i0 < pair.cell_count[0]; ++i0) {
+            const int i[2] = { i0, i1 };
+            for (int d = 0; d < pair.dims; ++d) {
+                state.setVariablePosition(
+                        pair.var_index[d],
+                        pair.min[d] + (i[d] + 0.5) * pair.res[d]);
+            }
+            updater.update(state);
+
+            double dist;
+            Status s;
+            if (!scm.checkCollision(
+                    *updater.collisionState(),
+                    *updater.attachedBodiesCollisionState(),
+                    all_allowed,
+                    pair.gidx,
+                    dist))
+            {
+                s = Status::Unknown;
+            } else if (scm.checkCollision(
+                    *updater.collisionState(),
+                    *updater.attachedBodiesCollisionState(),
+                    pair_only,
+                    pair.gidx,
+                    dist))
+            {
+                s = Status::Free;
+            } else {
+                s = Status::Collision;
+            }
+            pair.status[i1 * pair.cell_count[0] + i0] = (uint8_t)s;
+        }
+        }
+
+        for (int d = 0; d < pair.dims; ++d) {
+            state.setVariablePosition(
+                    pair.var_index[d],
+                    default_state.getVariablePosition(pair.var_index[d]));
+        }
+
+        MarkBoundaryCells(pair);
+    }
+}
+
+SelfCollisionTable::SelfCollisionTable() :
+    m_data(nullptr),
+    m_size(0),
+    m_strings(nullptr),
+    m_map(nullptr),
+    m_map_size(0)
+{
+}
+
+SelfCollisionTable::~SelfCollisionTable()
+{
+    reset();
+}
+
+bool SelfCollisionTable::build(
+    const moveit::core::RobotModelConstPtr& robot,
+    const smpl::collision::RobotCollisionModelConstPtr& rcm,
+    const GridFactory& create_grid,
+    const SelfCollisionTableConfig& config)
+{
+    reset();
+
+    auto then = std::chrono::steady_clock::now();
+
+    ////////////////////////////////////
+    // Select link pairs to tabulate //
+    ////////////////////////////////////
+
+    // the group used to tabulate a pair is the smallest group containing both
+    // links, since the self collision model only checks sphere pairs between
+    // links of the same group
+    auto select_group = [&](int lidx1, int lidx2) {
+        int best = -1;
+        size_t best_size = 0;
+        for (int gidx = 0; gidx < rcm->groupCount(); ++gidx) {
+            auto& links = rcm->groupLinkIndices(gidx);
+            if (std::find(begin(links), end(links), lidx1) == end(links) ||
+                std::find(begin(links), end(links), lidx2) == end(links))
+            {
+                continue;
+            }
+            if (best < 0 || links.size() < best_size) {
+                best = gidx;
+                best_size = links.size();
+            }
+        }
+        return best;
+    };
+
+    std::vector<TablePair> pairs;
+    auto& links = robot->getLinkModels();
+    for (size_t i = 0; i < links.size(); ++i) {
+        if (!rcm->hasLink(links[i]->getName())) {
+            continue;
+        }
+        for (size_t j = i + 1; j < links.size(); ++j) {
+            if (!rcm->hasLink(links[j]->getName())) {
+                continue;
+            }
+
+            TablePair pair;
+            if (!MakeTablePair(links[i], links[j], config, pair)) {
+                continue;
+            }
+
+            pair.gidx = select_group(
+                    rcm->linkIndex(links[i]->getName()),
+                    rcm->linkIndex(links[j]->getName()));
+            if (pair.gidx < 0) {
+                continue;
+            }
+
+            pairs.push_back(std::move(pair));
+        }
+    }
+
+    ROS_INFO_NAMED(LOG, "Tabulate self collisions for %zu link pairs", pairs.size());
+
+    /////////////////////////////////
+    // Tabulate pairs in parallel //
+    /////////////////////////////////
+
+    int thread_count = config.thread_count;
+    if (thread_count <= 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < thread_count; ++t) {
+        workers.emplace_back(
+                BuildPairs,
+                std::cref(robot),
+                std::cref(rcm),
+                std::cref(create_grid),
+                std::ref(pairs),
+                std::ref(next),
+                std::ref(ok));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (!ok) {
+        ROS_ERROR_NAMED(LOG, "Failed to tabulate self collisions");
+        return false;
+    }
+
+    ///////////////
+    // Serialize //
+    ///////////////
+
+    std::string strings;
+    auto add_string = [&](const std::string& s) {
+        uint32_t off = (uint32_t)strings.size();
+        strings.append(s);
+        strings.push_back('\0');
+        return off;
+    };
+
+    Header header;
+    std::memcpy(header.magic, TABLE_MAGIC, sizeof(header.magic));
+    header.version = TABLE_VERSION;
+    header.pair_count = (uint32_t)pairs.size();
+    header.robot_name = add_string(robot->getName());
+    header.config_hash = ConfigHash(config);
+    header.entries_offset = sizeof(Header);
+
+    std::vector<Entry> entries(pairs.size());
+    for (size_t pidx = 0; pidx < pairs.size(); ++pidx) {
+        auto& pair = pairs[pidx];
+        auto& entry = entries[pidx];
+        std::memset(&entry, 0, sizeof(entry));
+        entry.link_name[0] = add_string(pair.link_name[0]);
+        entry.link_name[1] = add_string(pair.link_name[1]);
+        entry.dims = pair.dims;
+        for (int d = 0; d < 2; ++d) {
+            entry.var_name[d] = d < pair.dims ?
+                    add_string(robot->getVariableNames()[pair.var_index[d]]) :
+                    add_string("");
+            entry.cell_count[d] = pair.cell_count[d];
+            entry.wrap[d] = pair.wrap[d];
+            entry.min[d] = pair.min[d];
+            entry.res[d] = pair.res[d];
+        }
+    }
+
+    header.strings_offset = header.entries_offset + entries.size() * sizeof(Entry);
+    header.strings_size = strings.size();
+
+    uint64_t cells_offset = header.strings_offset + header.strings_size;
+    for (size_t pidx = 0; pidx < pairs.size(); ++pidx) {
+        entries[pidx].cells_offset = cells_offset;
+        cells_offset += (CellCount(pairs[pidx]) + 3) / 4;
+    }
+    header.size = cells_offset;
+
+    m_buffer.assign(header.size, 0);
+    std::memcpy(&m_buffer[0], &header, sizeof(header));
+    std::memcpy(&m_buffer[header.entries_offset], entries.data(), entries.size() * sizeof(Entry));
+    std::memcpy(&m_buffer[header.strings_offset], strings.data(), strings.size());
+    for (size_t pidx = 0; pidx < pairs.size(); ++pidx) {
+        uint8_t* cells = &m_buffer[entries[pidx].cells_offset];
+        auto& status = pairs[pidx].status;
+        for (size_t c = 0; c < status.size(); ++c) {
+            cells[c >> 2] |= (uint8_t)(status[c] << ((c & 3) << 1));
+        }
+    }
+
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+
+    if (!index(*robot, header.config_hash)) {
+        reset();
+        return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    ROS_INFO_NAMED(LOG, "Tabulated %zu link pairs (%zu bytes) in %0.3f seconds", m_pairs.size(), m_size, std::chrono::duration<double>(now - then).count());
+    return true;
+}
+
+bool SelfCollisionTable::load(
+    const std::string& path,
+    const moveit::core::RobotModel& robot,
+    const SelfCollisionTableConfig& config)
+{
+    reset();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ROS_DEBUG_NAMED(LOG, "Failed to open self collision table '%s'", path.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+        ROS_WARN_NAMED(LOG, "Self collision table '%s' is malformed", path.c_str());
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ROS_WARN_NAMED(LOG, "Failed to map self collision table '%s'", path.c_str());
+        return false;
+    }
+
+    m_map = map;
+    m_map_size = st.st_size;
+    m_data = (const uint8_t*)map;
+    m_size = st.st_size;
+
+    if (!index(robot, ConfigHash(config))) {
+        ROS_WARN_NAMED(LOG, "Self collision table '%s' does not match robot '%s' or its collision model and table parameters", path.c_str(), robot.getName().c_str());
+        reset();
+        return false;
+    }
+
+    ROS_INFO_NAMED(LOG, "Loaded self collision table '%s' (%zu link pairs)", path.c_str(), m_pairs.size());
+    return true;
+}
+
+bool SelfCollisionTable::save(const std::string& path) const
+{
+    if (!loaded()) {
+        return false;
+    }
+
+    // write to a temporary file and rename so that a concurrent reader never
+    // maps a partially-written table
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!ofs.is_open()) {
+            ROS_WARN_NAMED(LOG, "Failed to open '%s' for writing", tmp_path.c_str());
+            return false;
+        }
+        ofs.write((const char*)m_data, m_size);
+        if (!ofs) {
+            ROS_WARN_NAMED(LOG, "Failed to write self collision table to '%s'", tmp_path.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        ROS_WARN_NAMED(LOG, "Failed to move self collision table to '%s'", path.c_str());
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+auto SelfCollisionTable::linkName1(size_t pidx) const -> const char*
+{
+    return m_strings + m_pairs[pidx].entry->link_name[0];
+}
+
+auto SelfCollisionTable::linkName2(size_t pidx) const -> const char*
+{
+    return m_strings + m_pairs[pidx].entry->link_name[1];
+}
+
+auto SelfCollisionTable::pairStatus(
+    size_t pidx,
+    const moveit::core::RobotState& state) const
+    -> Status
+{
+    auto& pair = m_pairs[pidx];
+    auto* entry = pair.entry;
+
+    size_t cell = 0;
+    size_t stride = 1;
+    for (uint32_t d = 0; d < entry->dims; ++d) {
+        const int count = (int)entry->cell_count[d];
+        double pos = state.getVariablePosition(pair.var_index[d]);
+        int c;
+        if (entry->wrap[d]) {
+            pos = smpl::angles::normalize_angle(pos);
+            c = (int)std::floor((pos - entry->min[d]) / entry->res[d]) % count;
+            if (c < 0) {
+                c += count;
+            }
+        } else {
+            double f = (pos - entry->min[d]) / entry->res[d];
+            if (f < 0.0 || f >= (double)count) {
+                return Status::Unknown; // outside joint limits
+            }
+            c = (int)f;
+        }
+        cell += c * stride;
+        stride *= count;
+    }
+
+    return (Status)((pair.cells[cell >> 2] >> ((cell & 3) << 1)) & 0x3);
+}
+
+void SelfCollisionTable::reset()
+{
+    if (m_map) {
+        munmap(m_map, m_map_size);
+        m_map = nullptr;
+        m_map_size = 0;
+    }
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    m_data = nullptr;
+    m_size = 0;
+    m_strings = nullptr;
+    m_pairs.clear();
+}
+
+// Validate the table data and resolve the variables of each entry against the
+// robot model
+bool SelfCollisionTable::index(
+    const moveit::core::RobotModel& robot,
+    uint64_t config_hash)
+{
+    m_pairs.clear();
+
+    if (m_size < sizeof(Header)) {
+        return false;
+    }
+
+    auto* header = (const Header*)m_data;
+    if (std::memcmp(header->magic, TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0 ||
+        header->version != TABLE_VERSION ||
+        header->config_hash != config_hash ||
+        header->size != m_size ||
+        header->entries_offset + (uint64_t)header->pair_count * sizeof(Entry) > m_size ||
+        header->strings_offset + header->strings_size > m_size ||
+        header->strings_size == 0 ||
+        m_data[header->strings_offset + header->strings_size - 1] != '\0')
+    {
+        return false;
+    }
+
+    m_strings = (const char*)(m_data + header->strings_offset);
+
+    auto valid_string = [&](uint64_t off) { return off < header->strings_size; };
+
+    if (!valid_string(header->robot_name) ||
+        robot.getName() != m_strings + header->robot_name)
+    {
+        return false;
+    }
+
+    auto& var_names = robot.getVariableNames();
+    auto* entries = (const Entry*)(m_data + header->entries_offset);
+    m_pairs.reserve(header->pair_count);
+    for (uint32_t pidx = 0; pidx < header->pair_count; ++pidx) {
+        auto& entry = entries[pidx];
+        if (entry.dims > 2 ||
+            !valid_string(entry.link_name[0]) ||
+            !valid_string(entry.link_name[1]))
+        {
+            return false;
+        }
+
+        PairInfo info;
+        info.entry = &entry;
+        info.var_index[0] = info.var_index[1] = -1;
+
+        uint64_t cell_count = 1;
+        for (uint32_t d = 0; d < entry.dims; ++d) {
+            if (!valid_string(entry.var_name[d]) ||
+                entry.cell_count[d] == 0 ||
+                !(entry.res[d] > 0.0))
+            {
+                return false;
+            }
+            auto it = std::find(
+                    begin(var_names), end(var_names),
+                    m_strings + entry.var_name[d]);
+            if (it == end(var_names)) {
+                return false;
+            }
+            info.var_index[d] = (int)std::distance(begin(var_names), it);
+            cell_count *= entry.cell_count[d];
+        }
+
+        if (entry.cells_offset + (cell_count + 3) / 4 > m_size) {
+            return false;
+        }
+        info.cells = m_data + entry.cells_offset;
+        m_pairs.push_back(info);
+    }
+
+    return true;
+}
+
+} // namespace collision_detection
@@ -0,0 +1,164 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef collision_detection_self_collision_table_h
+#define collision_detection_self_collision_table_h
+
+// standard includes
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// system includes
+#include <moveit/robot_model/robot_model.h>
+#include <moveit/robot_state/robot_state.h>
+#include <sbpl_collision_checking/robot_collision_model.h>
+#include <smpl/occupancy_grid.h>
+
+namespace collision_detection {
+
+struct SelfCollisionTableConfig
+{
+    // discretization of revolute joint variables (radians)
+    double revolute_res = 1.0 * M_PI / 180.0;
+
+    // discretization of prismatic joint variables (meters)
+    double prismatic_res = 0.005;
+
+    // maximum number of joint variables separating a tabulated link pair
+    int max_dims = 2;
+
+    // number of worker threads used to build the tables; 0 => one per core
+    int thread_count = 0;
+
+    // serialized robot collision model configuration the tables are built
+    // against. A table is only loaded for the same configuration.
+    std::string model_config;
+};
+
+/// \brief Joint-space lookup tables of self-collision status between links
+///     separated by at most two joint variables.
+///
+/// The relative transform between two such links, and therefore their
+/// collision status, depends only on the (at most two) variables of the joints
+/// along the kinematic path between them. The status is tabulated over a
+/// discretization of those variables so that the self collision check may
+/// replace sphere checks for these pairs with an O(1) lookup.
+///
+/// The tables are stored in a single flat buffer with the same layout as the
+/// on-disk representation so that a saved file may be mapped directly into
+/// memory with no deserialization.
+class SelfCollisionTable
+{
+public:
+
+    typedef std::function<smpl::OccupancyGridPtr()> GridFactory;
+
+    SelfCollisionTable();
+    ~SelfCollisionTable();
+
+    SelfCollisionTable(const SelfCollisionTable&) = delete;
+    SelfCollisionTable& operator=(const SelfCollisionTable&) = delete;
+
+    bool build(
+        const moveit::core::RobotModelConstPtr& robot,
+        const smpl::collision::RobotCollisionModelConstPtr& rcm,
+        const GridFactory& create_grid,
+        const SelfCollisionTableConfig& config);
+
+    /// \brief Map a saved table into memory
+    ///
+    /// The table is rejected unless it was built for the same robot, variable
+    /// names, collision model configuration, and table parameters (other than
+    /// the thread count) as given in \p config.
+    bool load(
+        const std::string& path,
+        const moveit::core::RobotModel& robot,
+        const SelfCollisionTableConfig& config);
+    bool save(const std::string& path) const;
+
+    bool loaded() const { return m_data != nullptr; }
+
+    /// Return the memory, in bytes, held by the tables, including any mapped
+    /// file
+    size_t memoryUsage() const
+    { return m_size + m_pairs.size() * sizeof(PairInfo); }
+
+    enum class Status : uint8_t
+    {
+        Free = 0,
+        Collision = 1,
+        Unknown = 2, // near a collision boundary; defer to geometry
+    };
+
+    size_t pairCount() const { return m_pairs.size(); }
+    auto linkName1(size_t pidx) const -> const char*;
+    auto linkName2(size_t pidx) const -> const char*;
+
+    /// Return the tabulated collision status of a pair in the given state. Only
+    /// the variable positions of the state are read.
+    auto pairStatus(size_t pidx, const moveit::core::RobotState& state) const
+        -> Status;
+
+private:
+
+    // on-disk records, defined in the implementation
+    struct Header;
+    struct Entry;
+
+    struct PairInfo
+    {
+        const Entry* entry;
+        const uint8_t* cells;
+        int var_index[2]; // variable indices in the RobotState
+    };
+
+    // either points into m_buffer or into a mapped file
+    const uint8_t* m_data;
+    size_t m_size;
+    const char* m_strings;
+
+    std::vector<uint8_t> m_buffer;
+
+    void* m_map;
+    size_t m_map_size;
+
+    std::vector<PairInfo> m_pairs;
+
+    void reset();
+    bool index(const moveit::core::RobotModel& robot, uint64_t config_hash);
+};
+
+} // namespace collision_detection
+
+#endif
@@ -0,0 +1,319 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "shared_voxel_ring.h"
+
+// standard includes
+#include <atomic>
+#include <cstring>
+#include <new>
+
+// system includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ros/console.h>
+
+namespace collision_detection {
+
+static const char* LOG = "shared_voxels";
+
+static const uint64_t RING_MAGIC = 0x53425056524e4731; // "SBPVRNG1"
+
+// Offsets are monotonically increasing byte counts; the position in the data
+// region is the offset modulo the capacity. The producer only writes head and
+// the consumer only writes tail.
+struct SharedVoxelRing::Header
+{
+    uint64_t magic;
+    uint64_t capacity;
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+};
+
+// Records and the capacity are multiples of the record alignment, so a record
+// header always fits before the end of the data region
+struct SharedVoxelRing::Record
+{
+    uint32_t op; // Op, or PAD to skip to the start of the data region
+    uint32_t count;
+    uint64_t size;
+};
+
+static const uint32_t PAD = 0xFFFFFFFF;
+static const size_t RECORD_ALIGN = 16;
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomics must be lock-free to be shared between processes");
+
+static size_t AlignUp(size_t n)
+{
+    return (n + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+
+SharedVoxelRing::SharedVoxelRing() :
+    m_header(nullptr),
+    m_data(nullptr),
+    m_map_size(0),
+    m_capacity(0),
+    m_peek_size(0)
+{
+}
+
+SharedVoxelRing::~SharedVoxelRing()
+{
+    close();
+}
+
+bool SharedVoxelRing::create(const std::string& name, size_t capacity)
+{
+    close();
+
+    capacity = AlignUp(capacity);
+    size_t size = AlignUp(sizeof(Header)) + capacity;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        ROS_WARN_NAMED(LOG, "Failed to create shared memory '%s'", name.c_str());
+        return false;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        ROS_WARN_NAMED(LOG, "Failed to size shared memory '%s'", name.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        ROS_WARN_NAMED(LOG, "Failed to map shared memory '%s'", name.c_str());
+        return false;
+    }
+
+    m_header = new (map) Header;
+    m_header->capacity = capacity;
+    m_header->head.store(0);
+    m_header->tail.store(0);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = RING_MAGIC;
+
+    m_data = (uint8_t*)map + AlignUp(sizeof(Header));
+    m_map_size = size;
+    m_capacity = capacity;
+    return true;
+}
+
+bool SharedVoxelRing::open(const std::string& name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+        ROS_DEBUG_NAMED(LOG, "Failed to open shared memory '%s'", name.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)AlignUp(sizeof(Header))) {
+        ROS_WARN_NAMED(LOG, "Shared memory '%s' is malformed", name.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(
+            nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        ROS_WARN_NAMED(LOG, "Failed to map shared memory '%s'", name.c_str());
+        return false;
+    }
+
+    auto* header = (Header*)map;
+    const uint64_t capacity = header->capacity;
+    if (header->magic != RING_MAGIC ||
+        capacity == 0 ||
+        capacity != AlignUp(capacity) ||
+        AlignUp(sizeof(Header)) + capacity != (size_t)st.st_size)
+    {
+        ROS_WARN_NAMED(LOG, "Shared memory '%s' is not a voxel ring", name.c_str());
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    m_header = header;
+    m_data = (uint8_t*)map + AlignUp(sizeof(Header));
+    m_map_size = st.st_size;
+    m_capacity = capacity;
+    ROS_INFO_NAMED(LOG, "Attached to shared voxel ring '%s' (%zu bytes)", name.c_str(), (size_t)capacity);
+    return true;
+}
+
+void SharedVoxelRing::close()
+{
+    if (m_header) {
+        munmap(m_header, m_map_size);
+        m_header = nullptr;
+        m_data = nullptr;
+        m_map_size = 0;
+        m_capacity = 0;
+        m_peek_size = 0;
+    }
+}
+
+bool SharedVoxelRing::write(Op op, const double* points, uint32_t count)
+{
+    if (!m_header) {
+        return false;
+    }
+
+    const uint64_t capacity = m_capacity;
+    const size_t payload = 3 * sizeof(double) * (size_t)count;
+    const size_t size = AlignUp(sizeof(Record) + payload);
+
+    uint64_t head = m_header->head.load(std::memory_order_relaxed);
+    uint64_t tail = m_header->tail.load(std::memory_order_acquire);
+
+    // batches are never split across the end of the data region
+    size_t pos = head % capacity;
+    size_t skip = capacity - pos < size ? capacity - pos : 0;
+    if (size > capacity || skip + size > capacity - (head - tail)) {
+        return false;
+    }
+
+    if (skip) {
+        auto* pad = (Record*)(m_data + pos);
+        pad->op = PAD;
+        pad->count = 0;
+        pad->size = skip;
+        head += skip;
+        pos = 0;
+    }
+
+    auto* record = (Record*)(m_data + pos);
+    record->op = (uint32_t)op;
+    record->count = count;
+    record->size = size;
+    std::memcpy(m_data + pos + sizeof(Record), points, payload);
+
+    m_header->head.store(head + size, std::memory_order_release);
+    return true;
+}
+
+bool SharedVoxelRing::pending() const
+{
+    if (!m_header) {
+        return false;
+    }
+    return m_header->tail.load(std::memory_order_relaxed) !=
+            m_header->head.load(std::memory_order_acquire);
+}
+
+// Read the record at the tail, which the producer in another process may have
+// corrupted, and return false if it does not describe a record lying within
+// the written part of the data region
+bool SharedVoxelRing::readRecord(uint64_t tail, uint64_t head, Record& record)
+{
+    const uint64_t capacity = m_capacity;
+    const uint64_t pos = tail % capacity;
+    if (head - tail > capacity || head - tail < sizeof(Record)) {
+        return false;
+    }
+
+    std::memcpy(&record, m_data + pos, sizeof(Record));
+    if (record.size < sizeof(Record) ||
+        record.size != AlignUp(record.size) ||
+        record.size > capacity - pos ||
+        record.size > head - tail)
+    {
+        return false;
+    }
+
+    if (record.op == PAD) {
+        return true;
+    }
+    if (record.op != (uint32_t)Op::Add && record.op != (uint32_t)Op::Remove) {
+        return false;
+    }
+    const uint64_t payload = 3 * sizeof(double) * (uint64_t)record.count;
+    return payload <= record.size - sizeof(Record);
+}
+
+// Discard everything written so far after a malformed record
+void SharedVoxelRing::discard(uint64_t head)
+{
+    ROS_ERROR_NAMED(LOG, "Malformed record in shared voxel ring; discarding %zu bytes", (size_t)(head - m_header->tail.load(std::memory_order_relaxed)));
+    m_header->tail.store(head, std::memory_order_release);
+}
+
+bool SharedVoxelRing::peek(Batch& batch)
+{
+    if (!m_header) {
+        return false;
+    }
+
+    uint64_t tail = m_header->tail.load(std::memory_order_relaxed);
+    uint64_t head = m_header->head.load(std::memory_order_acquire);
+    while (tail != head) {
+        Record record;
+        if (!readRecord(tail, head, record)) {
+            discard(head);
+            return false;
+        }
+
+        if (record.op == PAD) {
+            tail += record.size;
+            m_header->tail.store(tail, std::memory_order_release);
+            continue;
+        }
+
+        batch.op = (Op)record.op;
+        batch.count = record.count;
+        batch.points = (const double*)(m_data + tail % m_capacity + sizeof(Record));
+        m_peek_size = record.size;
+        return true;
+    }
+    return false;
+}
+
+void SharedVoxelRing::pop()
+{
+    if (!m_header || m_peek_size == 0) {
+        return;
+    }
+
+    // the size validated by peek(), not the record, which may have changed
+    uint64_t tail = m_header->tail.load(std::memory_order_relaxed);
+    m_header->tail.store(tail + m_peek_size, std::memory_order_release);
+    m_peek_size = 0;
+}
+
+} // namespace collision_detection
@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef collision_detection_shared_voxel_ring_h
+#define collision_detection_shared_voxel_ring_h
+
+// standard includes
+#include <cstdint>
+#include <string>
+
+namespace collision_detection {
+
+/// \brief Single-producer, single-consumer ring buffer of point batches in
+///     POSIX shared memory
+///
+/// Lets a local perception process hand large voxel updates to the collision
+/// world without serializing them into planning scene messages. Each batch is
+/// stored contiguously in the mapped region and is read in place by the
+/// consumer. Points are stored as (x, y, z) triples of doubles in the frame of
+/// the world collision grid.
+class SharedVoxelRing
+{
+public:
+
+    enum class Op : uint32_t
+    {
+        Add = 0,
+        Remove = 1,
+    };
+
+    struct Batch
+    {
+        Op op;
+        uint32_t count;
+        const double* points; // 3 * count coordinates
+    };
+
+    SharedVoxelRing();
+    ~SharedVoxelRing();
+
+    SharedVoxelRing(const SharedVoxelRing&) = delete;
+    SharedVoxelRing& operator=(const SharedVoxelRing&) = delete;
+
+    /// Create, or recreate, the named shared memory region with room for \p
+    /// capacity bytes of batches. For use by the producer.
+    bool create(const std::string& name, size_t capacity);
+
+    /// Attach to a shared memory region created by create()
+    bool open(const std::string& name);
+
+    void close();
+
+    bool isOpen() const { return m_header != nullptr; }
+
+    /// Append a batch, failing if there is not enough free space
+    bool write(Op op, const double* points, uint32_t count);
+
+    /// Return the oldest unconsumed batch without copying it. The batch stays
+    /// valid until pop() is called. Records are validated against the size of
+    /// the ring; if a malformed record is found, all pending batches are
+    /// discarded.
+    bool peek(Batch& batch);
+
+    /// Release the batch returned by the last successful peek()
+    void pop();
+
+    /// Return whether any batches have been written and not yet consumed
+    bool pending() const;
+
+private:
+
+    // shared records, defined in the implementation
+    struct Header;
+    struct Record;
+
+    Header* m_header;
+    uint8_t* m_data;
+    size_t m_map_size;
+
+    // capacity validated when the region was mapped
+    uint64_t m_capacity;
+
+    // size of the record returned by the last peek()
+    uint64_t m_peek_size;
+
+    bool readRecord(uint64_t tail, uint64_t head, Record& record);
+    void discard(uint64_t head);
+};
+
+} // namespace collision_detection
+
+#endif
@@ -0,0 +1,192 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "trace.h"
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+// system includes
+#include <ros/console.h>
+#include <unistd.h>
+
+namespace collision_detection {
+namespace trace {
+
+static const char* LOG = "trace";
+
+std::atomic<bool> g_enabled(false);
+
+namespace {
+
+struct Event
+{
+    // index + 1 of the span last written to this slot; 0 if never written or
+    // being written. the fields are atomic so that a reader racing a writer
+    // sees torn values, which it discards, rather than undefined behavior
+    std::atomic<uint64_t> seq;
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> begin_us;
+    std::atomic<uint64_t> dur_us;
+    std::atomic<uint32_t> tid;
+};
+
+struct RingBuffer
+{
+    std::unique_ptr<Event[]> events;
+    size_t mask;
+    std::atomic<uint64_t> head;
+};
+
+// buffers are never freed once tracing has been enabled, so that spans in
+// flight never write to released memory
+std::atomic<RingBuffer*> g_buffer(nullptr);
+std::mutex g_enable_mutex;
+
+auto ThreadID() -> uint32_t
+{
+    static std::atomic<uint32_t> next_tid(1);
+    thread_local uint32_t tid = next_tid++;
+    return tid;
+}
+
+} // namespace
+
+void enable(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(g_enable_mutex);
+    if (!g_buffer.load()) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        auto* buffer = new RingBuffer;
+        buffer->events.reset(new Event[size]);
+        for (size_t i = 0; i < size; ++i) {
+            buffer->events[i].seq.store(0, std::memory_order_relaxed);
+        }
+        buffer->mask = size - 1;
+        buffer->head.store(0);
+        g_buffer.store(buffer);
+        ROS_INFO_NAMED(LOG, "Enable tracing (capacity: %zu spans)", size);
+    }
+    g_enabled.store(true);
+}
+
+void disable()
+{
+    g_enabled.store(false);
+}
+
+auto now_us() -> uint64_t
+{
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(t).count();
+}
+
+void record(const char* name, uint64_t begin_us, uint64_t end_us)
+{
+    auto* buffer = g_buffer.load(std::memory_order_acquire);
+    if (!buffer) {
+        return;
+    }
+
+    uint64_t index = buffer->head.fetch_add(1, std::memory_order_relaxed);
+    auto& event = buffer->events[index & buffer->mask];
+
+    // mark the slot as being written so that readers skip it. the fence keeps
+    // the field stores below from becoming visible before the mark
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store(name, std::memory_order_relaxed);
+    event.begin_us.store(begin_us, std::memory_order_relaxed);
+    event.dur_us.store(end_us - begin_us, std::memory_order_relaxed);
+    event.tid.store(ThreadID(), std::memory_order_relaxed);
+    event.seq.store(index + 1, std::memory_order_release);
+}
+
+bool dump(const std::string& path)
+{
+    auto* buffer = g_buffer.load(std::memory_order_acquire);
+    if (!buffer) {
+        ROS_WARN_NAMED(LOG, "Tracing was never enabled");
+        return false;
+    }
+
+    std::ofstream ofs(path);
+    if (!ofs.is_open()) {
+        ROS_WARN_NAMED(LOG, "Failed to open '%s' for writing", path.c_str());
+        return false;
+    }
+
+    const int pid = (int)getpid();
+    const size_t size = buffer->mask + 1;
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t first = head > size ? head - size : 0;
+
+    ofs << "{\"traceEvents\":[";
+    size_t count = 0;
+    for (uint64_t index = first; index < head; ++index) {
+        auto& event = buffer->events[index & buffer->mask];
+        if (event.seq.load(std::memory_order_acquire) != index + 1) {
+            continue; // overwritten or still being written
+        }
+        const char* name = event.name.load(std::memory_order_relaxed);
+        uint64_t begin_us = event.begin_us.load(std::memory_order_relaxed);
+        uint64_t dur_us = event.dur_us.load(std::memory_order_relaxed);
+        uint32_t tid = event.tid.load(std::memory_order_relaxed);
+        // keep the field loads above from moving past the recheck
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.seq.load(std::memory_order_relaxed) != index + 1) {
+            continue;
+        }
+
+        if (count++ > 0) {
+            ofs << ',';
+        }
+        ofs << "\n{\"name\":\"" << name << "\",\"ph\":\"X\""
+            << ",\"ts\":" << begin_us
+            << ",\"dur\":" << dur_us
+            << ",\"pid\":" << pid
+            << ",\"tid\":" << tid << '}';
+    }
+    ofs << "\n]}\n";
+
+    ROS_INFO_NAMED(LOG, "Wrote %zu spans to '%s'", count, path.c_str());
+    return ofs.good();
+}
+
+} // namespace trace
+} // namespace collision_detection
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef collision_detection_trace_h
+#define collision_detection_trace_h
+
+// standard includes
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace collision_detection {
+namespace trace {
+
+// Timeline tracing of planning and collision checking calls. Spans are
+// recorded into a fixed-size, lock-free ring buffer shared by all threads and
+// may be written out in the Chrome trace event format, viewable in
+// chrome://tracing or Perfetto. When tracing is disabled, a span costs a single
+// relaxed atomic load.
+
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+
+/// Begin recording spans into a ring buffer with room for at least \p capacity
+/// spans. Once full, the oldest spans are overwritten.
+void enable(size_t capacity = 1 << 16);
+
+void disable();
+
+/// Write the recorded spans to \p path as Chrome trace event JSON
+bool dump(const std::string& path);
+
+auto now_us() -> uint64_t;
+
+void record(const char* name, uint64_t begin_us, uint64_t end_us);
+
+// Records the lifetime of the enclosing scope. The name must be a string with
+// static storage duration.
+class Span
+{
+public:
+
+    explicit Span(const char* name) :
+        m_name(enabled() ? name : nullptr),
+        m_begin(m_name ? now_us() : 0)
+    { }
+
+    ~Span() { if (m_name) record(m_name, m_begin, now_us()); }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+
+    const char* m_name;
+    uint64_t m_begin;
+};
+
+} // namespace trace
+} // namespace collision_detection
+
+#define SBPL_TRACE_CONCAT_(a, b) a ## b
+#define SBPL_TRACE_CONCAT(a, b) SBPL_TRACE_CONCAT_(a, b)
+
+#define SBPL_TRACE_SPAN(name) \
+    ::collision_detection::trace::Span SBPL_TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "arena.h"
+
+// standard includes
+#include <algorithm>
+#include <cstdint>
+
+namespace sbpl_interface {
+
+Arena::Arena(size_t block_size) :
+    m_block_size(block_size),
+    m_blocks(),
+    m_offset(0),
+    m_used(0)
+{
+}
+
+Arena::~Arena()
+{
+}
+
+auto Arena::allocate(size_t size, size_t alignment) -> void*
+{
+    if (!m_blocks.empty()) {
+        auto& block = m_blocks.back();
+        auto base = reinterpret_cast<uintptr_t>(block.data.get());
+        size_t offset =
+                ((base + m_offset + alignment - 1) & ~(alignment - 1)) - base;
+        if (offset + size <= block.size) {
+            m_offset = offset + size;
+            m_used += size;
+            return block.data.get() + offset;
+        }
+    }
+
+    // the new block begins at an address aligned for any fundamental type
+    addBlock(size);
+    m_offset = size;
+    m_used += size;
+    return m_blocks.back().data.get();
+}
+
+void Arena::reset()
+{
+    if (m_blocks.size() > 1) {
+        // keep the largest block, sized for a solve like the last one
+        auto largest = std::max_element(
+                begin(m_blocks), end(m_blocks),
+                [](const Block& a, const Block& b) { return a.size < b.size; });
+        Block keep = std::move(*largest);
+        m_blocks.clear();
+        m_blocks.push_back(std::move(keep));
+    }
+    m_offset = 0;
+    m_used = 0;
+}
+
+auto Arena::memoryUsage() const -> size_t
+{
+    size_t usage = 0;
+    for (auto& block : m_blocks) {
+        usage += block.size;
+    }
+    return usage;
+}
+
+void Arena::addBlock(size_t min_size)
+{
+    // grow geometrically so that a large solve needs few blocks, and after a
+    // reset, the block kept covers most of it
+    size_t size = m_block_size;
+    if (!m_blocks.empty()) {
+        size = std::max(size, 2 * m_blocks.back().size);
+    }
+    size = std::max(size, min_size);
+
+    Block block;
+    block.data.reset(new char[size]);
+    block.size = size;
+    m_blocks.push_back(std::move(block));
+}
+
+} // namespace sbpl_interface
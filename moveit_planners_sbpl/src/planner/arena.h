@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_arena_h
+#define sbpl_interface_arena_h
+
+// standard includes
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace sbpl_interface {
+
+/// \brief Monotonic allocator for memory that lives no longer than a solve
+///
+/// Memory is carved sequentially out of large blocks and is never returned
+/// individually. reset() reclaims everything at once, without visiting the
+/// individual allocations, and keeps the largest block so that subsequent
+/// solves of a similar size allocate nothing from the heap. The arena is not thread-safe; each
+/// planning context, or concurrent solve, uses its own.
+class Arena
+{
+public:
+
+    explicit Arena(size_t block_size = 1 << 20);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    auto allocate(size_t size, size_t alignment) -> void*;
+
+    /// Reclaim all memory handed out by the arena. Any object still referring
+    /// to memory from the arena must be destroyed first.
+    void reset();
+
+    /// Return the number of bytes handed out since the last reset
+    auto used() const -> size_t { return m_used; }
+
+    /// Return the number of bytes held by the arena
+    auto memoryUsage() const -> size_t;
+
+private:
+
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t m_block_size;
+
+    // the last block is the one being allocated from
+    std::vector<Block> m_blocks;
+    size_t m_offset;
+    size_t m_used;
+
+    void addBlock(size_t min_size);
+};
+
+/// \brief Standard allocator drawing from an Arena
+///
+/// Deallocation is a no-op; the memory is reclaimed when the arena is reset.
+/// An allocator without an arena falls back to the global heap, so containers
+/// of the same type may hold either kind of storage.
+template <class T>
+class ArenaAllocator
+{
+public:
+
+    typedef T value_type;
+
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <class U>
+    struct rebind { typedef ArenaAllocator<U> other; };
+
+    ArenaAllocator(Arena* arena = nullptr) : m_arena(arena) { }
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& o) : m_arena(o.arena()) { }
+
+    auto allocate(size_t n) -> T*
+    {
+        if (m_arena) {
+            return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (!m_arena) {
+            ::operator delete(p);
+        }
+    }
+
+    auto arena() const -> Arena* { return m_arena; }
+
+private:
+
+    Arena* m_arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() != b.arena();
+}
+
+} // namespace sbpl_interface
+
+#endif
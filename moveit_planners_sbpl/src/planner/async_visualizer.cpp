@@ -0,0 +1,249 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "async_visualizer.h"
+
+// standard includes
+#include <limits>
+#include <utility>
+
+namespace sbpl_interface {
+
+static auto RateToPeriod(double rate) -> AsyncVisualizer::clock::duration
+{
+    if (rate <= 0.0) {
+        return AsyncVisualizer::clock::duration::zero();
+    }
+    return std::chrono::duration_cast<AsyncVisualizer::clock::duration>(
+            std::chrono::duration<double>(1.0 / rate));
+}
+
+AsyncVisualizer::AsyncVisualizer(const ros::NodeHandle& nh, double rate) :
+    m_viz(nh),
+    m_done(false),
+    m_default_period(RateToPeriod(rate)),
+    m_periods(),
+    m_namespaces()
+{
+    m_thread = std::thread([this]() { run(); });
+}
+
+AsyncVisualizer::~AsyncVisualizer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+}
+
+void AsyncVisualizer::setDefaultRate(double rate)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_default_period = RateToPeriod(rate);
+    for (auto& entry : m_namespaces) {
+        if (m_periods.find(entry.first) == m_periods.end()) {
+            entry.second.period = m_default_period;
+        }
+    }
+}
+
+void AsyncVisualizer::setRate(const std::string& ns, double rate)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto period = RateToPeriod(rate);
+    m_periods[ns] = period;
+    auto it = m_namespaces.find(ns);
+    if (it != m_namespaces.end()) {
+        it->second.period = period;
+    }
+}
+
+void AsyncVisualizer::visualize(
+    smpl::visual::Level level,
+    const smpl::visual::Marker& marker)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        getPendingNamespace(marker.ns, level).markers[marker.id] = marker;
+    }
+    m_cv.notify_one();
+}
+
+void AsyncVisualizer::visualize(
+    smpl::visual::Level level,
+    const std::vector<smpl::visual::Marker>& markers)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& marker : markers) {
+            getPendingNamespace(marker.ns, level).markers[marker.id] = marker;
+        }
+    }
+    m_cv.notify_one();
+}
+
+#ifdef SMPL_SV_VISUALIZATION_MSGS
+void AsyncVisualizer::visualize(
+    smpl::visual::Level level,
+    const visualization_msgs::MarkerArray& markers)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& marker : markers.markers) {
+            auto& ns = getPendingNamespace(marker.ns, level);
+            if (marker.action == visualization_msgs::Marker::DELETEALL) {
+                // keyed below any id so that it is published first
+                ns.markers.clear();
+                ns.ros_markers.clear();
+                ns.build = MarkerBuilder();
+                ns.ros_markers[std::numeric_limits<int>::min()] = marker;
+            } else {
+                ns.ros_markers[marker.id] = marker;
+            }
+        }
+    }
+    m_cv.notify_one();
+}
+#endif
+
+void AsyncVisualizer::visualizeDeferred(
+    smpl::visual::Level level,
+    const std::string& ns,
+    MarkerBuilder build)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        getPendingNamespace(ns, level).build = std::move(build);
+    }
+    m_cv.notify_one();
+}
+
+// Return the entry for a namespace, marked as pending
+auto AsyncVisualizer::getPendingNamespace(
+    const std::string& name,
+    smpl::visual::Level level)
+    -> Namespace&
+{
+    auto it = m_namespaces.find(name);
+    if (it == m_namespaces.end()) {
+        it = m_namespaces.emplace(name, Namespace()).first;
+        auto pit = m_periods.find(name);
+        it->second.period =
+                pit != m_periods.end() ? pit->second : m_default_period;
+    }
+
+    auto& ns = it->second;
+    ns.level = level;
+    ns.pending = true;
+    return ns;
+}
+
+void AsyncVisualizer::run()
+{
+    std::map<int, smpl::visual::Marker> markers;
+    std::map<int, visualization_msgs::Marker> ros_markers;
+    MarkerBuilder build;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_done) {
+        // find a namespace that is due for publishing, or the earliest time
+        // at which one will be
+        auto now = clock::now();
+        auto wake = clock::time_point::max();
+        Namespace* due = nullptr;
+        for (auto& entry : m_namespaces) {
+            auto& ns = entry.second;
+            if (!ns.pending) {
+                continue;
+            }
+            auto next = ns.last_publish + ns.period;
+            if (next <= now) {
+                due = &ns;
+                break;
+            }
+            wake = std::min(wake, next);
+        }
+
+        if (!due) {
+            if (wake == clock::time_point::max()) {
+                m_cv.wait(lock);
+            } else {
+                m_cv.wait_until(lock, wake);
+            }
+            continue;
+        }
+
+        auto level = due->level;
+        markers.clear();
+        ros_markers.clear();
+        std::swap(markers, due->markers);
+        std::swap(ros_markers, due->ros_markers);
+        build = std::move(due->build);
+        due->build = MarkerBuilder();
+        due->pending = false;
+        due->last_publish = now;
+
+        // build and publish without holding the lock so that planning threads
+        // never wait on construction, conversion, or publishing
+        lock.unlock();
+        if (build) {
+            for (auto& marker : build().markers) {
+                ros_markers[marker.id] = std::move(marker);
+            }
+            build = MarkerBuilder();
+        }
+        if (!markers.empty()) {
+            std::vector<smpl::visual::Marker> array;
+            array.reserve(markers.size());
+            for (auto& entry : markers) {
+                array.push_back(std::move(entry.second));
+            }
+            m_viz.visualize(level, array);
+        }
+#ifdef SMPL_SV_VISUALIZATION_MSGS
+        if (!ros_markers.empty()) {
+            visualization_msgs::MarkerArray array;
+            array.markers.reserve(ros_markers.size());
+            for (auto& entry : ros_markers) {
+                array.markers.push_back(std::move(entry.second));
+            }
+            m_viz.visualize(level, array);
+        }
+#endif
+        lock.lock();
+    }
+}
+
+} // namespace sbpl_interface
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_async_visualizer_h
+#define sbpl_interface_async_visualizer_h
+
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// system includes
+#include <ros/ros.h>
+#include <smpl/debug/visualize.h>
+#include <smpl/debug/visualizer_ros.h>
+
+namespace sbpl_interface {
+
+/// \brief Visualizer that publishes markers from a background thread
+///
+/// Markers handed to the visualizer are queued by namespace and published
+/// later by a worker thread, so that the caller never waits on conversion or
+/// publishing. Each namespace is published at most at its configured rate.
+/// Pending markers are kept by id, so a namespace may be filled over several
+/// calls; only a marker superseded by one with the same namespace and id
+/// before it is published is dropped. A DELETEALL marker discards the pending
+/// markers of its namespace.
+///
+/// Callers whose markers are expensive to construct may queue a function that
+/// builds them instead. The function is called from the worker thread when the
+/// namespace is published and is never called if it is superseded first.
+class AsyncVisualizer : public smpl::visual::VisualizerBase
+{
+public:
+
+    typedef std::chrono::steady_clock clock;
+
+    typedef std::function<visualization_msgs::MarkerArray()> MarkerBuilder;
+
+    AsyncVisualizer(
+        const ros::NodeHandle& nh = ros::NodeHandle(),
+        double rate = 10.0);
+
+    ~AsyncVisualizer();
+
+    /// Set the maximum publish rate, in Hz, of namespaces without a rate of
+    /// their own. A non-positive rate removes the limit.
+    void setDefaultRate(double rate);
+
+    /// Set the maximum publish rate, in Hz, of a single namespace
+    void setRate(const std::string& ns, double rate);
+
+    /// Queue a function that builds the markers of a namespace. The function
+    /// must not refer to state that may change or be destroyed before it is
+    /// called.
+    void visualizeDeferred(
+        smpl::visual::Level level,
+        const std::string& ns,
+        MarkerBuilder build);
+
+    /// \name Reimplemented Functions from VisualizerBase
+    ///@{
+    void visualize(
+        smpl::visual::Level level,
+        const smpl::visual::Marker& marker) override;
+
+    void visualize(
+        smpl::visual::Level level,
+        const std::vector<smpl::visual::Marker>& markers) override;
+
+#ifdef SMPL_SV_VISUALIZATION_MSGS
+    void visualize(
+        smpl::visual::Level level,
+        const visualization_msgs::MarkerArray& markers) override;
+#endif
+    ///@}
+
+private:
+
+    struct Namespace
+    {
+        smpl::visual::Level level;
+        std::map<int, smpl::visual::Marker> markers;
+        std::map<int, visualization_msgs::Marker> ros_markers;
+        MarkerBuilder build;
+        bool pending = false;
+        clock::time_point last_publish;
+        clock::duration period = clock::duration::zero();
+    };
+
+    smpl::VisualizerROS m_viz;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_done;
+
+    clock::duration m_default_period;
+    std::unordered_map<std::string, clock::duration> m_periods;
+    std::unordered_map<std::string, Namespace> m_namespaces;
+
+    std::thread m_thread;
+
+    auto getPendingNamespace(
+        const std::string& name,
+        smpl::visual::Level level)
+        -> Namespace&;
+
+    void run();
+};
+
+} // namespace sbpl_interface
+
+#endif
@@ -0,0 +1,184 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "heuristic_grid_registry.h"
+
+// standard includes
+#include <algorithm>
+#include <utility>
+
+// system includes
+#include <ros/console.h>
+
+// project includes
+#include "../collision/collision_common_sbpl.h"
+
+namespace sbpl_interface {
+
+static const char* LOG = "grid_registry";
+
+static
+bool SameAABB(
+    const moveit_msgs::OrientedBoundingBox& a,
+    const moveit_msgs::OrientedBoundingBox& b)
+{
+    return a.pose.position.x == b.pose.position.x &&
+            a.pose.position.y == b.pose.position.y &&
+            a.pose.position.z == b.pose.position.z &&
+            a.pose.orientation.w == b.pose.orientation.w &&
+            a.pose.orientation.x == b.pose.orientation.x &&
+            a.pose.orientation.y == b.pose.orientation.y &&
+            a.pose.orientation.z == b.pose.orientation.z &&
+            a.extents.x == b.extents.x &&
+            a.extents.y == b.extents.y &&
+            a.extents.z == b.extents.z;
+}
+
+bool HeuristicGridRegistry::Key::operator==(const Key& other) const
+{
+    return res == other.res &&
+            inflation_radius == other.inflation_radius &&
+            voxel_version == other.voxel_version &&
+            frame_id == other.frame_id &&
+            SameAABB(workspace_aabb, other.workspace_aabb) &&
+            objects == other.objects;
+}
+
+auto HeuristicGridRegistry::MakeKey(
+    const collision_detection::World& world,
+    uint64_t voxel_version,
+    const std::string& frame_id,
+    const moveit_msgs::OrientedBoundingBox& workspace_aabb,
+    double res,
+    double inflation_radius)
+    -> Key
+{
+    Key key;
+    key.objects.reserve(world.size());
+    for (auto it = world.begin(); it != world.end(); ++it) {
+        key.objects.push_back(it->second);
+    }
+    std::sort(begin(key.objects), end(key.objects));
+    key.voxel_version = voxel_version;
+    key.frame_id = frame_id;
+    key.workspace_aabb = workspace_aabb;
+    key.res = res;
+    key.inflation_radius = inflation_radius;
+    return key;
+}
+
+auto HeuristicGridRegistry::find(const Key& key) -> GridConstPtr
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    prune();
+    for (auto& entry : m_entries) {
+        if (entry.key == key) {
+            return entry.grid.lock();
+        }
+    }
+    return nullptr;
+}
+
+void HeuristicGridRegistry::insert(Key key, const GridConstPtr& grid)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    prune();
+    for (auto& entry : m_entries) {
+        if (entry.key == key) {
+            entry.grid = grid;
+            return;
+        }
+    }
+
+    Entry entry;
+    entry.key = std::move(key);
+    entry.grid = grid;
+    m_entries.push_back(std::move(entry));
+    ROS_DEBUG_NAMED(LOG, "Register heuristic grid (%zu registered)", m_entries.size());
+}
+
+bool HeuristicGridRegistry::contains(const smpl::OccupancyGrid* grid) const
+{
+    for (auto& live : liveGrids()) {
+        if (live.get() == grid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t HeuristicGridRegistry::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+auto HeuristicGridRegistry::memoryUsage() const -> size_t
+{
+    auto grids = liveGrids();
+    std::sort(begin(grids), end(grids));
+    grids.erase(std::unique(begin(grids), end(grids)), end(grids));
+
+    size_t usage = 0;
+    for (auto& grid : grids) {
+        usage += collision_detection::GridMemoryUsage(*grid);
+    }
+    return usage;
+}
+
+// Return the registered grids that are still held by some context
+auto HeuristicGridRegistry::liveGrids() const -> std::vector<GridConstPtr>
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<GridConstPtr> grids;
+    grids.reserve(m_entries.size());
+    for (auto& entry : m_entries) {
+        auto grid = entry.grid.lock();
+        if (grid) {
+            grids.push_back(std::move(grid));
+        }
+    }
+    return grids;
+}
+
+// Forget grids that are no longer held by any context, along with the world
+// objects their keys refer to
+void HeuristicGridRegistry::prune()
+{
+    auto expired = [](const Entry& entry) { return entry.grid.expired(); };
+    m_entries.erase(
+            std::remove_if(begin(m_entries), end(m_entries), expired),
+            end(m_entries));
+}
+
+} // namespace sbpl_interface
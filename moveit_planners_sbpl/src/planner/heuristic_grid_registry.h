@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_heuristic_grid_registry_h
+#define sbpl_interface_heuristic_grid_registry_h
+
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// system includes
+#include <moveit/collision_detection/world.h>
+#include <moveit_msgs/OrientedBoundingBox.h>
+#include <smpl/occupancy_grid.h>
+
+namespace sbpl_interface {
+
+/// \brief Shares read-only heuristic grids between planning contexts
+///
+/// Grids are identified by the contents of the world they were built from, the
+/// bounds of the workspace in the planning frame, the grid resolution, and the
+/// obstacle inflation radius. The registry does not own the grids; an entry is
+/// forgotten once the last context holding its grid releases it.
+class HeuristicGridRegistry
+{
+public:
+
+    typedef std::shared_ptr<const smpl::OccupancyGrid> GridConstPtr;
+
+    struct Key
+    {
+        // world objects, ordered by address. Unmodified objects are shared
+        // between copies of a world, so equal objects imply equal contents.
+        std::vector<collision_detection::World::ObjectConstPtr> objects;
+
+        // version of the voxels applied to the world outside of its objects
+        uint64_t voxel_version;
+
+        std::string frame_id;
+        moveit_msgs::OrientedBoundingBox workspace_aabb;
+        double res;
+        double inflation_radius;
+
+        bool operator==(const Key& other) const;
+    };
+
+    static auto MakeKey(
+        const collision_detection::World& world,
+        uint64_t voxel_version,
+        const std::string& frame_id,
+        const moveit_msgs::OrientedBoundingBox& workspace_aabb,
+        double res,
+        double inflation_radius)
+        -> Key;
+
+    /// Return the grid registered under \p key or null if there is none
+    auto find(const Key& key) -> GridConstPtr;
+
+    /// Register a grid. Replaces any grid already registered under \p key.
+    void insert(Key key, const GridConstPtr& grid);
+
+    /// Return whether \p grid is registered
+    bool contains(const smpl::OccupancyGrid* grid) const;
+
+    size_t size() const;
+
+    /// Return an estimate of the memory, in bytes, held by registered grids.
+    /// Each grid is counted once, however many contexts hold it.
+    auto memoryUsage() const -> size_t;
+
+private:
+
+    struct Entry
+    {
+        Key key;
+        std::weak_ptr<const smpl::OccupancyGrid> grid;
+    };
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+
+    void prune();
+    auto liveGrids() const -> std::vector<GridConstPtr>;
+};
+
+} // namespace sbpl_interface
+
+#endif
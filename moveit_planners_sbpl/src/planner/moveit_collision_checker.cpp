@@ -34,9 +34,13 @@
 #include "moveit_collision_checker.h"
 
 // standard includes
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <limits>
 
 // system includes
+#include <geometric_shapes/shape_operations.h>
 #include <ros/console.h>
 #include <ros/ros.h>
 #include <smpl/angles.h>
@@ -46,13 +50,26 @@
 
 #include <moveit_planners_sbpl/planner/moveit_robot_model.h>
 
+// project includes
+#include "../collision/collision_world_sbpl.h"
+
 namespace sbpl_interface {
 
-MoveItCollisionChecker::MoveItCollisionChecker() :
+MoveItCollisionChecker::MoveItCollisionChecker(Arena* arena) :
     Base(),
     m_robot_model(nullptr),
     m_scene(),
-    m_ref_state()
+    m_ref_state(),
+    m_waypoint_path(ArenaAllocator<smpl::RobotState>(arena)),
+    m_enabled_ccd(false),
+    m_arena(arena),
+    m_cache_results(false),
+    m_state_cache(0, VectorHash(), std::equal_to<CacheKey>(), arena),
+    m_edge_cache(0, VectorHash(), std::equal_to<CacheKey>(), arena),
+    m_enabled_swept_volumes(false),
+    m_distance_field(),
+    m_rcm(),
+    m_swept_volumes(0, VectorHash(), std::equal_to<CacheKey>(), arena)
 {
     ros::NodeHandle nh;
 }
@@ -115,6 +132,14 @@ bool MoveItCollisionChecker::init(
     ph.param("enable_ccd", m_enabled_ccd, false);
     ROS_INFO("enable_ccd: %s", m_enabled_ccd ? "true" : "false");
 
+    ph.param("enable_swept_volumes", m_enabled_swept_volumes, false);
+    ROS_INFO("enable_swept_volumes: %s", m_enabled_swept_volumes ? "true" : "false");
+    m_distance_field.reset();
+    m_rcm.reset();
+    if (m_enabled_swept_volumes) {
+        initSweptVolumes();
+    }
+
     return true;
 }
 
@@ -123,6 +148,71 @@ bool MoveItCollisionChecker::initialized() const
     return (bool)m_robot_model;
 }
 
+void MoveItCollisionChecker::setCacheResults(bool cache)
+{
+    m_cache_results = cache;
+    if (!cache) {
+        clearCaches();
+    }
+}
+
+// Copy a scratch key into storage from the arena, to be stored in a cache
+auto MoveItCollisionChecker::storedKey(const CacheKey& key) const -> CacheKey
+{
+    return CacheKey(begin(key), end(key), ArenaAllocator<double>(m_arena));
+}
+
+// Clear the state, edge, and swept volume caches together so that the arena
+// may reclaim their storage. The caches, and the waypoint path, are swapped
+// with empty containers, which hold no storage from the arena, and destroyed
+// before the arena is reset, so this must not be called while the waypoints
+// are in use.
+void MoveItCollisionChecker::clearCaches()
+{
+    if (!m_arena) {
+        m_state_cache.clear();
+        m_edge_cache.clear();
+        m_swept_volumes.clear();
+        return;
+    }
+
+    WaypointPath(ArenaAllocator<smpl::RobotState>(m_arena))
+            .swap(m_waypoint_path);
+    CacheMap<bool>(0, VectorHash(), std::equal_to<CacheKey>(), m_arena)
+            .swap(m_state_cache);
+    CacheMap<bool>(0, VectorHash(), std::equal_to<CacheKey>(), m_arena)
+            .swap(m_edge_cache);
+    SweptVolumeMap(0, VectorHash(), std::equal_to<CacheKey>(), m_arena)
+            .swap(m_swept_volumes);
+    m_arena->reset();
+}
+
+auto MoveItCollisionChecker::memoryUsage() const -> size_t
+{
+    // hash table node: next pointer, cached hash, key, and value
+    const size_t node_size =
+            sizeof(void*) + sizeof(size_t) + sizeof(std::vector<double>) +
+            sizeof(void*);
+    const size_t state_size = m_zero_state.size() * sizeof(double);
+
+    // cache entries allocated from the arena are accounted for by its owner
+    size_t usage = 0;
+    if (!m_arena) {
+        usage += m_state_cache.size() * (node_size + state_size);
+        usage += m_edge_cache.size() * (node_size + 2 * state_size);
+    }
+    for (auto& entry : m_swept_volumes) {
+        auto& volume = entry.second;
+        if (!m_arena) {
+            usage += node_size + sizeof(SweptVolume);
+            usage += entry.first.size() * sizeof(double);
+        }
+        usage += volume.centers.size() * sizeof(Eigen::Vector3d);
+        usage += volume.radii.size() * sizeof(double);
+    }
+    return usage;
+}
+
 smpl::Extension* MoveItCollisionChecker::getExtension(size_t class_code)
 {
     if (class_code == smpl::GetClassCode<smpl::CollisionChecker>()) {
@@ -140,6 +230,30 @@ bool MoveItCollisionChecker::isStateValid(
         return false;
     }
 
+    if (!m_cache_results) {
+        return checkStateValid(state, verbose);
+    }
+
+    m_state_key.assign(begin(state), end(state));
+    auto it = m_state_cache.find(m_state_key);
+    if (it != end(m_state_cache)) {
+        return it->second;
+    }
+
+    const size_t max_cache_size = 1 << 20;
+    if (m_state_cache.size() >= max_cache_size) {
+        clearCaches();
+    }
+
+    bool valid = checkStateValid(state, verbose);
+    m_state_cache.emplace(storedKey(m_state_key), valid);
+    return valid;
+}
+
+bool MoveItCollisionChecker::checkStateValid(
+    const smpl::RobotState& state,
+    bool verbose)
+{
     setRobotStateFromState(*m_ref_state, state);
 
     // TODO: need to propagate path_constraints and trajectory_constraints down
@@ -160,12 +274,44 @@ bool MoveItCollisionChecker::isStateToStateValid(
     const smpl::RobotState& start,
     const smpl::RobotState& finish,
     bool verbose)
+{
+    if (!m_cache_results) {
+        return checkStateToStateValid(start, finish);
+    }
+
+    m_edge_key.assign(begin(start), end(start));
+    m_edge_key.insert(end(m_edge_key), begin(finish), end(finish));
+    auto it = m_edge_cache.find(m_edge_key);
+    if (it != end(m_edge_cache)) {
+        return it->second;
+    }
+
+    const size_t max_cache_size = 1 << 20;
+    if (m_edge_cache.size() >= max_cache_size) {
+        clearCaches();
+    }
+
+    bool valid = checkStateToStateValid(start, finish);
+    m_edge_cache.emplace(storedKey(m_edge_key), valid);
+    return valid;
+}
+
+bool MoveItCollisionChecker::checkStateToStateValid(
+    const smpl::RobotState& start,
+    const smpl::RobotState& finish)
 {
     if (m_enabled_ccd) {
         return checkContinuousCollision(start, finish);
-    } else {
-        return checkInterpolatedPathCollision(start, finish);
     }
+
+    if (m_distance_field) {
+        bool valid;
+        if (checkSweptVolumeCollision(start, finish, valid)) {
+            return valid;
+        }
+    }
+
+    return checkInterpolatedPathCollision(start, finish);
 }
 
 bool MoveItCollisionChecker::interpolatePath(
@@ -177,6 +323,285 @@ bool MoveItCollisionChecker::interpolatePath(
     return interpolatePathFast(start, finish, opath) >= 0;
 }
 
+// Swept volume templates are only used when the world distance field is
+// available from the sbpl collision world. The field is fetched again for each
+// scene given to init(). For each planning variable, record which other
+// planning variables lie below it in the kinematic tree and the links that it
+// moves.
+void MoveItCollisionChecker::initSweptVolumes()
+{
+    auto* cworld = dynamic_cast<const collision_detection::CollisionWorldSBPL*>(
+            m_scene->getCollisionWorld().get());
+    if (!cworld) {
+        ROS_WARN("Swept volume templates require the SBPL collision world");
+        return;
+    }
+
+    m_distance_field = cworld->sharedDistanceField();
+    if (!m_distance_field) {
+        ROS_WARN("Swept volume templates require an initialized world distance field");
+        return;
+    }
+
+    auto* crobot = dynamic_cast<const collision_detection::CollisionRobotSBPL*>(
+            m_scene->getCollisionRobotUnpadded().get());
+    if (crobot) {
+        m_rcm = crobot->robotCollisionModel();
+    }
+
+    auto& model = *m_robot_model->moveitRobotModel();
+    auto& avinds = m_robot_model->activeVariableIndices();
+    const size_t var_count = avinds.size();
+
+    std::vector<const moveit::core::JointModel*> var_joints(var_count);
+    for (size_t vidx = 0; vidx < var_count; ++vidx) {
+        var_joints[vidx] = model.getJointOfVariable(avinds[vidx]);
+    }
+
+    m_var_below.assign(var_count, std::vector<bool>(var_count, false));
+    m_var_templatable.assign(var_count, false);
+    m_var_child_link.assign(var_count, nullptr);
+    m_var_subtree_links.assign(var_count, { });
+    for (size_t i = 0; i < var_count; ++i) {
+        auto* joint = var_joints[i];
+        auto& descendants = joint->getDescendantJointModels();
+        for (size_t j = 0; j < var_count; ++j) {
+            m_var_below[i][j] = std::find(
+                    begin(descendants), end(descendants), var_joints[j]) !=
+                    end(descendants);
+        }
+
+        // the motion of the child link relative to its own frame at the start
+        // of the motion is independent of the start position only for
+        // single-dof joints
+        m_var_templatable[i] =
+                joint->getMimic() == nullptr &&
+                joint->getVariableCount() == 1 &&
+                (joint->getType() == moveit::core::JointModel::REVOLUTE ||
+                joint->getType() == moveit::core::JointModel::PRISMATIC);
+        m_var_child_link[i] = joint->getChildLinkModel();
+        m_var_subtree_links[i] = joint->getDescendantLinkModels();
+    }
+
+    m_swept_volumes.clear();
+}
+
+// Check the motion between two states against the world by testing the swept
+// volume of the links moved by the motion against the world distance field.
+// The links that do not move are assumed to have been validated with the start
+// state. Self collisions are still checked at each interpolated waypoint.
+// Return false if the motion could not be decided this way, in which case the
+// motion should be checked by interpolation.
+auto MoveItCollisionChecker::checkSweptVolumeCollision(
+    const smpl::RobotState& start,
+    const smpl::RobotState& finish,
+    bool& valid)
+    -> bool
+{
+    // make room before the waypoints are interpolated, as clearing the caches
+    // releases them
+    const size_t max_swept_volumes = 10000;
+    if (m_swept_volumes.size() >= max_swept_volumes) {
+        clearCaches();
+    }
+
+    int waypoint_count = interpolatePathFast(start, finish, m_waypoint_path);
+    if (waypoint_count < 0) {
+        valid = false;
+        return true;
+    }
+
+    // find the moving variable that all other moving variables are below
+    int root_vidx = -1;
+    for (size_t vidx = 0; vidx < m_diffs.size(); ++vidx) {
+        if (m_diffs[vidx] == 0.0) {
+            continue;
+        }
+        if (root_vidx < 0 || m_var_below[vidx][root_vidx]) {
+            root_vidx = (int)vidx;
+        }
+    }
+
+    if (root_vidx < 0 || !m_var_templatable[root_vidx]) {
+        return false;
+    }
+
+    for (size_t vidx = 0; vidx < m_diffs.size(); ++vidx) {
+        if (m_diffs[vidx] != 0.0 &&
+            (int)vidx != root_vidx &&
+            !m_var_below[root_vidx][vidx])
+        {
+            return false;
+        }
+    }
+
+    m_swept_volume_key.clear();
+    m_swept_volume_key.push_back((double)root_vidx);
+    m_swept_volume_key.insert(
+            end(m_swept_volume_key), begin(m_diffs), end(m_diffs));
+    for (size_t vidx = 0; vidx < start.size(); ++vidx) {
+        if (m_var_below[root_vidx][vidx]) {
+            m_swept_volume_key.push_back(start[vidx]);
+        }
+    }
+
+    auto it = m_swept_volumes.find(m_swept_volume_key);
+    if (it == end(m_swept_volumes)) {
+        auto sv = createSweptVolume(root_vidx, waypoint_count);
+        it = m_swept_volumes.emplace(
+                storedKey(m_swept_volume_key), std::move(sv)).first;
+    }
+    auto& sv = it->second;
+    if (!sv.decidable) {
+        return false;
+    }
+
+    setRobotStateFromState(*m_ref_state, start);
+    auto& T_model_link = m_ref_state->getGlobalLinkTransform(
+            m_var_child_link[root_vidx]);
+
+    // account for the discretization of the distance field
+    const double margin = std::sqrt(3.0) * m_distance_field->resolution();
+
+    for (size_t sidx = 0; sidx < sv.centers.size(); ++sidx) {
+        Eigen::Vector3d p = T_model_link * sv.centers[sidx];
+        int gx, gy, gz;
+        m_distance_field->worldToGrid(p.x(), p.y(), p.z(), gx, gy, gz);
+        if (!m_distance_field->isCellValid(gx, gy, gz)) {
+            return false;
+        }
+        double d = m_distance_field->getCellDistance(gx, gy, gz);
+        if (d < sv.radii[sidx] + margin) {
+            return false;
+        }
+    }
+
+    collision_detection::CollisionRequest req;
+    req.group_name = m_robot_model->planningGroupName();
+    auto cr = m_scene->getCollisionRobotUnpadded();
+    for (int widx = 0; widx < waypoint_count; ++widx) {
+        setRobotStateFromState(*m_ref_state, m_waypoint_path[widx]);
+        m_ref_state->update();
+        collision_detection::CollisionResult res;
+        cr->checkSelfCollision(
+                req, res, *m_ref_state, m_scene->getAllowedCollisionMatrix());
+        if (res.collision) {
+            valid = false;
+            return true;
+        }
+    }
+
+    valid = true;
+    return true;
+}
+
+// Construct the swept volume of the links below the root variable over the
+// waypoints currently stored in m_waypoint_path. Links are covered by the
+// spheres of the robot collision model, if available, and attached bodies by
+// the bounding spheres of their shapes. Each sphere is inflated by the
+// furthest its center travels between consecutive waypoints so that the
+// volume swept between waypoints is covered.
+auto MoveItCollisionChecker::createSweptVolume(int root_vidx, int waypoint_count)
+    -> SweptVolume
+{
+    struct BodySphere
+    {
+        const moveit::core::LinkModel* link;
+        Eigen::Vector3d center; // in the link frame
+        double radius;
+    };
+
+    std::vector<BodySphere> body_spheres;
+    auto& links = m_var_subtree_links[root_vidx];
+    for (auto* link : links) {
+        if (m_rcm) {
+            // links without spheres are not checked against the world
+            if (!m_rcm->hasLink(link->getName())) {
+                continue;
+            }
+            auto* spheres_model = m_rcm->linkSpheresModel(
+                    m_rcm->linkIndex(link->getName()));
+            if (!spheres_model) {
+                continue;
+            }
+            for (auto& sphere : spheres_model->spheres) {
+                body_spheres.push_back({ link, sphere.center, sphere.radius });
+            }
+            continue;
+        }
+
+        auto& shapes = link->getShapes();
+        auto& origins = link->getCollisionOriginTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            body_spheres.push_back({ link, origins[i] * center, radius });
+        }
+    }
+
+    std::vector<const moveit::core::AttachedBody*> attached_bodies;
+    m_ref_state->getAttachedBodies(attached_bodies);
+    for (auto* ab : attached_bodies) {
+        auto* link = ab->getAttachedLink();
+        if (std::find(begin(links), end(links), link) == end(links)) {
+            continue;
+        }
+        auto& shapes = ab->getShapes();
+        auto& transforms = ab->getFixedTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            body_spheres.push_back({ link, transforms[i] * center, radius });
+        }
+    }
+
+    auto& state = *m_ref_state;
+    auto* root_link = m_var_child_link[root_vidx];
+
+    setRobotStateFromState(state, m_waypoint_path[0]);
+    const Eigen::Affine3d T_link_model =
+            state.getGlobalLinkTransform(root_link).inverse();
+
+    SweptVolume sv;
+    sv.centers.reserve(body_spheres.size() * waypoint_count);
+    sv.radii.reserve(body_spheres.size() * waypoint_count);
+
+    std::vector<double> max_step(body_spheres.size(), 0.0);
+    for (int widx = 0; widx < waypoint_count; ++widx) {
+        setRobotStateFromState(state, m_waypoint_path[widx]);
+        for (size_t bidx = 0; bidx < body_spheres.size(); ++bidx) {
+            auto& bs = body_spheres[bidx];
+            Eigen::Vector3d c = T_link_model *
+                    (state.getGlobalLinkTransform(bs.link) * bs.center);
+            if (widx > 0) {
+                auto& prev = sv.centers[(widx - 1) * body_spheres.size() + bidx];
+                max_step[bidx] = std::max(max_step[bidx], (c - prev).norm());
+            }
+            sv.centers.push_back(c);
+            sv.radii.push_back(bs.radius);
+        }
+    }
+
+    for (size_t sidx = 0; sidx < sv.radii.size(); ++sidx) {
+        sv.radii[sidx] += max_step[sidx % body_spheres.size()];
+    }
+
+    // a sphere that reaches the maximum distance of the field is never cleared
+    // by it; check such motions by interpolation without looking up the field
+    const double margin = std::sqrt(3.0) * m_distance_field->resolution();
+    const double max_distance = m_distance_field->getUninitializedDistance();
+    for (auto radius : sv.radii) {
+        if (radius + margin >= max_distance) {
+            sv.decidable = false;
+            break;
+        }
+    }
+
+    return sv;
+}
+
 auto MoveItCollisionChecker::checkContinuousCollision(
     const smpl::RobotState& start,
     const smpl::RobotState& finish)
@@ -220,7 +645,7 @@ auto MoveItCollisionChecker::checkInterpolatedPathCollision(
 
     for (int widx = 0; widx < waypoint_count; ++widx) {
         auto& p = m_waypoint_path[widx];
-        if (!isStateValid(p, false)) {
+        if (!checkStateValid(p, false)) {
             return false;
         }
     }
@@ -239,10 +664,11 @@ void MoveItCollisionChecker::setRobotStateFromState(
     }
 }
 
+template <class Path>
 int MoveItCollisionChecker::interpolatePathFast(
     const smpl::RobotState& start,
     const smpl::RobotState& finish,
-    std::vector<smpl::RobotState>& opath)
+    Path& opath)
 {
     assert(start.size() == m_robot_model->activeVariableCount() &&
             finish.size() == m_robot_model->activeVariableCount());
@@ -34,11 +34,24 @@
 #ifndef sbpl_interface_moveit_collision_checker_h
 #define sbpl_interface_moveit_collision_checker_h
 
+// standard includes
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// system includes
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
 #include <moveit/planning_scene/planning_scene.h>
 #include <moveit/robot_model/robot_model.h>
 #include <moveit/robot_state/robot_state.h>
 #include <ros/ros.h>
+#include <sbpl_collision_checking/robot_collision_model.h>
 #include <smpl/collision_checker.h>
+#include <smpl/distance_map/distance_map_interface.h>
+
+// project includes
+#include "arena.h"
 
 namespace sbpl_interface {
 
@@ -50,7 +63,11 @@ public:
 
     typedef smpl::CollisionChecker Base;
 
-    MoveItCollisionChecker();
+    /// Cached results and swept volumes are allocated from the arena, if one
+    /// is given. The arena must outlive the collision checker and is reset by
+    /// the collision checker when its caches are cleared, so it must not back
+    /// any other objects.
+    explicit MoveItCollisionChecker(Arena* arena = nullptr);
     ~MoveItCollisionChecker();
 
     bool init(
@@ -60,6 +77,17 @@ public:
 
     bool initialized() const;
 
+    /// Remember the results of state and edge validity checks so that repeated
+    /// queries, e.g. from subsequent searches in an unchanged scene, are
+    /// answered without collision checking. Results are only valid while the
+    /// scene and reference state given to init() are unchanged.
+    void setCacheResults(bool cache);
+    bool cacheResults() const { return m_cache_results; }
+
+    /// Return an estimate of the memory, in bytes, held by cached results and
+    /// swept volumes, excluding memory held by the arena
+    auto memoryUsage() const -> size_t;
+
     /// \name Required Functions from Extension
     ///@{
     smpl::Extension* getExtension(size_t class_code) override;
@@ -99,10 +127,105 @@ private:
 
     smpl::RobotState m_zero_state;
     std::vector<double> m_diffs;
-    std::vector<smpl::RobotState> m_waypoint_path;
+
+    // waypoints interpolated for a single check. the path is allocated from
+    // the arena; the states within it are smpl::RobotStates, which use the
+    // heap, but are reused as long as the path is
+    typedef std::vector<smpl::RobotState, ArenaAllocator<smpl::RobotState>>
+    WaypointPath;
+    WaypointPath m_waypoint_path;
 
     bool m_enabled_ccd;
 
+    Arena* m_arena;
+
+    struct VectorHash
+    {
+        template <class Vector>
+        size_t operator()(const Vector& key) const
+        {
+            size_t seed = 0;
+            for (double d : key) {
+                seed ^= std::hash<double>()(d) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            }
+            return seed;
+        }
+    };
+
+    // keys stored in the caches are allocated from the arena; scratch keys
+    // used for lookups are allocated from the heap and reused
+    typedef std::vector<double, ArenaAllocator<double>> CacheKey;
+
+    template <class T>
+    using CacheMap = std::unordered_map<
+            CacheKey, T, VectorHash, std::equal_to<CacheKey>,
+            ArenaAllocator<std::pair<const CacheKey, T>>>;
+
+    // cached validity of states and of edges, keyed on the concatenation of
+    // their endpoints
+    bool m_cache_results;
+    CacheMap<bool> m_state_cache;
+    CacheMap<bool> m_edge_cache;
+    CacheKey m_state_key;
+    CacheKey m_edge_key;
+
+    // Swept sphere envelope of the links moved by a joint-space primitive,
+    // expressed in the frame of the child link of the primitive's root joint
+    // at the start of the motion
+    struct SweptVolume
+    {
+        std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d>> centers;
+        std::vector<double> radii;
+
+        // false if some sphere is too large to be cleared by the distance
+        // field, which saturates at its maximum propagation distance
+        bool decidable = true;
+    };
+
+    // key = (root variable, variable deltas, start positions of the variables
+    // below the root variable)
+    typedef CacheMap<SweptVolume> SweptVolumeMap;
+
+    bool m_enabled_swept_volumes;
+
+    // held, rather than borrowed from the collision world, so that it outlives
+    // a copy-on-write of the world while this checker is reused
+    std::shared_ptr<const smpl::DistanceMapInterface> m_distance_field;
+
+    // spheres of the links, as checked against the world by the sbpl collision
+    // world, or null to bound each collision shape by a sphere instead
+    smpl::collision::RobotCollisionModelConstPtr m_rcm;
+
+    // per-variable kinematic structure used to determine whether a motion is
+    // described by a swept volume template
+    std::vector<std::vector<bool>> m_var_below; // [i][j] -> j below i
+    std::vector<bool> m_var_templatable;
+    std::vector<const moveit::core::LinkModel*> m_var_child_link;
+    std::vector<std::vector<const moveit::core::LinkModel*>> m_var_subtree_links;
+
+    SweptVolumeMap m_swept_volumes;
+    CacheKey m_swept_volume_key;
+
+    auto storedKey(const CacheKey& key) const -> CacheKey;
+
+    void clearCaches();
+
+    void initSweptVolumes();
+
+    auto checkSweptVolumeCollision(
+        const smpl::RobotState& start,
+        const smpl::RobotState& finish,
+        bool& valid)
+        -> bool;
+
+    auto createSweptVolume(int root_vidx, int waypoint_count) -> SweptVolume;
+
+    bool checkStateValid(const smpl::RobotState& state, bool verbose);
+
+    bool checkStateToStateValid(
+        const smpl::RobotState& start,
+        const smpl::RobotState& finish);
+
     auto checkContinuousCollision(
         const smpl::RobotState& start,
         const smpl::RobotState& finish)
@@ -120,10 +243,11 @@ private:
     // interpolate the path between start and finish, storing intermediate
     // waypoints within opath. previous entries in opath are overwritten and
     // never cleared. the number of relevant waypoints is returned
+    template <class Path>
     int interpolatePathFast(
         const smpl::RobotState& start,
         const smpl::RobotState& finish,
-        std::vector<smpl::RobotState>& opath);
+        Path& opath);
 };
 
 } // namespace sbpl_interface
@@ -0,0 +1,306 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "predicted_obstacle_timing.h"
+
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// system includes
+#include <geometric_shapes/shape_operations.h>
+#include <ros/console.h>
+#include <smpl/angles.h>
+
+// project includes
+#include <moveit_planners_sbpl/planner/moveit_robot_model.h>
+
+#include "time_scaled_primitives.h"
+
+namespace sbpl_interface {
+
+static const char* LOG = "predicted_obstacles";
+
+namespace {
+
+struct BodySphere
+{
+    const moveit::core::LinkModel* link;
+    Eigen::Vector3d center; // in the link frame
+    double radius;
+};
+
+} // namespace
+
+static
+auto GetBodySpheres(const moveit::core::RobotState& state)
+    -> std::vector<BodySphere>
+{
+    std::vector<BodySphere> body_spheres;
+    auto& model = *state.getRobotModel();
+    for (auto* link : model.getLinkModelsWithCollisionGeometry()) {
+        auto& shapes = link->getShapes();
+        auto& origins = link->getCollisionOriginTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            body_spheres.push_back({ link, origins[i] * center, radius });
+        }
+    }
+
+    std::vector<const moveit::core::AttachedBody*> attached_bodies;
+    state.getAttachedBodies(attached_bodies);
+    for (auto* ab : attached_bodies) {
+        auto& shapes = ab->getShapes();
+        auto& transforms = ab->getFixedTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            body_spheres.push_back(
+                    { ab->getAttachedLink(), transforms[i] * center, radius });
+        }
+    }
+
+    return body_spheres;
+}
+
+// Linearly interpolate the path so that no motion between consecutive
+// waypoints takes longer than max_time
+static
+void DensifyPath(
+    const std::vector<double>& vel_limits,
+    const std::vector<bool>& continuous,
+    double max_time,
+    const std::vector<smpl::RobotState>& path,
+    std::vector<smpl::RobotState>& dense)
+{
+    dense.clear();
+    dense.push_back(path.front());
+    for (size_t i = 1; i < path.size(); ++i) {
+        auto& a = path[i - 1];
+        auto& b = path[i];
+        auto time = MinTraversalTime(vel_limits, continuous, a, b);
+        auto count = std::max(1, (int)std::ceil(time / max_time));
+        for (int s = 1; s <= count; ++s) {
+            auto alpha = (double)s / (double)count;
+            smpl::RobotState p(a.size());
+            for (size_t vidx = 0; vidx < a.size(); ++vidx) {
+                if (continuous[vidx]) {
+                    auto diff = smpl::angles::shortest_angle_diff(b[vidx], a[vidx]);
+                    p[vidx] = smpl::angles::normalize_angle(a[vidx] + alpha * diff);
+                } else {
+                    p[vidx] = a[vidx] + alpha * (b[vidx] - a[vidx]);
+                }
+            }
+            dense.push_back(std::move(p));
+        }
+    }
+}
+
+bool TimePathAroundPredictedObstacles(
+    const MoveItRobotModel& robot_model,
+    moveit::core::RobotState& state,
+    const collision_detection::CollisionWorldSBPL::PredictedObstacles& obstacles,
+    const std::vector<double>& vel_limits,
+    const ros::Time& start_time,
+    std::vector<smpl::RobotState>& path,
+    std::vector<double>& times)
+{
+    if (path.empty() || obstacles.dt <= 0.0) {
+        return false;
+    }
+
+    auto& continuous = robot_model.variableContinuous();
+    auto& var_indices = robot_model.activeVariableIndices();
+    const double dt = obstacles.dt;
+
+    std::vector<smpl::RobotState> dense;
+    DensifyPath(vel_limits, continuous, 0.25 * dt, path, dense);
+    const int n = (int)dense.size();
+
+    // minimum time to reach each waypoint from the start of the path
+    std::vector<double> cum(n, 0.0);
+    for (int i = 1; i < n; ++i) {
+        cum[i] = cum[i - 1] + MinTraversalTime(
+                vel_limits, continuous, dense[i - 1], dense[i]);
+    }
+
+    auto body_spheres = GetBodySpheres(state);
+    const int sphere_count = (int)body_spheres.size();
+    std::vector<Eigen::Vector3d> centers(n * sphere_count);
+    for (int i = 0; i < n; ++i) {
+        for (size_t vidx = 0; vidx < var_indices.size(); ++vidx) {
+            state.setVariablePosition(var_indices[vidx], dense[i][vidx]);
+        }
+        state.updateLinkTransforms();
+        for (int s = 0; s < sphere_count; ++s) {
+            auto& sphere = body_spheres[s];
+            centers[i * sphere_count + s] =
+                    state.getGlobalLinkTransform(sphere.link) * sphere.center;
+        }
+    }
+
+    // step k spans [start_time + k * dt, start_time + (k + 1) * dt) and
+    // overlaps at most two layers of predictions
+    const int layer_count = (int)obstacles.layers.size();
+    const double offset = (start_time - obstacles.stamp).toSec();
+    const int first_layer = (int)std::floor(offset / dt);
+    const int horizon = std::max(0, layer_count - first_layer);
+
+    std::vector<int8_t> occupied(n * horizon, -1);
+    auto is_occupied = [&](int i, int k) -> bool
+    {
+        auto& status = occupied[k * n + i];
+        if (status >= 0) {
+            return status != 0;
+        }
+
+        status = 0;
+        auto lo = std::max(0, first_layer + k);
+        auto hi = std::min(layer_count - 1, first_layer + k + 1);
+        for (int l = lo; l <= hi && status == 0; ++l) {
+            for (auto& obs : obstacles.layers[l]) {
+                for (int s = 0; s < sphere_count; ++s) {
+                    auto r = body_spheres[s].radius + obs.radius;
+                    auto& c = centers[i * sphere_count + s];
+                    if ((c - obs.center).squaredNorm() < r * r) {
+                        status = 1;
+                        break;
+                    }
+                }
+                if (status != 0) {
+                    break;
+                }
+            }
+        }
+        return status != 0;
+    };
+
+    // parent[k * n + i] = waypoint at step k - 1 from which waypoint i is
+    // reached at the start of step k
+    std::vector<int> parent((horizon + 1) * n, -1);
+    parent[0] = 0;
+
+    int end_step = -1;
+    int end_index = -1;
+    std::vector<int> frontier = { 0 };
+    std::vector<int> next;
+    for (int k = 0; !frontier.empty(); ++k) {
+        if (k == horizon) {
+            end_step = k;
+            end_index = *std::max_element(begin(frontier), end(frontier));
+            break;
+        }
+
+        // stop once the goal is reached and stays clear
+        if (parent[k * n + n - 1] >= 0) {
+            auto clear = true;
+            for (int kk = k; kk < horizon && clear; ++kk) {
+                clear = !is_occupied(n - 1, kk);
+            }
+            if (clear) {
+                end_step = k;
+                end_index = n - 1;
+                break;
+            }
+        }
+
+        next.clear();
+        for (int i : frontier) {
+            for (int j = i; j < n && cum[j] - cum[i] <= dt + 1e-9; ++j) {
+                if (is_occupied(j, k)) {
+                    break;
+                }
+                if (parent[(k + 1) * n + j] < 0) {
+                    parent[(k + 1) * n + j] = i;
+                    next.push_back(j);
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+
+    if (end_step < 0) {
+        ROS_DEBUG_NAMED(LOG, "No timing of the path avoids the predicted obstacles");
+        return false;
+    }
+
+    std::vector<int> steps(end_step + 1);
+    steps[end_step] = end_index;
+    for (int k = end_step; k > 0; --k) {
+        steps[k - 1] = parent[k * n + steps[k]];
+    }
+
+    std::vector<smpl::RobotState> timed_path = { dense.front() };
+    std::vector<double> timed_times = { 0.0 };
+    auto hold_count = 0;
+    for (int k = 0; k < end_step; ++k) {
+        auto a = steps[k];
+        auto b = steps[k + 1];
+        if (a == b) {
+            // hold until the robot moves again
+            ++hold_count;
+            if (k + 1 == end_step || steps[k + 2] != a) {
+                timed_path.push_back(dense[a]);
+                timed_times.push_back((k + 1) * dt);
+            }
+        } else {
+            auto span = cum[b] - cum[a];
+            for (int m = a + 1; m <= b; ++m) {
+                auto frac = span > 0.0 ?
+                        (cum[m] - cum[a]) / span :
+                        (double)(m - a) / (double)(b - a);
+                timed_path.push_back(dense[m]);
+                timed_times.push_back((k + frac) * dt);
+            }
+        }
+    }
+
+    // past the end of the predictions
+    auto tail_start = steps[end_step];
+    for (int m = tail_start + 1; m < n; ++m) {
+        timed_path.push_back(dense[m]);
+        timed_times.push_back(end_step * dt + cum[m] - cum[tail_start]);
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Timed path of %d waypoints over %0.3f seconds, holding for %d steps", n, timed_times.back(), hold_count);
+
+    path = std::move(timed_path);
+    times = std::move(timed_times);
+    return true;
+}
+
+} // namespace sbpl_interface
@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_predicted_obstacle_timing_h
+#define sbpl_interface_predicted_obstacle_timing_h
+
+// standard includes
+#include <vector>
+
+// system includes
+#include <moveit/robot_state/robot_state.h>
+#include <ros/time.h>
+#include <smpl/types.h>
+
+// project includes
+#include "../collision/collision_world_sbpl.h"
+
+namespace sbpl_interface {
+
+class MoveItRobotModel;
+
+/// \brief Time a joint-space path so that the robot avoids predicted moving
+///     obstacles
+///
+/// The path is densified and then timed by a breadth-first search over
+/// (waypoint, time step) pairs, in steps of the prediction interval. Within
+/// each step the robot either holds its position or advances along the path
+/// as far as its velocity limits allow, and every waypoint it occupies during
+/// the step must be clear of the obstacles predicted for that step. The
+/// search finds the earliest arrival; the robot waits for an obstacle to pass
+/// only when it cannot move ahead of it. Past the end of the predictions, the
+/// remainder of the path is traversed at full speed.
+///
+/// The robot is approximated by the bounding spheres of its collision
+/// geometry and attached bodies.
+///
+/// \param state Scratch state holding the positions of the variables outside
+///     the planning group
+/// \param start_time The time at which the robot begins the path
+/// \param path The path, in the order of the planning variables, replaced by
+///     the timed path
+/// \param times The time from \p start_time of each waypoint of the timed path
+/// \return false if the start is in collision with the predicted obstacles or
+///     no timing avoids them, in which case \p path is unchanged
+bool TimePathAroundPredictedObstacles(
+    const MoveItRobotModel& robot_model,
+    moveit::core::RobotState& state,
+    const collision_detection::CollisionWorldSBPL::PredictedObstacles& obstacles,
+    const std::vector<double>& vel_limits,
+    const ros::Time& start_time,
+    std::vector<smpl::RobotState>& path,
+    std::vector<double>& times);
+
+} // namespace sbpl_interface
+
+#endif
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "request_scheduler.h"
+
+// standard includes
+#include <algorithm>
+
+// system includes
+#include <ros/console.h>
+
+namespace sbpl_interface {
+
+static const char* LOG = "scheduler";
+
+RequestScheduler::RequestScheduler(int concurrency, int capacity) :
+    m_concurrency(std::max(1, concurrency)),
+    m_capacity(std::max(0, capacity)),
+    m_running(0),
+    m_next_seq(0),
+    m_waiting()
+{
+}
+
+bool RequestScheduler::acquire(int priority, clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    Request request;
+    request.priority = priority;
+    request.deadline = deadline;
+    request.seq = m_next_seq++;
+    request.displaced = false;
+
+    // admit immediately if a slot is free and nobody is waiting for one
+    if (m_running < m_concurrency && m_waiting.empty()) {
+        ++m_running;
+        return true;
+    }
+
+    if (m_waiting.size() >= (size_t)m_capacity) {
+        Request* least = leastUrgent();
+        if (!least || !MoreUrgent(request, *least)) {
+            ROS_WARN_NAMED(LOG, "Reject request (priority: %d); queue is full", priority);
+            return false;
+        }
+        ROS_WARN_NAMED(LOG, "Displace request (priority: %d) by request (priority: %d)", least->priority, priority);
+        least->displaced = true;
+        remove(least);
+        m_cv.notify_all();
+    }
+
+    m_waiting.push_back(&request);
+    ROS_DEBUG_NAMED(LOG, "Queue request (priority: %d, waiting: %zu)", priority, m_waiting.size());
+
+    while (true) {
+        if (request.displaced) {
+            return false;
+        }
+
+        if (clock::now() >= request.deadline) {
+            ROS_WARN_NAMED(LOG, "Drop request (priority: %d); deadline passed while waiting", priority);
+            remove(&request);
+            m_cv.notify_all();
+            return false;
+        }
+
+        if (m_running < m_concurrency && mostUrgent() == &request) {
+            remove(&request);
+            ++m_running;
+            // another slot may still be free for the next request
+            m_cv.notify_all();
+            return true;
+        }
+
+        m_cv.wait_until(lock, request.deadline);
+    }
+}
+
+void RequestScheduler::release()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    --m_running;
+    m_cv.notify_all();
+}
+
+bool RequestScheduler::MoreUrgent(const Request& a, const Request& b)
+{
+    if (a.priority != b.priority) {
+        return a.priority > b.priority;
+    }
+    if (a.deadline != b.deadline) {
+        return a.deadline < b.deadline;
+    }
+    return a.seq < b.seq;
+}
+
+auto RequestScheduler::mostUrgent() const -> Request*
+{
+    auto it = std::min_element(begin(m_waiting), end(m_waiting),
+            [](const Request* a, const Request* b) { return MoreUrgent(*a, *b); });
+    return it == end(m_waiting) ? nullptr : *it;
+}
+
+auto RequestScheduler::leastUrgent() const -> Request*
+{
+    auto it = std::max_element(begin(m_waiting), end(m_waiting),
+            [](const Request* a, const Request* b) { return MoreUrgent(*a, *b); });
+    return it == end(m_waiting) ? nullptr : *it;
+}
+
+void RequestScheduler::remove(Request* request)
+{
+    m_waiting.erase(
+            std::remove(begin(m_waiting), end(m_waiting), request),
+            end(m_waiting));
+}
+
+} // namespace sbpl_interface
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_request_scheduler_h
+#define sbpl_interface_request_scheduler_h
+
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace sbpl_interface {
+
+/// \brief Admission control for planning requests
+///
+/// Requests acquire one of a fixed number of planning slots before planning.
+/// Waiting requests are admitted in order of priority, then deadline, then
+/// arrival. The waiting queue is bounded; when it is full, a new request
+/// displaces the least urgent waiting request if it is more urgent, and is
+/// rejected otherwise. Requests whose deadline passes while waiting are
+/// dropped.
+class RequestScheduler
+{
+public:
+
+    typedef std::chrono::steady_clock clock;
+
+    RequestScheduler(int concurrency = 1, int capacity = 16);
+
+    RequestScheduler(const RequestScheduler&) = delete;
+    RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+    /// Block until a planning slot is available for this request. Return
+    /// false if the request was rejected, displaced, or passed its deadline
+    /// before being admitted. Every successful acquire() must be paired with a
+    /// call to release().
+    bool acquire(int priority, clock::time_point deadline);
+
+    void release();
+
+    int concurrency() const { return m_concurrency; }
+    int capacity() const { return m_capacity; }
+
+private:
+
+    struct Request
+    {
+        int priority;
+        clock::time_point deadline;
+        uint64_t seq;
+        bool displaced;
+    };
+
+    int m_concurrency;
+    int m_capacity;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    int m_running;
+    uint64_t m_next_seq;
+    std::vector<Request*> m_waiting;
+
+    static bool MoreUrgent(const Request& a, const Request& b);
+
+    auto mostUrgent() const -> Request*;
+    auto leastUrgent() const -> Request*;
+    void remove(Request* request);
+};
+
+} // namespace sbpl_interface
+
+#endif
@@ -1,9 +1,18 @@
 #include "sbpl_planner_manager.h"
 
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <utility>
+
 // system includes
 #include <moveit/planning_scene/planning_scene.h>
 #include <moveit/robot_state/conversions.h>
 
+#include "../collision/collision_robot_sbpl.h"
+#include "../collision/collision_world_sbpl.h"
+#include "../collision/trace.h"
 #include "sbpl_planning_context.h"
 
 static const char* xmlTypeToString(XmlRpc::XmlRpcValue::Type type)
@@ -42,18 +51,144 @@ auto make_unique(Args&&... args) -> std::unique_ptr<T> {
     return std::unique_ptr<T>(new T(args...));
 }
 
+// A planning context for a single request. The cached planning context of the
+// request's planner configuration holds the scene, request, and planner state
+// of one request at a time, so it is given this request's scene and request
+// only once the group's lock is held, and keeps them until the solve ends.
+//
+// The request is admitted by the scheduler before it takes the group's lock,
+// so that a request waiting for admission never holds the lock that more
+// urgent requests of the group need. Waiting for the lock is bounded by the
+// request's deadline.
+class SBPLRequestContext : public planning_interface::PlanningContext
+{
+public:
+
+    SBPLRequestContext(
+        const SBPLPlanningContextPtr& context,
+        MoveItRobotModel* model,
+        std::timed_mutex* mutex,
+        RequestScheduler* scheduler,
+        const std::string& planning_link) :
+        PlanningContext(context->getName(), context->getGroupName()),
+        m_context(context),
+        m_model(model),
+        m_mutex(mutex),
+        m_scheduler(scheduler),
+        m_planning_link(planning_link),
+        m_request_time(RequestScheduler::clock::now())
+    {
+    }
+
+    bool solve(planning_interface::MotionPlanResponse& res) override
+    {
+        return solveRequest(res);
+    }
+
+    bool solve(planning_interface::MotionPlanDetailedResponse& res) override
+    {
+        return solveRequest(res);
+    }
+
+    bool terminate() override { return m_context->terminate(); }
+
+    void clear() override
+    {
+        std::lock_guard<std::timed_mutex> lock(*m_mutex);
+        m_context->clear();
+    }
+
+private:
+
+    SBPLPlanningContextPtr m_context;
+    MoveItRobotModel* m_model;
+    std::timed_mutex* m_mutex;
+    RequestScheduler* m_scheduler;
+    std::string m_planning_link;
+    RequestScheduler::clock::time_point m_request_time;
+
+    template <class Response>
+    bool solveRequest(Response& res)
+    {
+        auto deadline = m_request_time +
+                std::chrono::duration_cast<RequestScheduler::clock::duration>(
+                        std::chrono::duration<double>(
+                                getMotionPlanRequest().allowed_planning_time));
+        if (m_scheduler &&
+            !m_scheduler->acquire(m_context->priority(), deadline))
+        {
+            ROS_WARN_NAMED(PP_LOGGER, "Request was not admitted before its deadline");
+            res.error_code_.val = moveit_msgs::MoveItErrorCodes::TIMED_OUT;
+            return false;
+        }
+
+        // release the planning slot on return
+        std::unique_ptr<RequestScheduler, void (*)(RequestScheduler*)> slot(
+                m_scheduler, [](RequestScheduler* s) { s->release(); });
+
+        std::unique_lock<std::timed_mutex> lock(*m_mutex, deadline);
+        if (!lock.owns_lock()) {
+            ROS_WARN_NAMED(PP_LOGGER, "Group '%s' was busy until the request's deadline", getGroupName().c_str());
+            res.error_code_.val = moveit_msgs::MoveItErrorCodes::TIMED_OUT;
+            return false;
+        }
+
+        if (!prepare()) {
+            res.error_code_.val = moveit_msgs::MoveItErrorCodes::FAILURE;
+            return false;
+        }
+        return m_context->solve(res);
+    }
+
+    // Configure the group's model and the cached context for this request.
+    // Requires m_mutex.
+    bool prepare()
+    {
+        auto& scene = getPlanningScene();
+        if (!m_model->setPlanningLink(m_planning_link) ||
+            !m_model->setPlanningScene(scene) ||
+            !m_model->setPlanningFrame(scene->getPlanningFrame()))
+        {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to set SBPL Robot Model's planning link, scene, or frame");
+            return false;
+        }
+        m_context->setPlanningScene(scene);
+        m_context->setMotionPlanRequest(getMotionPlanRequest());
+        m_context->setRequestTime(m_request_time);
+        return true;
+    }
+};
+
 SBPLPlannerManager::SBPLPlannerManager() :
     Base(),
     m_robot_model(),
-    m_viz()
+    m_viz(),
+    m_memory_budget(0),
+    m_context_uses(0)
 {
     ROS_DEBUG_NAMED(PP_LOGGER, "Constructed SBPL Planner Manager");
     smpl::viz::set_visualizer(&m_viz);
+
+    // markers of the collision checkers are built on the visualizer's thread
+    collision_detection::SetDeferredVisualizer(
+            [this](
+                const std::string& ns,
+                collision_detection::MarkerBuilder build)
+            {
+                m_viz.visualizeDeferred(
+                        smpl::visual::Level::Info, ns, std::move(build));
+            });
 }
 
 SBPLPlannerManager::~SBPLPlannerManager()
 {
     ROS_DEBUG_NAMED(PP_LOGGER, "Destructed SBPL Planner Manager");
+    if (!m_trace_path.empty()) {
+        m_trace_timer.stop();
+        collision_detection::trace::dump(m_trace_path);
+    }
+    collision_detection::SetDeferredVisualizer(
+            collision_detection::DeferredVisualizer());
     if (smpl::viz::visualizer() == &m_viz) {
         smpl::viz::unset_visualizer();
     }
@@ -75,6 +210,105 @@ bool SBPLPlannerManager::initialize(
         return false;
     }
 
+    // solutions timed around predicted obstacles are re-timed, and may collide
+    // with them, if the pipeline parameterizes time after planning
+    std::string adapters;
+    if (nh.getParam("request_adapters", adapters) &&
+        (adapters.find("TimeParameterization") != std::string::npos ||
+        adapters.find("TimeOptimalParameterization") != std::string::npos))
+    {
+        for (auto& entry : getPlannerConfigurations()) {
+            auto it = entry.second.config.find("avoid_predicted_obstacles");
+            if (it != end(entry.second.config) && it->second == "true") {
+                ROS_WARN_NAMED(PP_LOGGER, "Planner configuration '%s' avoids predicted obstacles, but the planning pipeline re-times solutions", entry.first.c_str());
+            }
+        }
+    }
+
+    bool enable_scheduler;
+    nh.param("scheduler/enabled", enable_scheduler, false);
+    if (enable_scheduler) {
+        int concurrency, capacity;
+        nh.param("scheduler/concurrency", concurrency, 1);
+        nh.param("scheduler/capacity", capacity, 16);
+        m_scheduler = make_unique<RequestScheduler>(concurrency, capacity);
+        ROS_INFO_NAMED(PP_LOGGER, "Schedule requests (concurrency: %d, capacity: %d)", m_scheduler->concurrency(), m_scheduler->capacity());
+    }
+
+    bool share_grids;
+    nh.param("heuristic_grids/shared", share_grids, false);
+    if (share_grids) {
+        m_grid_registry = make_unique<HeuristicGridRegistry>();
+    }
+
+    int worker_count;
+    nh.param("workers/count", worker_count, 0);
+    if (worker_count > 0) {
+        WorkerPool::Options options;
+        options.count = worker_count;
+        options.param_ns = nh.getNamespace();
+        nh.param("workers/executable", options.executable, std::string());
+        nh.param("workers/timeout_margin", options.timeout_margin, 5.0);
+        auto workers = make_unique<WorkerPool>();
+        if (workers->init(options)) {
+            m_workers = std::move(workers);
+        } else {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to start planning workers. Plan in-process");
+        }
+    }
+
+    bool preprocess;
+    nh.param("scene_preprocessing/enabled", preprocess, false);
+    if (preprocess) {
+        if (m_grid_registry) {
+            double delay;
+            nh.param("scene_preprocessing/delay", delay, 0.05);
+            m_preprocessor = make_unique<ScenePreprocessor>(
+                    [this](const ScenePreprocessor::ObjectList& objects) {
+                        prepareContexts(objects);
+                    },
+                    delay);
+        } else {
+            ROS_WARN_NAMED(PP_LOGGER, "Scene preprocessing requires shared heuristic grids");
+        }
+    }
+
+    double memory_budget_mb;
+    nh.param("memory_budget_mb", memory_budget_mb, 0.0);
+    if (memory_budget_mb > 0.0) {
+        m_memory_budget = (size_t)(memory_budget_mb * 1024.0 * 1024.0);
+        ROS_INFO_NAMED(PP_LOGGER, "Memory budget: %0.1f MB", memory_budget_mb);
+    }
+
+    double viz_rate;
+    nh.param("visualization/rate", viz_rate, 10.0);
+    m_viz.setDefaultRate(viz_rate);
+    std::map<std::string, double> viz_rates;
+    if (nh.getParam("visualization/rates", viz_rates)) {
+        for (auto& entry : viz_rates) {
+            m_viz.setRate(entry.first, entry.second);
+        }
+    }
+
+    bool enable_trace;
+    nh.param("trace/enabled", enable_trace, false);
+    if (enable_trace) {
+        int capacity;
+        double dump_period;
+        nh.param("trace/capacity", capacity, 1 << 16);
+        nh.param("trace/path", m_trace_path, std::string("/tmp/sbpl_trace.json"));
+        nh.param("trace/dump_period", dump_period, 0.0);
+        collision_detection::trace::enable(std::max(capacity, 1));
+        ROS_INFO_NAMED(PP_LOGGER, "Trace to '%s'", m_trace_path.c_str());
+        if (dump_period > 0.0) {
+            m_trace_timer = nh.createWallTimer(
+                    ros::WallDuration(dump_period),
+                    [this](const ros::WallTimerEvent&) {
+                        collision_detection::trace::dump(m_trace_path);
+                    });
+        }
+    }
+
     ROS_INFO_NAMED(PP_LOGGER, "Initialized SBPL Planner Manager");
     return true;
 }
@@ -120,30 +354,23 @@ auto SBPLPlannerManager::getPlanningContext(
     ////////////////////////////////////////
 
     auto* mutable_me = const_cast<SBPLPlannerManager*>(this);
-    auto* sbpl_model = mutable_me->getModelForGroup(req.group_name);
-    if (!sbpl_model) {
+    auto* group = mutable_me->getModelForGroup(req.group_name);
+    if (!group) {
         ROS_WARN_NAMED(PP_LOGGER, "No SBPL Robot Model available for group '%s'", req.group_name.c_str());
         return null_context;
     }
+    auto* sbpl_model = group->model.get();
 
+    // the model is configured for the request, under the group's lock, only
+    // once the request is solved
     auto planning_link = selectPlanningLink(req);
     if (planning_link.empty()) {
         ROS_INFO_NAMED(PP_LOGGER, "Clear the planning link");
-    } else {
-        ROS_INFO_NAMED(PP_LOGGER, "Set planning link to '%s'", planning_link.c_str());
-    }
-
-    if (!sbpl_model->setPlanningLink(planning_link)) {
+    } else if (!m_robot_model->hasLinkModel(planning_link)) {
         ROS_ERROR_NAMED(PP_LOGGER, "Failed to set planning link to '%s'", planning_link.c_str());
         return null_context;
-    }
-
-    bool res = true;
-    res &= sbpl_model->setPlanningScene(planning_scene);
-    res &= sbpl_model->setPlanningFrame(planning_scene->getPlanningFrame());
-    if (!res) {
-        ROS_WARN_NAMED(PP_LOGGER, "Failed to set SBPL Robot Model's planning scene or planning frame");
-        return null_context;
+    } else {
+        ROS_INFO_NAMED(PP_LOGGER, "Set planning link to '%s'", planning_link.c_str());
     }
 
     /////////////////////////////////////////////
@@ -157,11 +384,179 @@ auto SBPLPlannerManager::getPlanningContext(
 
     auto sbpl_context = mutable_me->getPlanningContextForPlanner(
             sbpl_model, req.planner_id);
+    if (!sbpl_context) {
+        return null_context;
+    }
+
+    auto context = std::make_shared<SBPLRequestContext>(
+            sbpl_context,
+            sbpl_model,
+            &group->mutex,
+            m_scheduler.get(),
+            planning_link);
+    context->setPlanningScene(planning_scene);
+    context->setMotionPlanRequest(req);
+
+    if (m_preprocessor) {
+        mutable_me->m_preprocessor->observe(*planning_scene);
+    }
+
+    mutable_me->enforceMemoryBudget(*planning_scene);
+
+    return std::move(context);
+}
+
+bool SBPLPlannerManager::solveBatch(
+    const planning_scene::PlanningSceneConstPtr& planning_scene,
+    const std::vector<planning_interface::MotionPlanRequest>& reqs,
+    std::vector<planning_interface::MotionPlanResponse>& res,
+    int thread_count)
+{
+    ROS_DEBUG_NAMED(PP_LOGGER, "Solve batch of %zu requests", reqs.size());
+
+    res.clear();
+    if (reqs.empty()) {
+        return true;
+    }
+
+    if (!planning_scene) {
+        ROS_WARN_NAMED(PP_LOGGER, "Planning Scene is null");
+        return false;
+    }
+
+    auto& group_name = reqs.front().group_name;
+    auto& planner_id = reqs.front().planner_id;
+    auto planning_link = selectPlanningLink(reqs.front());
+    for (auto& req : reqs) {
+        if (!canServiceRequest(req)) {
+            ROS_WARN_NAMED(PP_LOGGER, "Unable to service request");
+            return false;
+        }
+        if (req.group_name != group_name ||
+            req.planner_id != planner_id ||
+            selectPlanningLink(req) != planning_link)
+        {
+            ROS_WARN_NAMED(PP_LOGGER, "Batched requests must share the same group, planner, and planning link");
+            return false;
+        }
+    }
+
+    auto* group = getModelForGroup(group_name);
+    if (!group) {
+        ROS_WARN_NAMED(PP_LOGGER, "No SBPL Robot Model available for group '%s'", group_name.c_str());
+        return false;
+    }
+    auto* sbpl_model = group->model.get();
+
+    auto context = getPlanningContextForPlanner(sbpl_model, planner_id);
+    if (!context) {
+        return false;
+    }
+
+    // admitted as a single request with the longest time allowed to any of
+    // the batch, before the group's lock is taken
+    auto request_time = RequestScheduler::clock::now();
+    double allowed_time = 0.0;
+    for (auto& req : reqs) {
+        allowed_time = std::max(allowed_time, req.allowed_planning_time);
+    }
+    auto deadline = request_time +
+            std::chrono::duration_cast<RequestScheduler::clock::duration>(
+                    std::chrono::duration<double>(allowed_time));
+    if (m_scheduler && !m_scheduler->acquire(context->priority(), deadline)) {
+        ROS_WARN_NAMED(PP_LOGGER, "Batch was not admitted before its deadline");
+        return false;
+    }
+
+    std::unique_ptr<RequestScheduler, void (*)(RequestScheduler*)> slot(
+            m_scheduler.get(), [](RequestScheduler* s) { s->release(); });
+
+    // the batch holds the group's model and context for its duration
+    std::unique_lock<std::timed_mutex> group_lock(group->mutex, deadline);
+    if (!group_lock.owns_lock()) {
+        ROS_WARN_NAMED(PP_LOGGER, "Group '%s' was busy until the batch's deadline", group_name.c_str());
+        return false;
+    }
+
+    if (!sbpl_model->setPlanningLink(planning_link) ||
+        !sbpl_model->setPlanningScene(planning_scene) ||
+        !sbpl_model->setPlanningFrame(planning_scene->getPlanningFrame()))
+    {
+        ROS_WARN_NAMED(PP_LOGGER, "Failed to update SBPL Robot Model for batch");
+        return false;
+    }
 
-    sbpl_context->setPlanningScene(planning_scene);
-    sbpl_context->setMotionPlanRequest(req);
+    context->setRequestTime(request_time);
 
-    return std::move(sbpl_context);
+    if (thread_count <= 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    thread_count = std::min<int>(thread_count, reqs.size());
+
+    // each worker needs its own model, since models hold the planning scene
+    // and scratch robot state
+    std::unique_lock<std::mutex> models_lock(m_models_mutex);
+    auto& batch_models = m_batch_models[group_name];
+    models_lock.unlock();
+    while (batch_models.size() < (size_t)thread_count) {
+        auto model = make_unique<MoveItRobotModel>();
+        if (!model->init(m_robot_model, group_name)) {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to initialize SBPL Robot Model");
+            return false;
+        }
+        batch_models.push_back(std::move(model));
+    }
+
+    std::vector<MoveItRobotModel*> models;
+    for (int i = 0; i < thread_count; ++i) {
+        if (!batch_models[i]->setPlanningLink(planning_link)) {
+            ROS_ERROR_NAMED(PP_LOGGER, "Failed to set planning link to '%s'", planning_link.c_str());
+            return false;
+        }
+        models.push_back(batch_models[i].get());
+    }
+
+    bool ok = context->solveBatch(planning_scene, reqs, models, res);
+    enforceMemoryBudget(*planning_scene);
+    return ok;
+}
+
+auto SBPLPlannerManager::MemoryUsage::total() const -> size_t
+{
+    size_t usage = world_grid + self_collision + shared_grids;
+    for (auto& entry : contexts) {
+        usage += entry.second;
+    }
+    return usage;
+}
+
+auto SBPLPlannerManager::memoryUsage(
+    const planning_scene::PlanningScene* scene) const
+    -> MemoryUsage
+{
+    MemoryUsage usage;
+    if (scene) {
+        using collision_detection::CollisionWorldSBPL;
+        using collision_detection::CollisionRobotSBPL;
+        auto* cworld = dynamic_cast<const CollisionWorldSBPL*>(
+                scene->getCollisionWorld().get());
+        if (cworld) {
+            usage.world_grid = cworld->memoryUsage();
+        }
+        auto* crobot = dynamic_cast<const CollisionRobotSBPL*>(
+                scene->getCollisionRobot().get());
+        if (crobot) {
+            usage.self_collision = crobot->memoryUsage();
+        }
+    }
+    if (m_grid_registry) {
+        usage.shared_grids = m_grid_registry->memoryUsage();
+    }
+    std::lock_guard<std::mutex> lock(m_contexts_mutex);
+    for (auto& entry : m_contexts) {
+        usage.contexts[entry.first] = entry.second->memoryUsage();
+    }
+    return usage;
 }
 
 bool SBPLPlannerManager::canServiceRequest(
@@ -674,18 +1069,20 @@ bool SBPLPlannerManager::loadSettingsMap(
 }
 
 auto SBPLPlannerManager::getModelForGroup(const std::string& group_name)
-    -> MoveItRobotModel*
+    -> GroupModel*
 {
+    std::lock_guard<std::mutex> lock(m_models_mutex);
     auto it = m_sbpl_models.find(group_name);
     if (it == end(m_sbpl_models)) {
-        auto model = make_unique<MoveItRobotModel>();
-        if (!model->init(m_robot_model, group_name)) {
+        auto group = make_unique<GroupModel>();
+        group->model = make_unique<MoveItRobotModel>();
+        if (!group->model->init(m_robot_model, group_name)) {
             ROS_WARN_NAMED(PP_LOGGER, "Failed to initialize SBPL Robot Model");
             return NULL;
         }
 
         ROS_INFO_NAMED(PP_LOGGER, "Created SBPL Robot Model for group '%s'", group_name.c_str());
-        auto ent = m_sbpl_models.insert(std::make_pair(group_name, std::move(model)));
+        auto ent = m_sbpl_models.insert(std::make_pair(group_name, std::move(group)));
         return ent.first->second.get();
     } else {
         ROS_DEBUG_NAMED(PP_LOGGER, "Use existing SBPL Robot Model for group '%s'", group_name.c_str());
@@ -699,6 +1096,7 @@ auto SBPLPlannerManager::getPlanningContextForPlanner(
     -> SBPLPlanningContextPtr
 {
     SBPLPlanningContextPtr null_context;
+    std::lock_guard<std::mutex> lock(m_contexts_mutex);
     auto it = m_contexts.find(planner_id);
     if (it == end(m_contexts)) {
         auto context = SBPLPlanningContextPtr(new SBPLPlanningContext(
@@ -725,14 +1123,95 @@ auto SBPLPlannerManager::getPlanningContextForPlanner(
             ROS_ERROR_NAMED(PP_LOGGER, "Failed to initialize SBPL Planning Context");
             return null_context;
         }
+        context->setGridRegistry(m_grid_registry.get());
+        context->setWorkerPool(m_workers.get());
 
         m_contexts.insert(std::make_pair(planner_id, context));
+        m_context_last_use[planner_id] = m_context_uses++;
         return context;
     } else {
+        m_context_last_use[planner_id] = m_context_uses++;
         return it->second;
     }
 }
 
+// Build heuristic grids for the changed world ahead of the next request to each
+// context. Called from the scene preprocessing thread.
+void SBPLPlannerManager::prepareContexts(
+    const ScenePreprocessor::ObjectList& objects)
+{
+    std::vector<SBPLPlanningContextPtr> contexts;
+    {
+        std::lock_guard<std::mutex> lock(m_contexts_mutex);
+        for (auto& entry : m_contexts) {
+            contexts.push_back(entry.second);
+        }
+    }
+
+    for (auto& context : contexts) {
+        context->prepareGrid(objects);
+    }
+}
+
+// Evict idle planning contexts, least recently used first, until the estimated
+// memory usage is within budget. Collision grids owned by the scene count
+// against the budget but are never evicted. Shared heuristic grids count once
+// and are freed only when no remaining context holds them.
+void SBPLPlannerManager::enforceMemoryBudget(
+    const planning_scene::PlanningScene& scene)
+{
+    auto usage = memoryUsage(&scene);
+    auto total = usage.total();
+    ROS_DEBUG_NAMED(PP_LOGGER, "Memory usage: %zu bytes", total);
+    ROS_DEBUG_NAMED(PP_LOGGER, "  world grid: %zu bytes", usage.world_grid);
+    ROS_DEBUG_NAMED(PP_LOGGER, "  self collision: %zu bytes", usage.self_collision);
+    ROS_DEBUG_NAMED(PP_LOGGER, "  shared grids: %zu bytes", usage.shared_grids);
+    for (auto& entry : usage.contexts) {
+        ROS_DEBUG_NAMED(PP_LOGGER, "  context '%s': %zu bytes", entry.first.c_str(), entry.second);
+    }
+
+    if (m_memory_budget == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_contexts_mutex);
+    while (total > m_memory_budget) {
+        // contexts referenced outside the manager are in use
+        auto victim = end(m_contexts);
+        for (auto it = begin(m_contexts); it != end(m_contexts); ++it) {
+            if (it->second.use_count() > 1) {
+                continue;
+            }
+            if (victim == end(m_contexts) ||
+                m_context_last_use[it->first] <
+                        m_context_last_use[victim->first])
+            {
+                victim = it;
+            }
+        }
+
+        if (victim == end(m_contexts)) {
+            ROS_WARN_NAMED(PP_LOGGER, "Memory usage (%zu bytes) exceeds budget (%zu bytes) with no idle contexts to evict", total, m_memory_budget);
+            break;
+        }
+
+        auto context_usage = usage.contexts[victim->first];
+        ROS_INFO_NAMED(PP_LOGGER, "Evict planning context '%s' (%zu bytes) to stay within the memory budget", victim->first.c_str(), context_usage);
+        total -= context_usage;
+        m_context_last_use.erase(victim->first);
+        m_contexts.erase(victim);
+
+        // shared grids are released only with the last context holding them
+        if (m_grid_registry) {
+            auto shared_grids = m_grid_registry->memoryUsage();
+            if (shared_grids < usage.shared_grids) {
+                total -= usage.shared_grids - shared_grids;
+                usage.shared_grids = shared_grids;
+            }
+        }
+    }
+}
+
 auto SBPLPlannerManager::selectPlanningLink(
     const planning_interface::MotionPlanRequest& req) const
     -> std::string
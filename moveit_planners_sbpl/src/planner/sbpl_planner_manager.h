@@ -1,15 +1,27 @@
 #ifndef sbpl_interface_sbpl_planner_manager_h
 #define sbpl_interface_sbpl_planner_manager_h
 
+// standard includes
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 // system includes
 #include <XmlRpcValue.h>
 #include <moveit/macros/class_forward.h>
 #include <moveit/planning_interface/planning_interface.h>
-#include <smpl/debug/visualizer_ros.h>
 
 // project includes
 #include <moveit_planners_sbpl/planner/moveit_robot_model.h>
 
+#include "async_visualizer.h"
+#include "heuristic_grid_registry.h"
+#include "request_scheduler.h"
+#include "scene_preprocessor.h"
+#include "worker_pool.h"
+
 namespace sbpl_interface {
 
 MOVEIT_CLASS_FORWARD(SBPLPlanningContext);
@@ -41,6 +53,11 @@ public:
         std::vector<std::string>& algs) const override;
 
     /// \sa planning_interface::PlannerManager::getPlanningContext()
+    ///
+    /// Each call returns a new context bound to the given scene and request.
+    /// Planning contexts are cached per planner configuration and shared
+    /// between requests, so solving the returned context waits for any other
+    /// request of the same group to finish.
     virtual planning_interface::PlanningContextPtr getPlanningContext(
         const planning_scene::PlanningSceneConstPtr& planning_scene,
         const planning_interface::MotionPlanRequest& req,
@@ -56,21 +73,93 @@ public:
 
     ///@}
 
+    /// \brief Plan for several requests against the same planning scene
+    ///
+    /// Requests must share the same group, planner, planning link, and
+    /// workspace. Scene-dependent structures are built once and the searches
+    /// are distributed across \p thread_count threads (0 => one per core).
+    /// One response is returned per request, in order.
+    bool solveBatch(
+        const planning_scene::PlanningSceneConstPtr& planning_scene,
+        const std::vector<planning_interface::MotionPlanRequest>& reqs,
+        std::vector<planning_interface::MotionPlanResponse>& res,
+        int thread_count = 0);
+
+    struct MemoryUsage
+    {
+        size_t world_grid = 0;
+        size_t self_collision = 0;
+
+        // heuristic grids held by the grid registry, counted once
+        size_t shared_grids = 0;
+
+        // planner configuration -> memory held by its planning context
+        std::map<std::string, size_t> contexts;
+
+        auto total() const -> size_t;
+    };
+
+    /// \brief Return an estimate of the memory, in bytes, held by cached
+    ///     planning contexts and, if \p scene is given, its collision grids
+    auto memoryUsage(const planning_scene::PlanningScene* scene = nullptr) const
+        -> MemoryUsage;
+
 private:
 
     moveit::core::RobotModelConstPtr m_robot_model;
 
-    // per-group sbpl robot model
+    // per-group sbpl robot model, with a lock held while the model is
+    // configured for a request and while a context of the group solves it,
+    // taken only after the request is admitted by the scheduler.
+    // The planning contexts of a group, and their planners, share the model.
     // TODO: make unique per context instance
-    std::map<std::string, std::unique_ptr<MoveItRobotModel>> m_sbpl_models;
+    struct GroupModel
+    {
+        std::unique_ptr<MoveItRobotModel> model;
+        std::timed_mutex mutex;
+    };
+    std::map<std::string, std::unique_ptr<GroupModel>> m_sbpl_models;
+
+    // guards m_sbpl_models and m_batch_models
+    std::mutex m_models_mutex;
 
     // per-configuration context
     std::map<std::string, SBPLPlanningContextPtr> m_contexts;
+    mutable std::mutex m_contexts_mutex;
 
-    smpl::VisualizerROS m_viz;
+    // per-group sbpl robot models for batch planning workers
+    std::map<std::string, std::vector<std::unique_ptr<MoveItRobotModel>>>
+    m_batch_models;
+
+    // publishes debug markers off the planning threads
+    AsyncVisualizer m_viz;
+
+    // admission control for planning requests, if enabled
+    std::unique_ptr<RequestScheduler> m_scheduler;
+
+    // heuristic grids shared between contexts, if enabled
+    std::unique_ptr<HeuristicGridRegistry> m_grid_registry;
+
+    // out-of-process planning workers, if enabled
+    std::unique_ptr<WorkerPool> m_workers;
+
+    // total memory allowed before idle contexts are evicted; 0 => unlimited
+    size_t m_memory_budget;
+
+    // planner configuration -> last use, for least-recently-used eviction
+    std::map<std::string, uint64_t> m_context_last_use;
+    uint64_t m_context_uses;
+
+    // destination of the timeline trace, if tracing is enabled
+    std::string m_trace_path;
+    ros::WallTimer m_trace_timer;
 
     planning_interface::PlannerConfigurationMap map;
 
+    // prepares contexts for scene changes in the background, if enabled.
+    // Declared last so that it stops before the contexts are destroyed.
+    std::unique_ptr<ScenePreprocessor> m_preprocessor;
+
     void logPlanningScene(const planning_scene::PlanningScene& scene) const;
     void logMotionPlanRequest(
         const planning_interface::MotionPlanRequest& req) const;
@@ -96,13 +185,17 @@ private:
 
     // retrive an already-initialized model for a given group
     auto getModelForGroup(const std::string& group_name)
-        -> MoveItRobotModel*;
+        -> GroupModel*;
 
     auto getPlanningContextForPlanner(
         MoveItRobotModel* model,
         const std::string& config)
         -> SBPLPlanningContextPtr;
 
+    void prepareContexts(const ScenePreprocessor::ObjectList& objects);
+
+    void enforceMemoryBudget(const planning_scene::PlanningScene& scene);
+
     std::string selectPlanningLink(
         const planning_interface::MotionPlanRequest& req) const;
 
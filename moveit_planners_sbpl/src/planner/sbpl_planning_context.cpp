@@ -1,15 +1,22 @@
 #include "sbpl_planning_context.h"
 
 // standard includes
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
 
 // system includes
+#include <unistd.h>
 #include <moveit/collision_detection/world.h>
 #include <eigen_conversions/eigen_msg.h>
 #include <moveit/planning_scene/planning_scene.h>
 #include <moveit/robot_state/conversions.h>
 #include <moveit_msgs/GetMotionPlan.h>
 #include <moveit_msgs/PlanningScene.h>
+#include <smpl/angles.h>
 #include <smpl/console/nonstd.h>
 #include <smpl/ros/propagation_distance_field.h>
 #include <sbpl_collision_checking/world_collision_model.h>
@@ -18,6 +25,9 @@
 // project includes
 #include "../collision/collision_world_sbpl.h"
 #include "../collision/collision_common_sbpl.h"
+#include "../collision/trace.h"
+#include "predicted_obstacle_timing.h"
+#include "time_scaled_primitives.h"
 
 static const char* PP_LOGGER = "planning";
 
@@ -126,17 +136,57 @@ auto CreateHeuristicGrid(
     double max_distance)
     -> std::unique_ptr<smpl::OccupancyGrid>;
 
+static
+auto CreateHeuristicGridFromObjects(
+    const moveit_msgs::OrientedBoundingBox& workspace_aabb,
+    const std::string& frame_id,
+    const std::vector<collision_detection::World::ObjectConstPtr>& objects,
+    double res,
+    double max_distance)
+    -> std::unique_ptr<smpl::OccupancyGrid>;
+
+static
+auto CreatePlaceholderGrid(const std::string& frame_id)
+    -> std::unique_ptr<smpl::OccupancyGrid>;
+
 static
 bool GetPlanningFrameWorkspaceAABB(
     const moveit_msgs::WorkspaceParameters& workspace,
     const planning_scene::PlanningScene& scene,
     moveit_msgs::OrientedBoundingBox& aabb);
 
+static
+auto VoxelVersion(const planning_scene::PlanningScene& scene) -> uint64_t;
+
 static
 void CopyDistanceField(
     const smpl::DistanceMapInterface& dfin,
     smpl::DistanceMapInterface& dfout);
 
+static
+bool ConvertJointTrajectoryToPath(
+    const trajectory_msgs::JointTrajectory& traj,
+    const std::vector<std::string>& var_names,
+    std::vector<smpl::RobotState>& path);
+
+static
+void ConvertPathToJointTrajectory(
+    const std::vector<smpl::RobotState>& path,
+    const std::vector<std::string>& var_names,
+    trajectory_msgs::JointTrajectory& traj);
+
+static
+bool DecimatePath(
+    smpl::CollisionChecker& checker,
+    const std::vector<bool>& continuous,
+    double tolerance,
+    std::vector<smpl::RobotState>& path);
+
+static
+bool SameRobotState(
+    const moveit::core::RobotState& a,
+    const moveit::core::RobotState& b);
+
 SBPLPlanningContext::SBPLPlanningContext(
     MoveItRobotModel* robot_model,
     const std::string& name,
@@ -144,20 +194,41 @@ SBPLPlanningContext::SBPLPlanningContext(
 :
     Base(name, group),
     m_robot_model(robot_model),
+    m_arena(),
     m_collision_checker(),
     m_grid(),
-    m_planner()
+    m_grid_registry(nullptr),
+    m_planner(),
+    m_memory_usage(0),
+    m_grid_voxel_version(0),
+    m_have_grid_key(false),
+    m_reuse_search(false),
+    m_prev_voxel_version(0),
+    m_priority(0),
+    m_workers(nullptr),
+    m_request_time(RequestScheduler::clock::now()),
+    m_repair_path(false),
+    m_smooth_path(false),
+    m_decimate_path(false),
+    m_decimation_tolerance(0.02),
+    m_time_cost(false),
+    m_avoid_predicted_obstacles(false)
 {
     ROS_DEBUG_NAMED(PP_LOGGER, "Constructed SBPL Planning Context");
 }
 
 SBPLPlanningContext::~SBPLPlanningContext()
 {
+    if (!m_time_scaled_mprim_filename.empty()) {
+        unlink(m_time_scaled_mprim_filename.c_str());
+    }
     ROS_DEBUG_NAMED(PP_LOGGER, "Destructed SBPL Planning Context");
 }
 
 bool SBPLPlanningContext::solve(planning_interface::MotionPlanResponse& res)
 {
+    SBPL_TRACE_SPAN("SBPLPlanningContext::solve");
+
     auto then = std::chrono::high_resolution_clock::now();
 
     auto& scene = getPlanningScene();
@@ -194,22 +265,20 @@ bool SBPLPlanningContext::solve(planning_interface::MotionPlanResponse& res)
         return true;
     }
 
-    ROS_DEBUG_NAMED(PP_LOGGER, "Update planner modules");
-    if (!updatePlanner(scene, *start_state, req.workspace_parameters)) {
-        ROS_WARN_NAMED(PP_LOGGER, "Failed to update SBPL");
-        res.planning_time_ = 0.0;
-        res.error_code_.val = moveit_msgs::MoveItErrorCodes::PLANNING_FAILED;
-        return false;
-    }
-
-    ROS_DEBUG_NAMED(PP_LOGGER, "Convert planning scene to message type");
-    // translate planning scene to planning scene message
-    moveit_msgs::PlanningScene scene_msg;
-    scene->getPlanningSceneMsg(scene_msg);
+    auto deadline = m_request_time +
+            std::chrono::duration_cast<RequestScheduler::clock::duration>(
+                    std::chrono::duration<double>(req.allowed_planning_time));
 
-    ROS_DEBUG_NAMED(PP_LOGGER, "Solve!");
     moveit_msgs::MotionPlanResponse res_msg;
-    if (!m_planner->solve(scene_msg, req_msg, res_msg)) {
+    bool solved;
+    if (m_workers && solveOnWorker(*scene, req, req_msg.start_state, deadline, res_msg)) {
+        solved = res_msg.error_code.val == moveit_msgs::MoveItErrorCodes::SUCCESS;
+    } else {
+        solved = solveInProcess(scene, *start_state, deadline, req_msg, res_msg);
+    }
+    updateMemoryUsage();
+
+    if (!solved) {
         res.trajectory_.reset();
         res.planning_time_ = res_msg.planning_time;
         res.error_code_ = res_msg.error_code;
@@ -259,6 +328,184 @@ bool SBPLPlanningContext::solve(
     return true;
 }
 
+bool SBPLPlanningContext::solveBatch(
+    const planning_scene::PlanningSceneConstPtr& scene,
+    const std::vector<planning_interface::MotionPlanRequest>& reqs,
+    const std::vector<MoveItRobotModel*>& models,
+    std::vector<planning_interface::MotionPlanResponse>& res)
+{
+    res.clear();
+    res.resize(reqs.size());
+    if (reqs.empty()) {
+        return true;
+    }
+
+    if (models.empty()) {
+        ROS_WARN_NAMED(PP_LOGGER, "Batch planning requires at least one robot model");
+        return false;
+    }
+
+    auto& workspace = reqs.front().workspace_parameters;
+    for (auto& req : reqs) {
+        if (!SerializedEqual(req.workspace_parameters, workspace)) {
+            ROS_WARN_NAMED(PP_LOGGER, "Batched requests must share the same workspace");
+            return false;
+        }
+    }
+
+    // the planner from the last request refers to the last scene
+    m_planner.reset();
+    m_prev_start_state.reset();
+
+    if (m_build_grid) {
+        ROS_DEBUG_NAMED(PP_LOGGER, "Update or create grid for batch of %zu requests", reqs.size());
+        m_grid = updateOrCreateGrid(std::move(m_grid), scene, workspace);
+        if (!m_grid) {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to update or create grid");
+            return false;
+        }
+    } else if (!m_grid || m_grid->getReferenceFrame() != scene->getPlanningFrame()) {
+        m_grid = CreatePlaceholderGrid(scene->getPlanningFrame());
+    }
+    m_prev_scene = scene;
+    m_prev_workspace = workspace;
+
+    moveit_msgs::PlanningScene scene_msg;
+    scene->getPlanningSceneMsg(scene_msg);
+
+    const size_t thread_count = std::min(models.size(), reqs.size());
+    std::atomic<size_t> next_request(0);
+
+    auto solve_requests = [&](MoveItRobotModel* model)
+    {
+        // private copies of the collision robots and world
+        planning_scene::PlanningScenePtr worker_scene = scene->diff();
+        worker_scene->getCollisionRobotNonConst();
+        worker_scene->getCollisionRobotUnpaddedNonConst();
+
+        if (!model->setPlanningScene(worker_scene) ||
+            !model->setPlanningFrame(worker_scene->getPlanningFrame()))
+        {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to set the planning scene of a batch worker");
+            return;
+        }
+
+        // per-thread storage for the collision checker caches, reused across
+        // the requests solved by the thread
+        Arena arena;
+
+        while (true) {
+            size_t ridx = next_request++;
+            if (ridx >= reqs.size()) {
+                break;
+            }
+            solveBatchRequest(
+                    worker_scene, scene_msg, model, arena, reqs[ridx], res[ridx]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t tidx = 1; tidx < thread_count; ++tidx) {
+        threads.emplace_back(solve_requests, models[tidx]);
+    }
+    solve_requests(models[0]);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // requests left unclaimed by failed workers
+    for (size_t ridx = next_request; ridx < reqs.size(); ++ridx) {
+        res[ridx].error_code_.val = moveit_msgs::MoveItErrorCodes::FAILURE;
+    }
+
+    updateMemoryUsage();
+    return true;
+}
+
+void SBPLPlanningContext::prepareGrid(
+    const std::vector<collision_detection::World::ObjectConstPtr>& objects)
+{
+    SBPL_TRACE_SPAN("SBPLPlanningContext::prepareGrid");
+
+    if (!m_grid_registry) {
+        return;
+    }
+
+    HeuristicGridRegistry::Key key;
+    {
+        std::lock_guard<std::mutex> lock(m_prepare_mutex);
+        if (!m_have_grid_key) {
+            return;
+        }
+        key = m_grid_key;
+    }
+
+    // voxels applied outside of world objects are not in the snapshot
+    if (key.voxel_version != 0) {
+        return;
+    }
+
+    key.objects = objects;
+    std::sort(begin(key.objects), end(key.objects));
+    if (m_grid_registry->find(key)) {
+        return;
+    }
+
+    std::shared_ptr<const smpl::OccupancyGrid> grid(
+            CreateHeuristicGridFromObjects(
+                    key.workspace_aabb,
+                    key.frame_id,
+                    objects,
+                    key.res,
+                    key.inflation_radius));
+    if (!grid) {
+        return;
+    }
+
+    ROS_DEBUG_NAMED(PP_LOGGER, "Prepared heuristic grid for world of %zu objects", objects.size());
+    m_grid_registry->insert(std::move(key), grid);
+
+    std::lock_guard<std::mutex> lock(m_prepare_mutex);
+    m_prepared_grid = std::move(grid);
+}
+
+auto SBPLPlanningContext::memoryUsage() const -> size_t
+{
+    return m_memory_usage.load(std::memory_order_relaxed);
+}
+
+// Measure the memory held by the context. Must be called by the thread
+// solving with the context.
+void SBPLPlanningContext::updateMemoryUsage()
+{
+    // grids held by the registry are accounted for there, once, rather than
+    // by each context that shares them
+    auto owned = [&](const smpl::OccupancyGrid& grid) {
+        return !m_grid_registry || !m_grid_registry->contains(&grid);
+    };
+
+    size_t usage = 0;
+    if (m_grid && owned(*m_grid)) {
+        usage += collision_detection::GridMemoryUsage(*m_grid);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_prepare_mutex);
+        if (m_prepared_grid && m_prepared_grid != m_grid &&
+            owned(*m_prepared_grid))
+        {
+            usage += collision_detection::GridMemoryUsage(*m_prepared_grid);
+        }
+    }
+    if (m_collision_checker) {
+        usage += m_collision_checker->memoryUsage();
+    }
+    usage += m_arena.memoryUsage();
+    for (auto& point : m_last_path) {
+        usage += point.size() * sizeof(double);
+    }
+    m_memory_usage.store(usage, std::memory_order_relaxed);
+}
+
 bool SBPLPlanningContext::terminate()
 {
     ROS_INFO_NAMED(PP_LOGGER, "SBPLPlanningContext::terminate()");
@@ -317,6 +564,65 @@ bool SBPLPlanningContext::init(const std::map<std::string, std::string>& config)
 
     m_use_grid = (heuristic_name == "bfs" || heuristic_name == "mfbfs" || heuristic_name == "bfs_egraph");
 
+    // Only heuristics known to ignore the grid plan without building one. The
+    // adaptive lattice reads the grid to decide where to plan in full
+    // dimensionality. Grid parameters are still only required by the bfs
+    // heuristics.
+    m_build_grid =
+            (heuristic_name != "euclid" &&
+                    heuristic_name != "euclid_diff" &&
+                    heuristic_name != "joint_distance" &&
+                    heuristic_name != "joint_distance_egraph") ||
+            graph_name == "adaptive_workspace_lattice";
+    ROS_DEBUG_NAMED(PP_LOGGER, " -> Build grid: %s", m_build_grid ? "true" : "false");
+
+    {
+        auto it = config.find("repair_path");
+        m_repair_path = it != end(config) && it->second == "true";
+    }
+    {
+        auto it = config.find("reuse_search");
+        m_reuse_search = it != end(config) && it->second == "true";
+    }
+    {
+        auto it = config.find("priority");
+        m_priority = it != end(config) ? std::atoi(it->second.c_str()) : 0;
+    }
+    {
+        auto it = config.find("smooth_path");
+        m_smooth_path = it != end(config) && it->second == "true";
+    }
+    {
+        auto it = config.find("decimate_path");
+        m_decimate_path = it != end(config) && it->second == "true";
+        it = config.find("decimation_tolerance");
+        m_decimation_tolerance =
+                it != end(config) ? std::atof(it->second.c_str()) : 0.02;
+    }
+    {
+        auto it = config.find("smoothing_time");
+        if (it != end(config)) {
+            m_smoother_params.max_time = std::atof(it->second.c_str());
+        }
+        it = config.find("smoothing_iterations");
+        if (it != end(config)) {
+            m_smoother_params.max_iterations = std::atoi(it->second.c_str());
+        }
+        it = config.find("smoothing_clearance");
+        if (it != end(config)) {
+            m_smoother_params.clearance = std::atof(it->second.c_str());
+        }
+        it = config.find("smoothing_obstacle_weight");
+        if (it != end(config)) {
+            m_smoother_params.obstacle_weight = std::atof(it->second.c_str());
+        }
+    }
+
+    {
+        auto it = config.find("avoid_predicted_obstacles");
+        m_avoid_predicted_obstacles = it != end(config) && it->second == "true";
+    }
+
     ROS_DEBUG_NAMED(PP_LOGGER, " -> Required Parameters Found");
 
     smpl::PlanningParams pp;
@@ -331,10 +637,31 @@ bool SBPLPlanningContext::init(const std::map<std::string, std::string>& config)
         grid_inflation_radius = 0.0;
     }
 
-    if (!InitPlanningParams(config, &pp)) {
+    // In time cost mode, plan with primitives scaled to equal durations so
+    // that the lattice's uniform action cost measures traversal time
+    auto planner_config = config;
+    {
+        auto it = config.find("cost_mode");
+        m_time_cost = it != end(config) && it->second == "time";
+        if (m_time_cost && !initTimeCost(planner_config)) {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to initialize time cost. Using distance cost");
+            m_time_cost = false;
+            planner_config = config;
+        }
+    }
+
+    if (!InitPlanningParams(planner_config, &pp)) {
         return false;
     }
 
+    if (m_avoid_predicted_obstacles &&
+        m_vel_limits.empty() &&
+        !GetPlanningVelocityLimits(*m_robot_model, m_vel_limits))
+    {
+        ROS_WARN_NAMED(PP_LOGGER, "No velocity limits for group '%s'. Ignore predicted obstacles", getGroupName().c_str());
+        m_avoid_predicted_obstacles = false;
+    }
+
     m_config = config; // save config, for science
     m_pp = pp; // save fully-initialized config
 
@@ -348,25 +675,383 @@ bool SBPLPlanningContext::init(const std::map<std::string, std::string>& config)
     return true;
 }
 
+// Write a copy of the configured motion primitives, scaled to equal durations
+// under the velocity limits of the group, and point the planner at it
+bool SBPLPlanningContext::initTimeCost(
+    std::map<std::string, std::string>& config)
+{
+    auto it = config.find("mprim_filename");
+    if (it == end(config)) {
+        ROS_WARN_NAMED(PP_LOGGER, "Time cost requires parameter 'mprim_filename'");
+        return false;
+    }
+
+    if (!GetPlanningVelocityLimits(*m_robot_model, m_vel_limits)) {
+        ROS_WARN_NAMED(PP_LOGGER, "No velocity limits for group '%s'", getGroupName().c_str());
+        return false;
+    }
+
+    auto dit = config.find("discretization");
+    if (dit == end(config)) {
+        ROS_WARN_NAMED(PP_LOGGER, "Time cost requires parameter 'discretization'");
+        return false;
+    }
+
+    std::vector<double> resolutions;
+    if (!GetPlanningResolutions(*m_robot_model, dit->second, resolutions)) {
+        return false;
+    }
+
+    if (m_time_scaled_mprim_filename.empty()) {
+        char path[] = "/tmp/sbpl_time_scaled_mprims_XXXXXX";
+        auto fd = mkstemp(path);
+        if (fd < 0) {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to create time-scaled motion primitive file");
+            return false;
+        }
+        close(fd);
+        m_time_scaled_mprim_filename = path;
+    }
+
+    if (!WriteTimeScaledPrimitives(
+            it->second, m_time_scaled_mprim_filename, m_vel_limits, resolutions))
+    {
+        return false;
+    }
+
+    ROS_DEBUG_NAMED(PP_LOGGER, " -> Time-scaled motion primitives: %s", m_time_scaled_mprim_filename.c_str());
+    it->second = m_time_scaled_mprim_filename;
+    return true;
+}
+
+// Update the planner for the scene and solve the translated request in this
+// process
+bool SBPLPlanningContext::solveInProcess(
+    const planning_scene::PlanningSceneConstPtr& scene,
+    const moveit::core::RobotState& start_state,
+    RequestScheduler::clock::time_point deadline,
+    moveit_msgs::MotionPlanRequest& req_msg,
+    moveit_msgs::MotionPlanResponse& res_msg)
+{
+    ROS_DEBUG_NAMED(PP_LOGGER, "Update planner modules");
+    if (!updatePlanner(scene, start_state, req_msg.workspace_parameters)) {
+        ROS_WARN_NAMED(PP_LOGGER, "Failed to update SBPL");
+        res_msg.planning_time = 0.0;
+        res_msg.error_code.val = moveit_msgs::MoveItErrorCodes::PLANNING_FAILED;
+        return false;
+    }
+
+    // the deadline covers the entire request, including admission and waiting
+    // for the group, not just the search
+    auto remaining = std::chrono::duration<double>(
+            deadline - RequestScheduler::clock::now()).count();
+    if (remaining <= 0.0) {
+        ROS_WARN_NAMED(PP_LOGGER, "Request deadline passed during setup");
+        res_msg.planning_time = 0.0;
+        res_msg.error_code.val = moveit_msgs::MoveItErrorCodes::TIMED_OUT;
+        return false;
+    }
+    ROS_DEBUG_NAMED(PP_LOGGER, "Search budget: %0.3f seconds", remaining);
+    req_msg.allowed_planning_time = remaining;
+
+    ROS_DEBUG_NAMED(PP_LOGGER, "Convert planning scene to message type");
+    // translate planning scene to planning scene message
+    moveit_msgs::PlanningScene scene_msg;
+    scene->getPlanningSceneMsg(scene_msg);
+
+    if (m_repair_path &&
+        repairLastSolution(scene_msg, req_msg, start_state, res_msg))
+    {
+        ROS_DEBUG_NAMED(PP_LOGGER, "Repaired last solution");
+    } else {
+        ROS_DEBUG_NAMED(PP_LOGGER, "Solve!");
+        m_last_path.clear();
+        if (!m_planner->solve(scene_msg, req_msg, res_msg)) {
+            return false;
+        }
+
+        if (m_repair_path &&
+            ConvertJointTrajectoryToPath(
+                    res_msg.trajectory.joint_trajectory,
+                    m_robot_model->planningVariableNames(),
+                    m_last_path))
+        {
+            m_last_req = req_msg;
+        }
+    }
+
+    return postProcessSolution(
+            *scene, *m_robot_model, *m_collision_checker, start_state, res_msg);
+}
+
+// Smooth, decimate and time a solution found by the planner, using the robot
+// model and collision checker that found it. Return false if no timing passes
+// the predicted obstacles.
+bool SBPLPlanningContext::postProcessSolution(
+    const planning_scene::PlanningScene& scene,
+    MoveItRobotModel& model,
+    MoveItCollisionChecker& checker,
+    const moveit::core::RobotState& start_state,
+    moveit_msgs::MotionPlanResponse& res_msg)
+{
+    SBPL_TRACE_SPAN("SBPLPlanningContext::postProcessSolution");
+
+    if (m_smooth_path) {
+        smoothSolution(scene, model, checker, start_state, res_msg);
+    }
+
+    if (m_decimate_path &&
+        res_msg.trajectory.multi_dof_joint_trajectory.points.empty())
+    {
+        auto& var_names = model.planningVariableNames();
+        std::vector<smpl::RobotState> path;
+        if (ConvertJointTrajectoryToPath(
+                res_msg.trajectory.joint_trajectory, var_names, path))
+        {
+            auto count = path.size();
+            if (DecimatePath(
+                    checker,
+                    model.variableContinuous(),
+                    m_decimation_tolerance,
+                    path))
+            {
+                ROS_DEBUG_NAMED(PP_LOGGER, "Decimated path from %zu to %zu waypoints", count, path.size());
+                ConvertPathToJointTrajectory(
+                        path, var_names, res_msg.trajectory.joint_trajectory);
+            }
+        }
+    }
+
+    if (m_avoid_predicted_obstacles &&
+        !timeSolution(scene, model, start_state, res_msg))
+    {
+        ROS_WARN_NAMED(PP_LOGGER, "Solution collides with predicted obstacles");
+        res_msg.error_code.val = moveit_msgs::MoveItErrorCodes::PLANNING_FAILED;
+        return false;
+    }
+
+    if (m_time_cost) {
+        std::vector<smpl::RobotState> path;
+        if (ConvertJointTrajectoryToPath(
+                res_msg.trajectory.joint_trajectory,
+                model.planningVariableNames(),
+                path))
+        {
+            auto duration = 0.0;
+            for (size_t i = 1; i < path.size(); ++i) {
+                duration += MinTraversalTime(
+                        m_vel_limits,
+                        model.variableContinuous(),
+                        path[i - 1],
+                        path[i]);
+            }
+            ROS_DEBUG_NAMED(PP_LOGGER, "Minimum traversal time of solution: %0.3f seconds", duration);
+        }
+    }
+
+    return true;
+}
+
+// Smooth the solution path in place, leaving it unchanged if the world
+// distance field is unavailable or the smoothed path is invalid
+void SBPLPlanningContext::smoothSolution(
+    const planning_scene::PlanningScene& scene,
+    MoveItRobotModel& model,
+    MoveItCollisionChecker& checker,
+    const moveit::core::RobotState& start_state,
+    moveit_msgs::MotionPlanResponse& res_msg)
+{
+    SBPL_TRACE_SPAN("SBPLPlanningContext::smoothSolution");
+
+    if (!res_msg.trajectory.multi_dof_joint_trajectory.points.empty()) {
+        return;
+    }
+
+    using collision_detection::CollisionWorldSBPL;
+    auto* cworld = dynamic_cast<const CollisionWorldSBPL*>(
+            scene.getCollisionWorld().get());
+    if (!cworld) {
+        return;
+    }
+
+    auto* dmap = cworld->distanceField(
+            scene.getRobotModel()->getName(), getGroupName());
+    if (!dmap) {
+        ROS_DEBUG_NAMED(PP_LOGGER, "World distance field is unavailable. Skip smoothing");
+        return;
+    }
+
+    auto& var_names = model.planningVariableNames();
+    std::vector<smpl::RobotState> path;
+    if (!ConvertJointTrajectoryToPath(
+            res_msg.trajectory.joint_trajectory, var_names, path))
+    {
+        return;
+    }
+
+    moveit::core::RobotState state(start_state);
+    if (SmoothPath(
+            model,
+            state,
+            *dmap,
+            checker,
+            m_smoother_params,
+            path))
+    {
+        ROS_DEBUG_NAMED(PP_LOGGER, "Smoothed solution");
+        ConvertPathToJointTrajectory(
+                path, var_names, res_msg.trajectory.joint_trajectory);
+    }
+}
+
+// Time the solution so that the robot passes the obstacles predicted by the
+// scene's collision world, setting the time from start of each waypoint.
+// Return false if no timing avoids them.
+bool SBPLPlanningContext::timeSolution(
+    const planning_scene::PlanningScene& scene,
+    const MoveItRobotModel& model,
+    const moveit::core::RobotState& start_state,
+    moveit_msgs::MotionPlanResponse& res_msg)
+{
+    SBPL_TRACE_SPAN("SBPLPlanningContext::timeSolution");
+
+    using collision_detection::CollisionWorldSBPL;
+    auto* cworld = dynamic_cast<const CollisionWorldSBPL*>(
+            scene.getCollisionWorld().get());
+    if (!cworld || !cworld->predictedObstacles()) {
+        return true;
+    }
+
+    if (!res_msg.trajectory.multi_dof_joint_trajectory.points.empty()) {
+        ROS_WARN_NAMED(PP_LOGGER, "Predicted obstacles are not supported for multi-dof trajectories");
+        return true;
+    }
+
+    auto& var_names = model.planningVariableNames();
+    std::vector<smpl::RobotState> path;
+    if (!ConvertJointTrajectoryToPath(
+            res_msg.trajectory.joint_trajectory, var_names, path))
+    {
+        return false;
+    }
+
+    moveit::core::RobotState state(start_state);
+    std::vector<double> times;
+    if (!TimePathAroundPredictedObstacles(
+            model,
+            state,
+            *cworld->predictedObstacles(),
+            m_vel_limits,
+            ros::Time::now(),
+            path,
+            times))
+    {
+        return false;
+    }
+
+    auto& traj = res_msg.trajectory.joint_trajectory;
+    ConvertPathToJointTrajectory(path, var_names, traj);
+    for (size_t i = 0; i < traj.points.size(); ++i) {
+        traj.points[i].time_from_start = ros::Duration(times[i]);
+    }
+    return true;
+}
+
+// Dispatch the original request, with the completed start state, to a worker,
+// which resolves the planner configuration itself. Return false if the request
+// must be solved in-process instead.
+bool SBPLPlanningContext::solveOnWorker(
+    const planning_scene::PlanningScene& scene,
+    const planning_interface::MotionPlanRequest& req,
+    const moveit_msgs::RobotState& start_state,
+    RequestScheduler::clock::time_point deadline,
+    moveit_msgs::MotionPlanResponse& res_msg)
+{
+    auto* cworld = dynamic_cast<const collision_detection::CollisionWorldSBPL*>(
+            scene.getCollisionWorld().get());
+
+    // voxels ingested outside of the planning scene are not part of the scene
+    // sent to the workers
+    if (cworld && cworld->hasVoxels()) {
+        return false;
+    }
+
+    // nor are predicted obstacles
+    if (m_avoid_predicted_obstacles && cworld && cworld->predictedObstacles()) {
+        return false;
+    }
+
+    auto worker_req = req;
+    worker_req.start_state = start_state;
+    auto remaining = std::chrono::duration<double>(
+            deadline - RequestScheduler::clock::now()).count();
+    if (remaining <= 0.0) {
+        return false;
+    }
+    worker_req.allowed_planning_time = remaining;
+
+    return m_workers->solve(scene, worker_req, res_msg);
+}
+
 bool SBPLPlanningContext::updatePlanner(
     const planning_scene::PlanningSceneConstPtr& scene,
     const moveit::core::RobotState& start_state,
     const moveit_msgs::WorkspaceParameters& workspace)
 {
+    SBPL_TRACE_SPAN("SBPLPlanningContext::updatePlanner");
+
     ROS_DEBUG_NAMED(PP_LOGGER, "Update planner");
 
+    auto voxel_version = VoxelVersion(*scene);
+
+    std::vector<collision_detection::World::ObjectConstPtr> world_objects;
+    moveit_msgs::AllowedCollisionMatrix acm;
+    if (m_reuse_search) {
+        auto& world = *scene->getWorld();
+        world_objects.reserve(world.size());
+        for (auto it = world.begin(); it != world.end(); ++it) {
+            world_objects.push_back(it->second);
+        }
+        std::sort(begin(world_objects), end(world_objects));
+        scene->getAllowedCollisionMatrix().getMessage(acm);
+    }
+
+    // Only the goal may have changed since the last request; keep the
+    // collision checker and everything it has learned about this scene.
+    // World objects are copied on write while m_prev_world holds them, so
+    // equal objects imply an unchanged world.
+    if (m_reuse_search &&
+        m_planner &&
+        m_collision_checker &&
+        scene == m_prev_scene &&
+        world_objects == m_prev_world &&
+        voxel_version == m_prev_voxel_version &&
+        SerializedEqual(acm, m_prev_acm) &&
+        m_prev_start_state &&
+        SameRobotState(start_state, *m_prev_start_state) &&
+        SerializedEqual(workspace, m_prev_workspace))
+    {
+        ROS_DEBUG_NAMED(PP_LOGGER, " -> Reuse planner from previous request");
+        return true;
+    }
+
+    // the planner refers to the collision checker being replaced
+    m_planner.reset();
+    m_prev_start_state.reset();
+
     // Update the collision checker interface to use the complete start state
     // as the reference state
     ROS_DEBUG_NAMED(PP_LOGGER, " -> Initialize collision checker interface");
-    m_collision_checker = make_unique<MoveItCollisionChecker>();
+    m_collision_checker.reset();
+    m_arena.reset();
+    m_collision_checker = make_unique<MoveItCollisionChecker>(&m_arena);
     if (!m_collision_checker->init(m_robot_model, start_state, scene)) {
         ROS_WARN_NAMED(PP_LOGGER, "Failed to initialize collision checker interface");
         return false;
     }
 
     // Create an occupancy grid (distance map) if required by the planner
-    // TODO: this should be optional if a grid is not required by the planner
-    if (true || m_use_grid) {
+    if (m_build_grid) {
         ROS_DEBUG_NAMED(PP_LOGGER, " -> Update or create grid");
         // TODO: difficult to make this function transactional, since it is
         // preferred to modify the grid in place when possible
@@ -375,29 +1060,287 @@ bool SBPLPlanningContext::updatePlanner(
             ROS_WARN_NAMED(PP_LOGGER, "Failed to update or create grid");
             return false;
         }
+    } else if (!m_grid || m_grid->getReferenceFrame() != scene->getPlanningFrame()) {
+        // the planner interface requires a grid, if only for the frame of its
+        // visualizations
+        ROS_DEBUG_NAMED(PP_LOGGER, " -> Create placeholder grid");
+        m_grid = CreatePlaceholderGrid(scene->getPlanningFrame());
     }
 
     ROS_DEBUG_NAMED(PP_LOGGER, " -> Initialize planner interface");
     m_planner = make_unique<smpl::PlannerInterface>(
-            m_robot_model, m_collision_checker.get(), m_grid.get());
+            m_robot_model,
+            m_collision_checker.get(),
+            const_cast<smpl::OccupancyGrid*>(m_grid.get()));
     if (!m_planner->init(m_pp)) {
         ROS_WARN_NAMED(PP_LOGGER, "Failed to initialize planner interface");
+        m_planner.reset();
         return false;
     }
 
+    m_collision_checker->setCacheResults(m_reuse_search);
+
     m_prev_scene = scene;
     m_prev_workspace = workspace;
+    m_prev_voxel_version = voxel_version;
+    m_prev_world = std::move(world_objects);
+    m_prev_acm = std::move(acm);
+    m_prev_start_state = std::make_shared<moveit::core::RobotState>(start_state);
+    return true;
+}
+
+bool SBPLPlanningContext::solveBatchRequest(
+    const planning_scene::PlanningSceneConstPtr& scene,
+    const moveit_msgs::PlanningScene& scene_msg,
+    MoveItRobotModel* model,
+    Arena& arena,
+    const planning_interface::MotionPlanRequest& req,
+    planning_interface::MotionPlanResponse& res)
+{
+    SBPL_TRACE_SPAN("SBPLPlanningContext::solveBatchRequest");
+
+    auto then = std::chrono::high_resolution_clock::now();
+
+    res.trajectory_.reset();
+    res.planning_time_ = 0.0;
+
+    moveit_msgs::MotionPlanRequest req_msg;
+    if (!TranslateRequest(req, m_planner_id, req_msg)) {
+        ROS_WARN_NAMED(PP_LOGGER, "Unable to translate Motion Plan Request to SBPL Motion Plan Request");
+        res.error_code_.val = moveit_msgs::MoveItErrorCodes::FAILURE;
+        return false;
+    }
+
+    auto start_state = scene->getCurrentStateUpdated(req_msg.start_state);
+    if (!start_state) {
+        ROS_WARN_NAMED(PP_LOGGER, "Unable to update start state with requested start state overrides");
+        res.error_code_.val = moveit_msgs::MoveItErrorCodes::INVALID_ROBOT_STATE;
+        return false;
+    }
+    moveit::core::robotStateToRobotStateMsg(*start_state, req_msg.start_state);
+
+    if (req_msg.goal_constraints.empty()) {
+        res.trajectory_.reset(new robot_trajectory::RobotTrajectory(
+                scene->getRobotModel(), getGroupName()));
+        res.trajectory_->addSuffixWayPoint(*start_state, 0.0);
+        res.error_code_.val = moveit_msgs::MoveItErrorCodes::SUCCESS;
+        return true;
+    }
+
+    // the collision checker of the previous request has been destroyed
+    arena.reset();
+    MoveItCollisionChecker collision_checker(&arena);
+    if (!collision_checker.init(model, *start_state, scene)) {
+        ROS_WARN_NAMED(PP_LOGGER, "Failed to initialize collision checker interface");
+        res.error_code_.val = moveit_msgs::MoveItErrorCodes::PLANNING_FAILED;
+        return false;
+    }
+
+    // the grid is only read during planning and is shared between workers
+    smpl::PlannerInterface planner(
+            model,
+            &collision_checker,
+            const_cast<smpl::OccupancyGrid*>(m_grid.get()));
+    if (!planner.init(m_pp)) {
+        ROS_WARN_NAMED(PP_LOGGER, "Failed to initialize planner interface");
+        res.error_code_.val = moveit_msgs::MoveItErrorCodes::PLANNING_FAILED;
+        return false;
+    }
+
+    // solutions are not repaired from earlier requests, as batched requests
+    // are solved in no particular order
+    moveit_msgs::MotionPlanResponse res_msg;
+    if (!planner.solve(scene_msg, req_msg, res_msg) ||
+        !postProcessSolution(
+                *scene, *model, collision_checker, *start_state, res_msg))
+    {
+        res.planning_time_ = res_msg.planning_time;
+        res.error_code_ = res_msg.error_code;
+        return false;
+    }
+
+    robot_trajectory::RobotTrajectoryPtr traj(new robot_trajectory::RobotTrajectory(
+            scene->getRobotModel(), getGroupName()));
+    traj->setRobotTrajectoryMsg(*start_state, res_msg.trajectory);
+
+    auto now = std::chrono::high_resolution_clock::now();
+    res.trajectory_ = std::move(traj);
+    res.planning_time_ = std::chrono::duration<double>(now - then).count();
+    res.error_code_ = res_msg.error_code;
+    return true;
+}
+
+// Attempt to reuse the last solution for a request that differs from the last
+// request only in its planning scene. Runs of invalid segments are replaced by
+// short searches between the valid waypoints that surround them. Returns false
+// if the request differs, or if any run could not be repaired, in which case
+// the caller should plan from scratch.
+bool SBPLPlanningContext::repairLastSolution(
+    const moveit_msgs::PlanningScene& scene_msg,
+    const moveit_msgs::MotionPlanRequest& req_msg,
+    const moveit::core::RobotState& start_state,
+    moveit_msgs::MotionPlanResponse& res_msg)
+{
+    auto then = std::chrono::high_resolution_clock::now();
+
+    if (m_last_path.size() < 2 ||
+        req_msg.group_name != m_last_req.group_name ||
+        req_msg.planner_id != m_last_req.planner_id ||
+        !SerializedEqual(req_msg.goal_constraints, m_last_req.goal_constraints) ||
+        !SerializedEqual(req_msg.path_constraints, m_last_req.path_constraints))
+    {
+        return false;
+    }
+
+    auto& avinds = m_robot_model->activeVariableIndices();
+    for (size_t vidx = 0; vidx < avinds.size(); ++vidx) {
+        double pos = start_state.getVariablePosition(avinds[vidx]);
+        if (std::fabs(pos - m_last_path.front()[vidx]) > 1e-6) {
+            return false;
+        }
+    }
+
+    auto& path = m_last_path;
+    auto& cc = *m_collision_checker;
+
+    // spend at most a quarter of the allowed time repairing before giving up
+    // and planning from scratch
+    double repair_time = 0.25 * req_msg.allowed_planning_time;
+
+    std::vector<smpl::RobotState> repaired;
+    repaired.push_back(path.front());
+    int repair_count = 0;
+    size_t i = 0;
+    while (i + 1 < path.size()) {
+        if (cc.isStateToStateValid(path[i], path[i + 1], false)) {
+            repaired.push_back(path[i + 1]);
+            ++i;
+            continue;
+        }
+
+        // find the first waypoint after the invalid run from which the rest of
+        // the path is locally valid
+        size_t j = i + 1;
+        while (j + 1 < path.size() &&
+            !(cc.isStateValid(path[j], false) &&
+                    cc.isStateToStateValid(path[j], path[j + 1], false)))
+        {
+            ++j;
+        }
+        if (!cc.isStateValid(path[j], false)) {
+            ROS_DEBUG_NAMED(PP_LOGGER, "Last solution's goal is invalid");
+            return false;
+        }
+
+        auto now = std::chrono::high_resolution_clock::now();
+        double elapsed = std::chrono::duration<double>(now - then).count();
+        if (elapsed >= repair_time) {
+            return false;
+        }
+
+        std::vector<smpl::RobotState> segment;
+        if (!planRepairSegment(
+                scene_msg, req_msg, start_state,
+                path[i], path[j],
+                repair_time - elapsed,
+                segment))
+        {
+            ROS_DEBUG_NAMED(PP_LOGGER, "Failed to repair waypoints [%zu, %zu]", i, j);
+            return false;
+        }
+
+        repaired.insert(end(repaired), begin(segment) + 1, end(segment));
+        ++repair_count;
+        i = j;
+    }
+
+    ROS_INFO_NAMED(PP_LOGGER, "Repaired %d segments of the last solution", repair_count);
+
+    m_last_path = std::move(repaired);
+
+    res_msg.group_name = req_msg.group_name;
+    res_msg.trajectory_start = req_msg.start_state;
+    ConvertPathToJointTrajectory(
+            m_last_path,
+            m_robot_model->planningVariableNames(),
+            res_msg.trajectory.joint_trajectory);
+    res_msg.trajectory.joint_trajectory.header.frame_id =
+            m_robot_model->moveitRobotModel()->getModelFrame();
+    auto now = std::chrono::high_resolution_clock::now();
+    res_msg.planning_time = std::chrono::duration<double>(now - then).count();
+    res_msg.error_code.val = moveit_msgs::MoveItErrorCodes::SUCCESS;
+    return true;
+}
+
+// Plan a path between two waypoints of the last solution. The returned segment
+// begins at from and ends at to.
+bool SBPLPlanningContext::planRepairSegment(
+    const moveit_msgs::PlanningScene& scene_msg,
+    const moveit_msgs::MotionPlanRequest& req_msg,
+    const moveit::core::RobotState& start_state,
+    const smpl::RobotState& from,
+    const smpl::RobotState& to,
+    double allowed_time,
+    std::vector<smpl::RobotState>& segment)
+{
+    auto& var_names = m_robot_model->planningVariableNames();
+    auto& avinds = m_robot_model->activeVariableIndices();
+
+    moveit_msgs::MotionPlanRequest req = req_msg;
+
+    moveit::core::RobotState state(start_state);
+    for (size_t vidx = 0; vidx < avinds.size(); ++vidx) {
+        state.setVariablePosition(avinds[vidx], from[vidx]);
+    }
+    moveit::core::robotStateToRobotStateMsg(state, req.start_state);
+
+    const double goal_tolerance = smpl::angles::to_radians(2.0);
+    req.goal_constraints.resize(1);
+    auto& goal = req.goal_constraints.front();
+    goal = moveit_msgs::Constraints();
+    goal.joint_constraints.resize(var_names.size());
+    for (size_t vidx = 0; vidx < var_names.size(); ++vidx) {
+        auto& jc = goal.joint_constraints[vidx];
+        jc.joint_name = var_names[vidx];
+        jc.position = to[vidx];
+        jc.tolerance_above = goal_tolerance;
+        jc.tolerance_below = goal_tolerance;
+        jc.weight = 1.0;
+    }
+    req.allowed_planning_time = allowed_time;
+
+    moveit_msgs::MotionPlanResponse res;
+    if (!m_planner->solve(scene_msg, req, res)) {
+        return false;
+    }
+
+    if (!ConvertJointTrajectoryToPath(
+            res.trajectory.joint_trajectory, var_names, segment) ||
+        segment.empty())
+    {
+        return false;
+    }
+
+    // connect the end of the segment to the exact waypoint
+    if (!m_collision_checker->isStateToStateValid(segment.back(), to, false)) {
+        return false;
+    }
+    segment.push_back(to);
     return true;
 }
 
 auto SBPLPlanningContext::updateOrCreateGrid(
-    std::unique_ptr<smpl::OccupancyGrid> grid,
+    std::shared_ptr<const smpl::OccupancyGrid> grid,
     const planning_scene::PlanningSceneConstPtr& scene,
     const moveit_msgs::WorkspaceParameters& workspace)
-    -> std::unique_ptr<smpl::OccupancyGrid>
+    -> std::shared_ptr<const smpl::OccupancyGrid>
 {
-    // TODO: transforms may have changed that reposition the workspace within
-    // the planning frame
+    // compare the workspace bounds in the planning frame, since transforms
+    // may have changed that reposition the workspace
+    moveit_msgs::OrientedBoundingBox workspace_aabb;
+    bool have_aabb = GetPlanningFrameWorkspaceAABB(
+            workspace, *scene, workspace_aabb);
+
     bool workspace_diff =
             workspace.header.frame_id != m_prev_workspace.header.frame_id ||
             workspace.min_corner.x != m_prev_workspace.min_corner.x ||
@@ -405,33 +1348,109 @@ auto SBPLPlanningContext::updateOrCreateGrid(
             workspace.min_corner.z != m_prev_workspace.min_corner.z ||
             workspace.max_corner.x != m_prev_workspace.max_corner.x ||
             workspace.max_corner.y != m_prev_workspace.max_corner.y ||
-            workspace.max_corner.z != m_prev_workspace.max_corner.z;
+            workspace.max_corner.z != m_prev_workspace.max_corner.z ||
+            !have_aabb ||
+            !SerializedEqual(workspace_aabb, m_prev_workspace_aabb);
+
+    // compare world contents rather than scenes, since a scene may be modified
+    // in place between requests
+    auto key = HeuristicGridRegistry::MakeKey(
+            *scene->getWorld(),
+            VoxelVersion(*scene),
+            scene->getPlanningFrame(),
+            workspace_aabb,
+            m_grid_res_x,
+            m_grid_inflation_radius);
+    bool world_diff =
+            key.objects != m_grid_world ||
+            key.voxel_version != m_grid_voxel_version;
+
+    if (have_aabb) {
+        std::lock_guard<std::mutex> lock(m_prepare_mutex);
+        m_grid_key = key;
+        m_grid_key.objects.clear();
+        m_have_grid_key = true;
+    }
+
+    if (grid && !workspace_diff && !world_diff) {
+        ROS_DEBUG_NAMED(PP_LOGGER, "   -> Reuse grid");
+        return grid;
+    }
 
-    if (scene != m_prev_scene || workspace_diff) {
+    if (m_grid_registry && have_aabb) {
+        auto shared = m_grid_registry->find(key);
+        if (shared) {
+            ROS_DEBUG_NAMED(PP_LOGGER, "   -> Use shared grid");
+            m_grid_world = std::move(key.objects);
+            m_grid_voxel_version = key.voxel_version;
+            m_prev_workspace_aabb = workspace_aabb;
+            return shared;
+        }
+    }
+
+    std::shared_ptr<const smpl::OccupancyGrid> new_grid;
+
+    // shared grids are never modified in place, and voxels applied outside
+    // of world objects are only picked up by a new grid
+    if (m_grid_registry ||
+        !grid ||
+        scene != m_prev_scene ||
+        workspace_diff ||
+        key.voxel_version != m_grid_voxel_version)
+    {
         ROS_DEBUG_NAMED(PP_LOGGER, "   -> Scene or workspace changed (scene: %p -> %p)", m_prev_scene.get(), scene.get());
         {
             auto g = std::move(grid); // for lack of a swap or destroy
         }
-        return CreateHeuristicGrid(
-                *scene,
-                workspace,
-                m_robot_model->planningGroupName(),
-                m_grid_res_x,
-                m_grid_res_y,
-                m_grid_res_z,
-                m_grid_inflation_radius);
+        if (m_grid_registry && have_aabb && key.voxel_version == 0) {
+            // built as prepareGrid() builds grids for the same key, so that
+            // the grid found in the registry does not depend on which build
+            // inserted it
+            new_grid = CreateHeuristicGridFromObjects(
+                    workspace_aabb,
+                    key.frame_id,
+                    key.objects,
+                    key.res,
+                    key.inflation_radius);
+        } else {
+            new_grid = CreateHeuristicGrid(
+                    *scene,
+                    workspace,
+                    m_robot_model->planningGroupName(),
+                    m_grid_res_x,
+                    m_grid_res_y,
+                    m_grid_res_z,
+                    m_grid_inflation_radius);
+        }
+    }
+
+    if (new_grid) {
+        if (m_grid_registry && have_aabb) {
+            m_grid_registry->insert(key, new_grid);
+        }
+        m_grid_world = std::move(key.objects);
+        m_grid_voxel_version = key.voxel_version;
+        m_prev_workspace_aabb = workspace_aabb;
+        return new_grid;
+    } else if (!grid) {
+        return nullptr;
     } else {
+        // without a registry, the grid is owned by this context alone
+        auto mgrid = std::const_pointer_cast<smpl::OccupancyGrid>(grid);
+        m_grid_world = std::move(key.objects);
+        m_grid_voxel_version = key.voxel_version;
+
         ROS_DEBUG_NAMED(PP_LOGGER, "   -> Update persistent grid");
         auto voxelize = [&](const collision_detection::World::Object& object)
         {
             std::vector<std::vector<Eigen::Vector3d>> voxelses; // , my precious
             Eigen::Vector3d grid_origin;
-            grid_origin.x() = grid->originX();
-            grid_origin.y() = grid->originY();
-            grid_origin.z() = grid->originZ();
+            grid_origin.x() = mgrid->originX();
+            grid_origin.y() = mgrid->originY();
+            grid_origin.z() = mgrid->originZ();
             smpl::collision::VoxelizeObject(
                     object,
-                    grid->resolution(),
+                    mgrid->resolution(),
                     grid_origin,
                     voxelses);
             return voxelses;
@@ -441,7 +1460,7 @@ auto SBPLPlanningContext::updateOrCreateGrid(
         {
             auto voxelses = voxelize(object);
             for (auto& voxels : voxelses) {
-                grid->removePointsFromField(voxels);
+                mgrid->removePointsFromField(voxels);
             }
         };
 
@@ -449,7 +1468,7 @@ auto SBPLPlanningContext::updateOrCreateGrid(
         {
             auto voxelses = voxelize(object);
             for (auto& voxels : voxelses) {
-                grid->addPointsToField(voxels);
+                mgrid->addPointsToField(voxels);
             }
         };
 
@@ -698,6 +1717,8 @@ auto CreateHeuristicGrid(
     double max_distance)
     -> std::unique_ptr<smpl::OccupancyGrid>
 {
+    SBPL_TRACE_SPAN("CreateHeuristicGrid");
+
     // create a distance field in the planning frame that represents the
     // workspace boundaries
 
@@ -740,14 +1761,6 @@ auto CreateHeuristicGrid(
     ROS_DEBUG_NAMED(PP_LOGGER, "  origin_y: %0.3f", workspace_pos_in_planning.y());
     ROS_DEBUG_NAMED(PP_LOGGER, "  origin_z: %0.3f", workspace_pos_in_planning.z());
 
-    auto hdf = std::make_shared<smpl::PropagationDistanceField>(
-            workspace_pos_in_planning.x(),
-            workspace_pos_in_planning.y(),
-            workspace_pos_in_planning.z(),
-            size_x, size_y, size_z,
-            res_x,
-            max_distance);
-
     ////////////////////////////////////////////////////////
     // Try to Copy Distance Field from CollisionWorldSBPL //
     ////////////////////////////////////////////////////////
@@ -767,6 +1780,13 @@ auto CreateHeuristicGrid(
             // planning scene world, but should probably add an explicit
             // function to force an update
             ROS_DEBUG_NAMED(PP_LOGGER, "Copy collision information");
+            auto hdf = std::make_shared<smpl::PropagationDistanceField>(
+                    workspace_pos_in_planning.x(),
+                    workspace_pos_in_planning.y(),
+                    workspace_pos_in_planning.z(),
+                    size_x, size_y, size_z,
+                    res_x,
+                    max_distance);
             CopyDistanceField(*df, *hdf);
 
             ROS_INFO_NAMED(PP_LOGGER, "Successfully initialized heuristic grid from sbpl collision checker");
@@ -782,12 +1802,48 @@ auto CreateHeuristicGrid(
     // Create New Distance Field //
     ///////////////////////////////
 
+    std::vector<collision_detection::World::ObjectConstPtr> objects;
+    auto& world = cworld->getWorld();
+    if (world) {
+        for (auto oit = world->begin(); oit != world->end(); ++oit) {
+            objects.push_back(oit->second);
+        }
+    } else {
+        ROS_WARN_NAMED(PP_LOGGER, "Attempt to insert null World into heuristic grid");
+    }
+
+    return CreateHeuristicGridFromObjects(
+            workspace_aabb, scene.getPlanningFrame(), objects, res_x, max_distance);
+}
+
+// Create a heuristic grid over the workspace bounds, in the planning frame,
+// from the world objects alone
+auto CreateHeuristicGridFromObjects(
+    const moveit_msgs::OrientedBoundingBox& workspace_aabb,
+    const std::string& frame_id,
+    const std::vector<collision_detection::World::ObjectConstPtr>& objects,
+    double res,
+    double max_distance)
+    -> std::unique_ptr<smpl::OccupancyGrid>
+{
+    SBPL_TRACE_SPAN("CreateHeuristicGridFromObjects");
+
+    auto hdf = std::make_shared<smpl::PropagationDistanceField>(
+            workspace_aabb.pose.position.x - 0.5 * workspace_aabb.extents.x,
+            workspace_aabb.pose.position.y - 0.5 * workspace_aabb.extents.y,
+            workspace_aabb.pose.position.z - 0.5 * workspace_aabb.extents.z,
+            workspace_aabb.extents.x,
+            workspace_aabb.extents.y,
+            workspace_aabb.extents.z,
+            res,
+            max_distance);
+
     // TODO: the collision checker might be mature enough to consider
     // instantiating a full cspace here and using available voxels state
     // information for a more accurate heuristic
 
     auto grid = make_unique<smpl::OccupancyGrid>(hdf);
-    grid->setReferenceFrame(scene.getPlanningFrame());
+    grid->setReferenceFrame(frame_id);
 
     // temporary storage for collision shapes/objects
     std::vector<std::unique_ptr<smpl::collision::CollisionShape>> shapes;
@@ -795,25 +1851,19 @@ auto CreateHeuristicGrid(
     smpl::collision::WorldCollisionModel cmodel(grid.get());
 
     // insert world objects into the collision model
-    auto& world = cworld->getWorld();
-    if (world) {
-        int insert_count = 0;
-        for (auto oit = world->begin(); oit != world->end(); ++oit) {
-
-            collision_objects.push_back(std::unique_ptr<smpl::collision::CollisionObject>());
-            ConvertObjectToCollisionObjectShallow(oit->second, shapes, collision_objects.back());
-            auto& collision_object = collision_objects.back();
-
-            if (!cmodel.insertObject(collision_object.get())) {
-                ROS_WARN_NAMED(PP_LOGGER, "Failed to insert object '%s' into heuristic grid", oit->first.c_str());
-            } else {
-                ++insert_count;
-            }
+    int insert_count = 0;
+    for (auto& object : objects) {
+        collision_objects.push_back(std::unique_ptr<smpl::collision::CollisionObject>());
+        ConvertObjectToCollisionObjectShallow(object, shapes, collision_objects.back());
+        auto& collision_object = collision_objects.back();
+
+        if (!cmodel.insertObject(collision_object.get())) {
+            ROS_WARN_NAMED(PP_LOGGER, "Failed to insert object '%s' into heuristic grid", object->id_.c_str());
+        } else {
+            ++insert_count;
         }
-        ROS_DEBUG_NAMED(PP_LOGGER, "Inserted %d objects into the heuristic grid", insert_count);
-    } else {
-        ROS_WARN_NAMED(PP_LOGGER, "Attempt to insert null World into heuristic grid");
     }
+    ROS_DEBUG_NAMED(PP_LOGGER, "Inserted %d objects into the heuristic grid", insert_count);
 
     // note: collision world and going out of scope here will
     // not destroy the prepared distance field and occupancy grid
@@ -821,6 +1871,27 @@ auto CreateHeuristicGrid(
     return grid;
 }
 
+// A single-cell grid for the planner interface when the planner does not read
+// the world grid
+auto CreatePlaceholderGrid(const std::string& frame_id)
+    -> std::unique_ptr<smpl::OccupancyGrid>
+{
+    const double res = 0.02;
+    auto df = std::make_shared<smpl::PropagationDistanceField>(
+            0.0, 0.0, 0.0, res, res, res, res, res);
+    auto grid = make_unique<smpl::OccupancyGrid>(df);
+    grid->setReferenceFrame(frame_id);
+    return grid;
+}
+
+auto VoxelVersion(const planning_scene::PlanningScene& scene) -> uint64_t
+{
+    using collision_detection::CollisionWorldSBPL;
+    auto* cworld = dynamic_cast<const CollisionWorldSBPL*>(
+            scene.getCollisionWorld().get());
+    return cworld ? cworld->voxelVersion() : 0;
+}
+
 void CopyDistanceField(
     const smpl::DistanceMapInterface& dfin,
     smpl::DistanceMapInterface& dfout)
@@ -846,4 +1917,145 @@ void CopyDistanceField(
     dfout.addPointsToMap(points);
 }
 
+bool ConvertJointTrajectoryToPath(
+    const trajectory_msgs::JointTrajectory& traj,
+    const std::vector<std::string>& var_names,
+    std::vector<smpl::RobotState>& path)
+{
+    std::vector<size_t> indices(var_names.size());
+    for (size_t vidx = 0; vidx < var_names.size(); ++vidx) {
+        auto it = std::find(
+                begin(traj.joint_names), end(traj.joint_names),
+                var_names[vidx]);
+        if (it == end(traj.joint_names)) {
+            return false;
+        }
+        indices[vidx] = std::distance(begin(traj.joint_names), it);
+    }
+
+    path.resize(traj.points.size());
+    for (size_t pidx = 0; pidx < traj.points.size(); ++pidx) {
+        auto& positions = traj.points[pidx].positions;
+        path[pidx].resize(var_names.size());
+        for (size_t vidx = 0; vidx < var_names.size(); ++vidx) {
+            if (indices[vidx] >= positions.size()) {
+                path.clear();
+                return false;
+            }
+            path[pidx][vidx] = positions[indices[vidx]];
+        }
+    }
+    return true;
+}
+
+void ConvertPathToJointTrajectory(
+    const std::vector<smpl::RobotState>& path,
+    const std::vector<std::string>& var_names,
+    trajectory_msgs::JointTrajectory& traj)
+{
+    traj.joint_names = var_names;
+    traj.points.resize(path.size());
+    for (size_t pidx = 0; pidx < path.size(); ++pidx) {
+        traj.points[pidx] = trajectory_msgs::JointTrajectoryPoint();
+        traj.points[pidx].positions = path[pidx];
+    }
+}
+
+bool SameRobotState(
+    const moveit::core::RobotState& a,
+    const moveit::core::RobotState& b)
+{
+    if (a.getRobotModel() != b.getRobotModel()) {
+        return false;
+    }
+
+    if (!std::equal(
+            a.getVariablePositions(),
+            a.getVariablePositions() + a.getVariableCount(),
+            b.getVariablePositions()))
+    {
+        return false;
+    }
+
+    std::vector<const moveit::core::AttachedBody*> abodies;
+    std::vector<const moveit::core::AttachedBody*> bbodies;
+    a.getAttachedBodies(abodies);
+    b.getAttachedBodies(bbodies);
+    if (abodies.size() != bbodies.size()) {
+        return false;
+    }
+    for (auto* ab : abodies) {
+        if (!b.hasAttachedBody(ab->getName())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Remove waypoints that lie within tolerance, in every variable, of the
+// straight-line motion between the waypoints kept around them, provided the
+// replacing motion is valid. Return true if any waypoints were removed.
+bool DecimatePath(
+    smpl::CollisionChecker& checker,
+    const std::vector<bool>& continuous,
+    double tolerance,
+    std::vector<smpl::RobotState>& path)
+{
+    if (path.size() < 3) {
+        return false;
+    }
+
+    // whether the waypoints between path[i] and path[j] lie within tolerance
+    // of the motion from path[i] to path[j]
+    auto within_tolerance = [&](size_t i, size_t j)
+    {
+        auto& a = path[i];
+        auto& b = path[j];
+        for (size_t k = i + 1; k < j; ++k) {
+            double t = (double)(k - i) / (double)(j - i);
+            for (size_t v = 0; v < a.size(); ++v) {
+                double ab, ak;
+                if (continuous[v]) {
+                    ab = smpl::angles::shortest_angle_diff(b[v], a[v]);
+                    ak = smpl::angles::shortest_angle_diff(path[k][v], a[v]);
+                } else {
+                    ab = b[v] - a[v];
+                    ak = path[k][v] - a[v];
+                }
+                if (std::fabs(ak - t * ab) > tolerance) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    std::vector<smpl::RobotState> decimated;
+    decimated.push_back(path.front());
+
+    size_t i = 0;
+    while (i < path.size() - 1) {
+        // furthest waypoint reachable within tolerance
+        auto j = i + 1;
+        while (j + 1 < path.size() && within_tolerance(i, j + 1)) {
+            ++j;
+        }
+
+        // back off toward the next waypoint until the motion is valid
+        while (j > i + 1 && !checker.isStateToStateValid(path[i], path[j], false)) {
+            j = i + 1 + (j - i - 1) / 2;
+        }
+
+        decimated.push_back(path[j]);
+        i = j;
+    }
+
+    if (decimated.size() == path.size()) {
+        return false;
+    }
+
+    path = std::move(decimated);
+    return true;
+}
+
 } // namespace sbpl_interface
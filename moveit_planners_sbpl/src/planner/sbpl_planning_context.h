@@ -2,14 +2,18 @@
 #define sbpl_interface_SBPLPlanningContext_h
 
 // standard includes
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 // system includes
 #include <moveit/distance_field/propagation_distance_field.h>
 #include <moveit/macros/class_forward.h>
 #include <moveit/planning_interface/planning_interface.h>
+#include <moveit_msgs/AllowedCollisionMatrix.h>
 #include <moveit_msgs/OrientedBoundingBox.h>
 #include <moveit_msgs/MotionPlanRequest.h>
 #include <smpl/ros/planner_interface.h>
@@ -18,7 +22,12 @@
 // project includes
 #include <moveit_planners_sbpl/planner/moveit_robot_model.h>
 
+#include "arena.h"
+#include "heuristic_grid_registry.h"
 #include "moveit_collision_checker.h"
+#include "request_scheduler.h"
+#include "trajectory_smoother.h"
+#include "worker_pool.h"
 
 namespace sbpl_interface {
 
@@ -59,16 +68,84 @@ public:
     /// before this initialization is possible.
     bool init(const std::map<std::string, std::string>& config);
 
+    /// Priority, from the "priority" setting, with which requests solved by
+    /// this context are admitted by the request scheduler
+    int priority() const { return m_priority; }
+
+    /// \brief Set the time at which the request was made
+    ///
+    /// The request's deadline is allowed_planning_time after this time. Time
+    /// spent waiting for admission and updating the planner is subtracted
+    /// from the time given to the search.
+    void setRequestTime(RequestScheduler::clock::time_point time)
+    { m_request_time = time; }
+
+    /// \brief Share heuristic grids with other contexts through \p registry
+    ///
+    /// Shared grids are never modified in place; a change to the world builds
+    /// or finds a different grid.
+    void setGridRegistry(HeuristicGridRegistry* registry)
+    { m_grid_registry = registry; }
+
+    /// \brief Dispatch calls to solve() to out-of-process workers
+    ///
+    /// Requests are solved in-process when no worker is ready or a worker
+    /// fails.
+    void setWorkerPool(WorkerPool* workers) { m_workers = workers; }
+
+    /// \brief Build the heuristic grid for a changed world ahead of a request
+    ///
+    /// The grid is built for the workspace of the last request and published
+    /// to the grid registry, where the next request against the same world
+    /// finds it. May be called from any thread. Does nothing without a grid
+    /// registry, before the first request, or when voxels have been applied to
+    /// the world outside of its objects.
+    void prepareGrid(
+        const std::vector<collision_detection::World::ObjectConstPtr>& objects);
+
+    /// Return an estimate of the memory, in bytes, held by the heuristic grid,
+    /// the collision checker, and the retained solution. A heuristic grid held
+    /// by the grid registry is not counted.
+    ///
+    /// The estimate is taken at the end of each solve, so that it may be read
+    /// without the group lock while the context is solving another request.
+    auto memoryUsage() const -> size_t;
+
+    /// \brief Solve several requests against the same scene in parallel
+    ///
+    /// The heuristic grid is built once for the shared scene and workspace.
+    /// Each worker plans with its own robot model, collision checker, and diff
+    /// of the scene so that no mutable collision checking state is shared
+    /// between threads. All requests must share the same workspace.
+    ///
+    /// \param models One robot model per worker thread, initialized for this
+    ///     context's group and with the planning link set
+    /// \param res One response per request, in the order of the requests
+    /// \return true if the batch was run, regardless of whether individual
+    ///     requests succeeded
+    bool solveBatch(
+        const planning_scene::PlanningSceneConstPtr& scene,
+        const std::vector<planning_interface::MotionPlanRequest>& reqs,
+        const std::vector<MoveItRobotModel*>& models,
+        std::vector<planning_interface::MotionPlanResponse>& res);
+
 private:
 
     // sbpl planner components
     MoveItRobotModel* m_robot_model;
+
+    // backs the caches of the collision checker, which is destroyed first
+    Arena m_arena;
     std::unique_ptr<MoveItCollisionChecker> m_collision_checker;
 
-    std::unique_ptr<smpl::OccupancyGrid> m_grid;
+    std::shared_ptr<const smpl::OccupancyGrid> m_grid;
+    HeuristicGridRegistry* m_grid_registry;
 
     std::unique_ptr<smpl::PlannerInterface> m_planner;
 
+    // memoryUsage() as of the end of the last solve
+    std::atomic<size_t> m_memory_usage;
+
     std::map<std::string, std::string> m_config;
     smpl::PlanningParams m_pp;
 
@@ -76,6 +153,11 @@ private:
     std::string m_planner_id;
 
     bool m_use_grid;
+
+    // whether the heuristic or graph reads the world grid. otherwise, the
+    // planner interface is given a placeholder grid in the planning frame
+    bool m_build_grid;
+
     double m_grid_res_x;
     double m_grid_res_y;
     double m_grid_res_z;
@@ -84,6 +166,97 @@ private:
     moveit_msgs::WorkspaceParameters m_prev_workspace;
     planning_scene::PlanningSceneConstPtr m_prev_scene;
 
+    // bounds of the heuristic grid in the planning frame and the objects of
+    // the world it was built from
+    moveit_msgs::OrientedBoundingBox m_prev_workspace_aabb;
+    std::vector<collision_detection::World::ObjectConstPtr> m_grid_world;
+    uint64_t m_grid_voxel_version;
+
+    // key of the last heuristic grid, less its world objects, and the grid
+    // last built ahead of a request, held until it is superseded
+    mutable std::mutex m_prepare_mutex;
+    bool m_have_grid_key;
+    HeuristicGridRegistry::Key m_grid_key;
+    std::shared_ptr<const smpl::OccupancyGrid> m_prepared_grid;
+
+    // retain the collision checker, its cached results, and the planner
+    // between requests that share the start state and scene. the scene is
+    // compared by the contents of its world and its allowed collisions, since
+    // it may be modified in place between requests
+    bool m_reuse_search;
+    moveit::core::RobotStatePtr m_prev_start_state;
+    uint64_t m_prev_voxel_version;
+    std::vector<collision_detection::World::ObjectConstPtr> m_prev_world;
+    moveit_msgs::AllowedCollisionMatrix m_prev_acm;
+
+    int m_priority;
+
+    WorkerPool* m_workers;
+    RequestScheduler::clock::time_point m_request_time;
+
+    // the last solution, repaired locally when the same request is made
+    // against a changed scene
+    bool m_repair_path;
+    moveit_msgs::MotionPlanRequest m_last_req;
+    std::vector<smpl::RobotState> m_last_path;
+
+    // smooth solutions away from obstacles using the world distance field
+    bool m_smooth_path;
+    TrajectorySmootherParams m_smoother_params;
+
+    // remove waypoints within a joint-space tolerance of the motion between
+    // their neighbors
+    bool m_decimate_path;
+    double m_decimation_tolerance;
+
+    // plan with edge costs proportional to the minimum traversal time under
+    // the velocity limits of the group, rather than to joint-space distance
+    bool m_time_cost;
+    std::vector<double> m_vel_limits;
+    std::string m_time_scaled_mprim_filename;
+
+    bool initTimeCost(std::map<std::string, std::string>& config);
+
+    // time solutions to pass obstacles predicted by the collision world. The
+    // pipeline must not re-time them with a time parameterization adapter
+    bool m_avoid_predicted_obstacles;
+
+    void updateMemoryUsage();
+
+    bool solveInProcess(
+        const planning_scene::PlanningSceneConstPtr& scene,
+        const moveit::core::RobotState& start_state,
+        RequestScheduler::clock::time_point deadline,
+        moveit_msgs::MotionPlanRequest& req_msg,
+        moveit_msgs::MotionPlanResponse& res_msg);
+
+    bool postProcessSolution(
+        const planning_scene::PlanningScene& scene,
+        MoveItRobotModel& model,
+        MoveItCollisionChecker& checker,
+        const moveit::core::RobotState& start_state,
+        moveit_msgs::MotionPlanResponse& res_msg);
+
+    void smoothSolution(
+        const planning_scene::PlanningScene& scene,
+        MoveItRobotModel& model,
+        MoveItCollisionChecker& checker,
+        const moveit::core::RobotState& start_state,
+        moveit_msgs::MotionPlanResponse& res_msg);
+
+    bool timeSolution(
+        const planning_scene::PlanningScene& scene,
+        const MoveItRobotModel& model,
+        const moveit::core::RobotState& start_state,
+        moveit_msgs::MotionPlanResponse& res_msg);
+
+    bool solveOnWorker(
+        const planning_scene::PlanningScene& scene,
+        const planning_interface::MotionPlanRequest& req,
+        const moveit_msgs::RobotState& start_state,
+        RequestScheduler::clock::time_point deadline,
+        moveit_msgs::MotionPlanResponse& res_msg);
+
     /// \brief Initialize SBPL constructs
     /// \param[out] Reason for failure if initialization is unsuccessful
     /// \return true if successful; false otherwise
@@ -92,11 +265,34 @@ private:
         const moveit::core::RobotState& start_state,
         const moveit_msgs::WorkspaceParameters& workspace);
 
+    bool solveBatchRequest(
+        const planning_scene::PlanningSceneConstPtr& scene,
+        const moveit_msgs::PlanningScene& scene_msg,
+        MoveItRobotModel* model,
+        Arena& arena,
+        const planning_interface::MotionPlanRequest& req,
+        planning_interface::MotionPlanResponse& res);
+
+    bool repairLastSolution(
+        const moveit_msgs::PlanningScene& scene_msg,
+        const moveit_msgs::MotionPlanRequest& req_msg,
+        const moveit::core::RobotState& start_state,
+        moveit_msgs::MotionPlanResponse& res_msg);
+
+    bool planRepairSegment(
+        const moveit_msgs::PlanningScene& scene_msg,
+        const moveit_msgs::MotionPlanRequest& req_msg,
+        const moveit::core::RobotState& start_state,
+        const smpl::RobotState& from,
+        const smpl::RobotState& to,
+        double allowed_time,
+        std::vector<smpl::RobotState>& segment);
+
     auto updateOrCreateGrid(
-        std::unique_ptr<smpl::OccupancyGrid> grid,
+        std::shared_ptr<const smpl::OccupancyGrid> grid,
         const planning_scene::PlanningSceneConstPtr& scene,
         const moveit_msgs::WorkspaceParameters& workspace)
-        -> std::unique_ptr<smpl::OccupancyGrid>;
+        -> std::shared_ptr<const smpl::OccupancyGrid>;
 };
 
 MOVEIT_CLASS_FORWARD(SBPLPlanningContext);
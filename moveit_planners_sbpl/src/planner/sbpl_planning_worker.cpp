@@ -0,0 +1,169 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+// standard includes
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// system includes
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <ros/ros.h>
+
+// project includes
+#include "../collision/collision_detector_allocator_sbpl.h"
+#include "sbpl_planner_manager.h"
+#include "worker_pool.h"
+
+static const char* LOG = "worker";
+
+// Solve planning requests for a WorkerPool in the parent process, reading
+// scenes from the shared memory snapshots named in the requests
+int main(int argc, char* argv[])
+{
+    ros::init(argc, argv, "sbpl_planning_worker", ros::init_options::NoSigintHandler);
+
+    int fd = -1;
+    std::string param_ns;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (strcmp(argv[i], "--fd") == 0) {
+            fd = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ns") == 0) {
+            param_ns = argv[++i];
+        }
+    }
+
+    if (fd < 0 || param_ns.empty()) {
+        ROS_ERROR_NAMED(LOG, "Usage: sbpl_planning_worker --fd <socket> --ns <namespace>");
+        return 1;
+    }
+
+    // The collision plugin and the planner manager read their configuration
+    // from the private namespace of the node; copy the parent's configuration
+    // there and keep the worker from starting workers of its own
+    ros::NodeHandle ph("~");
+    XmlRpc::XmlRpcValue params;
+    if (ros::param::get(param_ns, params)) {
+        ros::param::set(ph.getNamespace(), params);
+    }
+    ph.setParam("workers/count", 0);
+
+    robot_model_loader::RobotModelLoader loader;
+    auto robot_model = loader.getModel();
+    if (!robot_model) {
+        ROS_ERROR_NAMED(LOG, "Failed to load robot model");
+        return 1;
+    }
+
+    auto scene = std::make_shared<planning_scene::PlanningScene>(robot_model);
+    scene->setActiveCollisionDetector(
+            collision_detection::CollisionDetectorAllocatorSBPL::create(),
+            true);
+
+    sbpl_interface::SBPLPlannerManager manager;
+    if (!manager.initialize(robot_model, ph.getNamespace())) {
+        ROS_ERROR_NAMED(LOG, "Failed to initialize planner manager");
+        return 1;
+    }
+
+    // signal readiness
+    if (!sbpl_interface::WriteFrame(fd, std::vector<uint8_t>())) {
+        return 1;
+    }
+
+    uint64_t scene_version = 0;
+    moveit_msgs::PlanningScene prev_scene_msg;
+
+    std::vector<uint8_t> buffer;
+    while (ros::ok()) {
+        if (!sbpl_interface::ReadFrame(fd, buffer, -1.0)) {
+            break; // parent went away
+        }
+
+        std::string snapshot;
+        uint64_t version;
+        moveit_msgs::MotionPlanRequest req;
+        moveit_msgs::MotionPlanResponse res_msg;
+        if (!sbpl_interface::DecodeRequest(buffer, snapshot, version, req)) {
+            ROS_ERROR_NAMED(LOG, "Received malformed request");
+            break;
+        }
+
+        if (version != scene_version) {
+            moveit_msgs::PlanningScene scene_msg;
+            if (!sbpl_interface::ReadSceneSnapshot(snapshot, scene_msg)) {
+                res_msg.error_code.val = moveit_msgs::MoveItErrorCodes::FAILURE;
+                sbpl_interface::SerializeMessage(res_msg, buffer);
+                if (!sbpl_interface::WriteFrame(fd, buffer)) {
+                    break;
+                }
+                continue;
+            }
+
+            // Leave the world untouched when only the robot state changed, so
+            // that the heuristic grids built from it remain valid
+            if (scene_version != 0 &&
+                sbpl_interface::SerializedEqual(scene_msg.world, prev_scene_msg.world))
+            {
+                auto diff_msg = scene_msg;
+                diff_msg.is_diff = true;
+                diff_msg.world = moveit_msgs::PlanningSceneWorld();
+                scene->setPlanningSceneMsg(diff_msg);
+            } else {
+                scene->setPlanningSceneMsg(scene_msg);
+            }
+
+            prev_scene_msg = std::move(scene_msg);
+            scene_version = version;
+        }
+
+        moveit_msgs::MoveItErrorCodes err;
+        auto context = manager.getPlanningContext(scene, req, err);
+        if (!context) {
+            res_msg.error_code = err;
+        } else {
+            planning_interface::MotionPlanResponse res;
+            context->solve(res);
+            res.getMessage(res_msg);
+        }
+
+        sbpl_interface::SerializeMessage(res_msg, buffer);
+        if (!sbpl_interface::WriteFrame(fd, buffer)) {
+            break;
+        }
+    }
+
+    return 0;
+}
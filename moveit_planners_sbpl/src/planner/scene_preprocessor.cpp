@@ -0,0 +1,160 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "scene_preprocessor.h"
+
+// standard includes
+#include <utility>
+
+// system includes
+#include <ros/console.h>
+
+namespace sbpl_interface {
+
+static const char* LOG = "preprocessing";
+
+ScenePreprocessor::ScenePreprocessor(PrepareFn prepare, double delay) :
+    m_prepare(std::move(prepare)),
+    m_delay(std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(delay))),
+    m_world(),
+    m_observer(),
+    m_stop(false),
+    m_dirty(false)
+{
+    m_thread = std::thread([this]() { run(); });
+}
+
+ScenePreprocessor::~ScenePreprocessor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_observe_mutex);
+    if (m_world) {
+        mutableWorld()->removeObserver(m_observer);
+    }
+}
+
+void ScenePreprocessor::observe(const planning_scene::PlanningScene& scene)
+{
+    // requests are usually planned in diffs of the monitored scene, whose
+    // copies of the world never change after the request is made
+    auto* root = &scene;
+    while (root->getParent()) {
+        root = root->getParent().get();
+    }
+    auto& world = root->getWorld();
+
+    std::lock_guard<std::mutex> lock(m_observe_mutex);
+    if (world.get() == m_world.get()) {
+        return;
+    }
+
+    if (m_world) {
+        mutableWorld()->removeObserver(m_observer);
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Observe world %p", world.get());
+
+    m_world = world;
+    auto* observed = world.get();
+    m_observer = mutableWorld()->addObserver(
+            [this, observed](
+                const collision_detection::World::ObjectConstPtr&,
+                collision_detection::World::Action)
+            {
+                worldChanged(*observed);
+            });
+}
+
+// Observers do not modify the contents of the world. Requires m_observe_mutex.
+auto ScenePreprocessor::mutableWorld() -> collision_detection::World*
+{
+    return const_cast<collision_detection::World*>(m_world.get());
+}
+
+// Called by the thread modifying the world, with exclusive access to it. The
+// world is passed in rather than read from m_world, which observe() may be
+// replacing concurrently.
+void ScenePreprocessor::worldChanged(const collision_detection::World& world)
+{
+    ObjectList snapshot;
+    snapshot.reserve(world.size());
+    for (auto it = world.begin(); it != world.end(); ++it) {
+        snapshot.push_back(it->second);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_snapshot = std::move(snapshot);
+        m_dirty = true;
+        m_change_time = clock::now();
+    }
+    m_cv.notify_all();
+}
+
+void ScenePreprocessor::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv.wait(lock, [&]() { return m_stop || m_dirty; });
+        if (m_stop) {
+            break;
+        }
+
+        // wait for the world to settle, since a single scene update may
+        // change many objects
+        while (!m_stop && clock::now() < m_change_time + m_delay) {
+            m_cv.wait_until(lock, m_change_time + m_delay);
+        }
+        if (m_stop) {
+            break;
+        }
+
+        auto snapshot = std::move(m_snapshot);
+        m_snapshot.clear();
+        m_dirty = false;
+
+        lock.unlock();
+        ROS_DEBUG_NAMED(LOG, "Prepare for world of %zu objects", snapshot.size());
+        m_prepare(snapshot);
+        lock.lock();
+    }
+}
+
+} // namespace sbpl_interface
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_scene_preprocessor_h
+#define sbpl_interface_scene_preprocessor_h
+
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// system includes
+#include <moveit/collision_detection/world.h>
+#include <moveit/planning_scene/planning_scene.h>
+
+namespace sbpl_interface {
+
+/// \brief Runs scene-dependent preparation in the background after the world
+///     of an observed planning scene changes
+///
+/// The preprocessor registers an observer on the world of the root of the
+/// scene given to observe(), i.e. the monitored scene that per-request diffs
+/// are taken from. After a change, and once the world has been quiet for a short
+/// delay, the prepare function is called from a background thread with a
+/// snapshot of the world objects. World objects are copied on write, so the
+/// snapshot is unaffected by later changes to the world.
+class ScenePreprocessor
+{
+public:
+
+    typedef std::vector<collision_detection::World::ObjectConstPtr> ObjectList;
+    typedef std::function<void(const ObjectList&)> PrepareFn;
+
+    explicit ScenePreprocessor(PrepareFn prepare, double delay = 0.05);
+    ~ScenePreprocessor();
+
+    ScenePreprocessor(const ScenePreprocessor&) = delete;
+    ScenePreprocessor& operator=(const ScenePreprocessor&) = delete;
+
+    /// Observe the world of the root of \p scene in place of any world
+    /// observed before. The caller must have read access to the root scene,
+    /// e.g. hold the planning scene monitor's read lock, so that the world is
+    /// not being modified. May be called concurrently from
+    /// several threads.
+    void observe(const planning_scene::PlanningScene& scene);
+
+private:
+
+    typedef std::chrono::steady_clock clock;
+
+    PrepareFn m_prepare;
+    clock::duration m_delay;
+
+    // guards the observed world and the observer handle
+    std::mutex m_observe_mutex;
+    collision_detection::WorldConstPtr m_world;
+    collision_detection::World::ObserverHandle m_observer;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+    bool m_dirty;
+    clock::time_point m_change_time;
+    ObjectList m_snapshot;
+
+    std::thread m_thread;
+
+    auto mutableWorld() -> collision_detection::World*;
+    void worldChanged(const collision_detection::World& world);
+    void run();
+};
+
+} // namespace sbpl_interface
+
+#endif
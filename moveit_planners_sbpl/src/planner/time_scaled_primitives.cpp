@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "time_scaled_primitives.h"
+
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+// system includes
+#include <ros/console.h>
+#include <smpl/angles.h>
+
+// project includes
+#include <moveit_planners_sbpl/planner/moveit_robot_model.h>
+
+namespace sbpl_interface {
+
+static const char* LOG = "time_scaled_primitives";
+
+static const char* PRIMITIVES_HEADER = "Motion_Primitives(degrees):";
+
+bool GetPlanningVelocityLimits(
+    const MoveItRobotModel& robot_model,
+    std::vector<double>& vel_limits)
+{
+    vel_limits.resize(robot_model.activeVariableCount());
+    auto max_limit = 0.0;
+    for (size_t vidx = 0; vidx < vel_limits.size(); ++vidx) {
+        vel_limits[vidx] = robot_model.velLimit(vidx);
+        max_limit = std::max(max_limit, vel_limits[vidx]);
+    }
+
+    if (max_limit <= 0.0) {
+        return false;
+    }
+
+    for (auto& limit : vel_limits) {
+        if (limit <= 0.0) {
+            limit = max_limit;
+        }
+    }
+    return true;
+}
+
+bool GetPlanningResolutions(
+    const MoveItRobotModel& robot_model,
+    const std::string& discretization,
+    std::vector<double>& resolutions)
+{
+    // parse "<variable> <resolution> <variable> <resolution> ..."
+    std::map<std::string, double> disc;
+    std::istringstream iss(discretization);
+    std::string name;
+    double res;
+    while (iss >> name >> res) {
+        disc[name] = res;
+    }
+    if (!iss.eof()) {
+        ROS_WARN_NAMED(LOG, "Malformed discretization '%s'", discretization.c_str());
+        return false;
+    }
+
+    auto& names = robot_model.planningVariableNames();
+    resolutions.resize(names.size());
+    for (size_t vidx = 0; vidx < names.size(); ++vidx) {
+        auto it = disc.find(names[vidx]);
+        if (it == end(disc) || it->second <= 0.0) {
+            ROS_WARN_NAMED(LOG, "No discretization for variable '%s'", names[vidx].c_str());
+            return false;
+        }
+        resolutions[vidx] = it->second;
+    }
+    return true;
+}
+
+auto MinTraversalTime(
+    const std::vector<double>& vel_limits,
+    const std::vector<bool>& continuous,
+    const smpl::RobotState& a,
+    const smpl::RobotState& b)
+    -> double
+{
+    auto time = 0.0;
+    for (size_t vidx = 0; vidx < vel_limits.size(); ++vidx) {
+        auto dist = continuous[vidx] ?
+                smpl::angles::shortest_angle_dist(b[vidx], a[vidx]) :
+                std::fabs(b[vidx] - a[vidx]);
+        time = std::max(time, dist / vel_limits[vidx]);
+    }
+    return time;
+}
+
+bool WriteTimeScaledPrimitives(
+    const std::string& src_path,
+    const std::string& dst_path,
+    const std::vector<double>& vel_limits,
+    const std::vector<double>& resolutions)
+{
+    std::ifstream ifs(src_path);
+    if (!ifs.is_open()) {
+        ROS_WARN_NAMED(LOG, "Failed to open motion primitive file '%s'", src_path.c_str());
+        return false;
+    }
+
+    std::string header;
+    int prim_count, var_count, short_count;
+    if (!(ifs >> header >> prim_count >> var_count >> short_count) ||
+        header != PRIMITIVES_HEADER ||
+        prim_count < 0 || short_count < 0 || short_count > prim_count)
+    {
+        ROS_WARN_NAMED(LOG, "Malformed motion primitive file '%s'", src_path.c_str());
+        return false;
+    }
+
+    if (var_count != (int)vel_limits.size() ||
+        var_count != (int)resolutions.size())
+    {
+        ROS_WARN_NAMED(LOG, "Motion primitives of '%s' have %d variables. Expected %zu", src_path.c_str(), var_count, vel_limits.size());
+        return false;
+    }
+
+    std::vector<std::vector<double>> prims(
+            prim_count, std::vector<double>(var_count));
+    std::vector<double> durations(prim_count, 0.0);
+    for (int pidx = 0; pidx < prim_count; ++pidx) {
+        for (int vidx = 0; vidx < var_count; ++vidx) {
+            if (!(ifs >> prims[pidx][vidx])) {
+                ROS_WARN_NAMED(LOG, "Malformed motion primitive file '%s'", src_path.c_str());
+                return false;
+            }
+            auto dist = smpl::angles::to_radians(std::fabs(prims[pidx][vidx]));
+            durations[pidx] = std::max(durations[pidx], dist / vel_limits[vidx]);
+        }
+    }
+
+    // the last short_count primitives are short-distance primitives
+    auto scale_class = [&](int begin, int end)
+    {
+        auto sum = 0.0;
+        auto count = 0;
+        for (int pidx = begin; pidx < end; ++pidx) {
+            if (durations[pidx] > 0.0) {
+                sum += durations[pidx];
+                ++count;
+            }
+        }
+        if (count == 0) {
+            return;
+        }
+
+        // The lattice rounds each component to its variable's resolution,
+        // so snap scaled components to a whole number of steps here, and
+        // keep at least one step so that no component collapses to zero
+        // motion
+        auto duration = sum / count;
+        ROS_DEBUG_NAMED(LOG, "Scale %d primitives to %0.4f seconds", count, duration);
+        for (int pidx = begin; pidx < end; ++pidx) {
+            if (durations[pidx] <= 0.0) {
+                continue;
+            }
+            auto scale = duration / durations[pidx];
+            for (int vidx = 0; vidx < var_count; ++vidx) {
+                auto& d = prims[pidx][vidx];
+                if (d == 0.0) {
+                    continue;
+                }
+                auto dist = smpl::angles::to_radians(std::fabs(d)) * scale;
+                auto steps = std::max(1.0, std::round(dist / resolutions[vidx]));
+                d = std::copysign(
+                        smpl::angles::to_degrees(steps * resolutions[vidx]), d);
+            }
+        }
+    };
+
+    scale_class(0, prim_count - short_count);
+    scale_class(prim_count - short_count, prim_count);
+
+    std::ofstream ofs(dst_path);
+    if (!ofs.is_open()) {
+        ROS_WARN_NAMED(LOG, "Failed to open '%s' for writing", dst_path.c_str());
+        return false;
+    }
+
+    ofs << PRIMITIVES_HEADER << ' ' << prim_count << ' ' << var_count << ' ' << short_count << '\n';
+    ofs << std::fixed << std::setprecision(6);
+    for (auto& prim : prims) {
+        for (int vidx = 0; vidx < var_count; ++vidx) {
+            if (vidx != 0) {
+                ofs << ' ';
+            }
+            ofs << prim[vidx];
+        }
+        ofs << '\n';
+    }
+
+    if (!ofs.good()) {
+        ROS_WARN_NAMED(LOG, "Failed to write '%s'", dst_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace sbpl_interface
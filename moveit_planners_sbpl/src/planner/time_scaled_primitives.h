@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_time_scaled_primitives_h
+#define sbpl_interface_time_scaled_primitives_h
+
+// standard includes
+#include <string>
+#include <vector>
+
+// system includes
+#include <smpl/types.h>
+
+namespace sbpl_interface {
+
+class MoveItRobotModel;
+
+/// \brief Return the per-variable velocity limits of the planning variables
+///
+/// Variables without a positive velocity limit are given the largest limit of
+/// any other variable. Returns false if no variable has a positive limit.
+bool GetPlanningVelocityLimits(
+    const MoveItRobotModel& robot_model,
+    std::vector<double>& vel_limits);
+
+/// \brief Return the per-variable resolutions of the planning variables
+///
+/// \p discretization is the planner's "discretization" parameter, a list of
+/// variable names each followed by its resolution. Returns false if any
+/// planning variable is missing or has a non-positive resolution.
+bool GetPlanningResolutions(
+    const MoveItRobotModel& robot_model,
+    const std::string& discretization,
+    std::vector<double>& resolutions);
+
+/// \brief Return the minimum time to move between two states
+///
+/// Each variable moves independently at its velocity limit, so the time is
+/// that of the slowest variable. Continuous variables move along the shorter
+/// arc. This is a lower bound on the duration of any motion between the
+/// states, and so an admissible estimate of the time remaining to a goal.
+auto MinTraversalTime(
+    const std::vector<double>& vel_limits,
+    const std::vector<bool>& continuous,
+    const smpl::RobotState& a,
+    const smpl::RobotState& b)
+    -> double;
+
+/// \brief Rewrite a motion primitive file so that each primitive takes the
+///     same minimum traversal time
+///
+/// Each primitive of \p src_path is scaled so that its minimum traversal time
+/// under \p vel_limits equals the mean over its class (long- or
+/// short-distance). With a uniform cost per action, the cost of a path on the
+/// lattice is then proportional to its minimum traversal time: slow joints are
+/// given shorter primitives and fast joints longer ones.
+///
+/// Each scaled component is rounded to a whole number of steps of its
+/// variable's resolution in \p resolutions, and nonzero components keep at
+/// least one step, so the written primitives lie on the lattice. The
+/// durations are then equal only to within one step per variable.
+bool WriteTimeScaledPrimitives(
+    const std::string& src_path,
+    const std::string& dst_path,
+    const std::vector<double>& vel_limits,
+    const std::vector<double>& resolutions);
+
+} // namespace sbpl_interface
+
+#endif
@@ -0,0 +1,339 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "trajectory_smoother.h"
+
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// system includes
+#include <geometric_shapes/shape_operations.h>
+#include <moveit/robot_model/prismatic_joint_model.h>
+#include <moveit/robot_model/revolute_joint_model.h>
+#include <ros/console.h>
+#include <smpl/angles.h>
+
+// project includes
+#include <moveit_planners_sbpl/planner/moveit_robot_model.h>
+
+namespace sbpl_interface {
+
+static const char* LOG = "smoothing";
+
+namespace {
+
+struct BodySphere
+{
+    const moveit::core::LinkModel* link;
+    Eigen::Vector3d center; // in the link frame
+    double radius;
+
+    // planning variables that move the sphere
+    std::vector<int> vars;
+};
+
+} // namespace
+
+// Return a - b, accounting for wrap-around of continuous variables
+static
+double VariableDiff(bool continuous, double a, double b)
+{
+    return continuous ? smpl::angles::shortest_angle_diff(a, b) : a - b;
+}
+
+// Return the distance to the nearest obstacle at p and its gradient, or false
+// if p is outside the distance map
+static
+bool DistanceAndGradient(
+    const smpl::DistanceMapInterface& dmap,
+    const Eigen::Vector3d& p,
+    double& distance,
+    Eigen::Vector3d& gradient)
+{
+    int gx, gy, gz;
+    dmap.worldToGrid(p.x(), p.y(), p.z(), gx, gy, gz);
+    if (!dmap.isCellValid(gx, gy, gz)) {
+        return false;
+    }
+
+    distance = dmap.getCellDistance(gx, gy, gz);
+
+    // central differences, falling back to zero at the boundary
+    const int offsets[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    for (int a = 0; a < 3; ++a) {
+        auto& o = offsets[a];
+        if (!dmap.isCellValid(gx + o[0], gy + o[1], gz + o[2]) ||
+            !dmap.isCellValid(gx - o[0], gy - o[1], gz - o[2]))
+        {
+            gradient[a] = 0.0;
+            continue;
+        }
+        auto dp = dmap.getCellDistance(gx + o[0], gy + o[1], gz + o[2]);
+        auto dm = dmap.getCellDistance(gx - o[0], gy - o[1], gz - o[2]);
+        gradient[a] = (dp - dm) / (2.0 * dmap.resolution());
+    }
+    return true;
+}
+
+// Collect the bounding spheres of the collision shapes of links, and attached
+// bodies, moved by the planning variables
+static
+auto CollectBodySpheres(
+    MoveItRobotModel& robot_model,
+    const moveit::core::RobotState& state)
+    -> std::vector<BodySphere>
+{
+    auto& model = *robot_model.moveitRobotModel();
+    auto& avinds = robot_model.activeVariableIndices();
+
+    std::vector<const moveit::core::JointModel*> var_joints(avinds.size());
+    for (size_t vidx = 0; vidx < avinds.size(); ++vidx) {
+        var_joints[vidx] = model.getJointOfVariable(avinds[vidx]);
+    }
+
+    auto vars_moving = [&](const moveit::core::LinkModel* link) {
+        std::vector<int> vars;
+        for (size_t vidx = 0; vidx < var_joints.size(); ++vidx) {
+            auto& descendants = var_joints[vidx]->getDescendantLinkModels();
+            if (std::find(begin(descendants), end(descendants), link) !=
+                end(descendants))
+            {
+                vars.push_back((int)vidx);
+            }
+        }
+        return vars;
+    };
+
+    std::vector<BodySphere> spheres;
+    auto& links = robot_model.planningJointGroup()->getUpdatedLinkModelsWithGeometry();
+    for (auto* link : links) {
+        auto vars = vars_moving(link);
+        auto& shapes = link->getShapes();
+        auto& origins = link->getCollisionOriginTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            spheres.push_back({ link, origins[i] * center, radius, vars });
+        }
+    }
+
+    std::vector<const moveit::core::AttachedBody*> attached_bodies;
+    state.getAttachedBodies(attached_bodies);
+    for (auto* ab : attached_bodies) {
+        auto* link = ab->getAttachedLink();
+        if (std::find(begin(links), end(links), link) == end(links)) {
+            continue;
+        }
+        auto vars = vars_moving(link);
+        auto& shapes = ab->getShapes();
+        auto& transforms = ab->getFixedTransforms();
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            Eigen::Vector3d center;
+            double radius;
+            shapes::computeShapeBoundingSphere(shapes[i].get(), center, radius);
+            spheres.push_back({ link, transforms[i] * center, radius, vars });
+        }
+    }
+
+    return spheres;
+}
+
+// Solve A x = b in place for the (-1, 2, -1) tridiagonal matrix A, the metric
+// of the sum of squared differences between consecutive waypoints
+static
+void SolveSmoothnessMetric(std::vector<double>& b, std::vector<double>& scratch)
+{
+    auto n = b.size();
+    scratch.resize(n);
+    scratch[0] = -0.5;
+    b[0] *= 0.5;
+    for (size_t k = 1; k < n; ++k) {
+        auto denom = 2.0 + scratch[k - 1];
+        scratch[k] = -1.0 / denom;
+        b[k] = (b[k] + b[k - 1]) / denom;
+    }
+    for (size_t k = n - 1; k > 0; --k) {
+        b[k - 1] -= scratch[k - 1] * b[k];
+    }
+}
+
+bool SmoothPath(
+    MoveItRobotModel& robot_model,
+    moveit::core::RobotState& state,
+    const smpl::DistanceMapInterface& dmap,
+    smpl::CollisionChecker& checker,
+    const TrajectorySmootherParams& params,
+    std::vector<smpl::RobotState>& path)
+{
+    if (path.size() < 3) {
+        return false;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() +
+            std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(params.max_time));
+
+    auto& model = *robot_model.moveitRobotModel();
+    auto& avinds = robot_model.activeVariableIndices();
+    auto& continuous = robot_model.variableContinuous();
+    const size_t var_count = avinds.size();
+
+    std::vector<const moveit::core::JointModel*> var_joints(var_count);
+    for (size_t vidx = 0; vidx < var_count; ++vidx) {
+        var_joints[vidx] = model.getJointOfVariable(avinds[vidx]);
+    }
+
+    auto spheres = CollectBodySpheres(robot_model, state);
+
+    const auto original = path;
+    const size_t m = path.size() - 2; // interior waypoints
+
+    // per-variable gradient over the interior waypoints
+    std::vector<std::vector<double>> grad(var_count, std::vector<double>(m));
+    std::vector<double> scratch;
+
+    int iter;
+    for (iter = 0; iter < params.max_iterations; ++iter) {
+        if (clock::now() > deadline) {
+            break;
+        }
+
+        for (size_t i = 1; i <= m; ++i) {
+            auto& prev = path[i - 1];
+            auto& curr = path[i];
+            auto& next = path[i + 1];
+            for (size_t vidx = 0; vidx < var_count; ++vidx) {
+                grad[vidx][i - 1] =
+                        VariableDiff(continuous[vidx], curr[vidx], prev[vidx]) -
+                        VariableDiff(continuous[vidx], next[vidx], curr[vidx]);
+                state.setVariablePosition(avinds[vidx], curr[vidx]);
+            }
+            state.update();
+
+            for (auto& sphere : spheres) {
+                Eigen::Vector3d p = state.getGlobalLinkTransform(sphere.link) *
+                        sphere.center;
+                double d;
+                Eigen::Vector3d dgrad;
+                if (!DistanceAndGradient(dmap, p, d, dgrad)) {
+                    continue;
+                }
+
+                // gradient of the CHOMP obstacle cost with respect to the
+                // signed distance of the sphere surface
+                auto ds = d - sphere.radius;
+                double scale;
+                if (ds < 0.0) {
+                    scale = -1.0;
+                } else if (ds < params.clearance) {
+                    scale = (ds - params.clearance) / params.clearance;
+                } else {
+                    continue;
+                }
+                Eigen::Vector3d wgrad = params.obstacle_weight * scale * dgrad;
+
+                for (int vidx : sphere.vars) {
+                    auto* joint = var_joints[vidx];
+                    auto& T_child = state.getGlobalLinkTransform(
+                            joint->getChildLinkModel());
+                    Eigen::Vector3d column;
+                    if (joint->getType() == moveit::core::JointModel::REVOLUTE) {
+                        auto* rj = static_cast<const moveit::core::RevoluteJointModel*>(joint);
+                        Eigen::Vector3d axis = T_child.linear() * rj->getAxis();
+                        column = axis.cross(p - T_child.translation());
+                    } else if (joint->getType() == moveit::core::JointModel::PRISMATIC) {
+                        auto* pj = static_cast<const moveit::core::PrismaticJointModel*>(joint);
+                        column = T_child.linear() * pj->getAxis();
+                    } else {
+                        continue;
+                    }
+                    grad[vidx][i - 1] += column.dot(wgrad);
+                }
+            }
+        }
+
+        // precondition by the inverse of the smoothness metric
+        double max_delta = 0.0;
+        for (auto& g : grad) {
+            SolveSmoothnessMetric(g, scratch);
+            for (double delta : g) {
+                max_delta = std::max(max_delta, std::fabs(delta));
+            }
+        }
+
+        auto step = params.step_size;
+        if (step * max_delta > params.max_step) {
+            step = params.max_step / max_delta;
+        }
+        if (step * max_delta < 1e-6) {
+            break; // converged
+        }
+
+        for (size_t i = 1; i <= m; ++i) {
+            for (size_t vidx = 0; vidx < var_count; ++vidx) {
+                auto& pos = path[i][vidx];
+                pos -= step * grad[vidx][i - 1];
+                if (continuous[vidx]) {
+                    pos = smpl::angles::normalize_angle(pos);
+                } else if (robot_model.hasPosLimit(vidx)) {
+                    pos = std::max(robot_model.minPosLimit(vidx), pos);
+                    pos = std::min(robot_model.maxPosLimit(vidx), pos);
+                }
+            }
+        }
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Smoothed path of %zu waypoints in %d iterations", path.size(), iter);
+
+    if (iter == 0) {
+        return false;
+    }
+
+    for (size_t i = 1; i < path.size(); ++i) {
+        if ((i < path.size() - 1 && !checker.isStateValid(path[i], false)) ||
+            !checker.isStateToStateValid(path[i - 1], path[i], false))
+        {
+            ROS_DEBUG_NAMED(LOG, "Smoothed path is invalid at waypoint %zu. Keep the original path", i);
+            path = original;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace sbpl_interface
@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_trajectory_smoother_h
+#define sbpl_interface_trajectory_smoother_h
+
+// standard includes
+#include <vector>
+
+// system includes
+#include <moveit/robot_state/robot_state.h>
+#include <smpl/collision_checker.h>
+#include <smpl/distance_map/distance_map_interface.h>
+
+namespace sbpl_interface {
+
+class MoveItRobotModel;
+
+struct TrajectorySmootherParams
+{
+    // wall time allowed for optimization, in seconds
+    double max_time = 0.05;
+
+    int max_iterations = 100;
+
+    // distance from obstacles within which the obstacle cost applies
+    double clearance = 0.05;
+
+    // weight of the obstacle cost relative to the smoothness cost
+    double obstacle_weight = 1.0;
+
+    // inverse of the step regularization
+    double step_size = 0.1;
+
+    // largest change of any variable in a single iteration
+    double max_step = 0.02;
+};
+
+/// \brief Smooth a joint-space path by covariant gradient descent
+///
+/// The interior waypoints of \p path, given in the order of the planning
+/// variables of \p robot_model, are moved to reduce the sum of squared
+/// differences between consecutive waypoints and a cost on the proximity of
+/// the bounding spheres of the moving links to obstacles in \p dmap. Updates
+/// are preconditioned by the inverse of the smoothness metric, as in CHOMP, so
+/// that local obstacle gradients are spread smoothly along the path. The end
+/// points are not moved.
+///
+/// Optimization stops after the time or iteration limit. The result is then
+/// validated with \p checker; if any motion between consecutive waypoints is
+/// invalid, the path is left unchanged.
+///
+/// \param state Scratch state, holding the values of variables outside the
+///     planning group and the attached bodies
+/// \return true if the path was modified
+bool SmoothPath(
+    MoveItRobotModel& robot_model,
+    moveit::core::RobotState& state,
+    const smpl::DistanceMapInterface& dmap,
+    smpl::CollisionChecker& checker,
+    const TrajectorySmootherParams& params,
+    std::vector<smpl::RobotState>& path);
+
+} // namespace sbpl_interface
+
+#endif
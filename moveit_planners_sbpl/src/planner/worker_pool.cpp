@@ -0,0 +1,501 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#include "worker_pool.h"
+
+// standard includes
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+// system includes
+#include <fcntl.h>
+#include <moveit_msgs/PlanningSceneComponents.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ros/console.h>
+
+namespace sbpl_interface {
+
+static const char* LOG = "workers";
+
+// descriptor of the socket inherited by a worker process
+static const int WORKER_FD = 3;
+
+WorkerPool::WorkerPool() : m_scene_version(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    for (auto& worker : m_workers) {
+        kill(worker);
+    }
+    for (auto& snapshot : m_snapshots) {
+        shm_unlink(snapshot.name.c_str());
+    }
+}
+
+bool WorkerPool::init(const Options& options)
+{
+    if (options.executable.empty()) {
+        ROS_WARN_NAMED(LOG, "No worker executable given");
+        return false;
+    }
+
+    m_options = options;
+    m_workers.resize(std::max(options.count, 0));
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        if (!spawn(m_workers[i], (int)i)) {
+            return false;
+        }
+    }
+
+    ROS_INFO_NAMED(LOG, "Started %zu planning workers", m_workers.size());
+    return true;
+}
+
+bool WorkerPool::solve(
+    const planning_scene::PlanningScene& scene,
+    const moveit_msgs::MotionPlanRequest& req,
+    moveit_msgs::MotionPlanResponse& res)
+{
+    SceneKey key;
+    auto versioned = GetSceneKey(scene, key);
+
+    int widx;
+    Snapshot snapshot;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        widx = claimWorker();
+        if (widx < 0) {
+            ROS_DEBUG_NAMED(LOG, "No planning worker is ready");
+            return false;
+        }
+        if (!versioned || !isCurrentScene(key)) {
+            moveit_msgs::PlanningScene scene_msg;
+            scene.getPlanningSceneMsg(scene_msg);
+            std::vector<uint8_t> buffer;
+            SerializeMessage(scene_msg, buffer);
+            if (!publishScene(buffer)) {
+                m_workers[widx].state = WorkerState::Idle;
+                return false;
+            }
+            m_scene_key = versioned ? std::move(key) : SceneKey();
+        }
+        ++m_snapshots.back().refs;
+        snapshot = m_snapshots.back();
+    }
+
+    ROS_DEBUG_NAMED(LOG, "Dispatch request to worker %d (scene version %lu)", widx, snapshot.version);
+
+    auto& worker = m_workers[widx];
+    std::vector<uint8_t> buffer;
+    EncodeRequest(snapshot.name, snapshot.version, req, buffer);
+    auto ok = WriteFrame(worker.fd, buffer) &&
+            ReadFrame(
+                    worker.fd,
+                    buffer,
+                    req.allowed_planning_time + m_options.timeout_margin) &&
+            DeserializeMessage(buffer, res);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    releaseSnapshot(snapshot.version);
+    if (!ok) {
+        ROS_WARN_NAMED(LOG, "Planning worker %d failed to respond. Restart it", widx);
+        kill(worker);
+        spawn(worker, widx);
+        return false;
+    }
+
+    worker.state = WorkerState::Idle;
+    return true;
+}
+
+bool WorkerPool::spawn(Worker& worker, int index)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        ROS_WARN_NAMED(LOG, "Failed to create worker socket (%s)", strerror(errno));
+        return false;
+    }
+
+    // prepare the arguments before forking; the child makes only
+    // async-signal-safe calls before exec
+    auto fd_arg = std::to_string(WORKER_FD);
+    auto name_arg = "__name:=sbpl_planning_worker_" +
+            std::to_string(getpid()) + "_" + std::to_string(index);
+    std::vector<char*> argv = {
+        const_cast<char*>(m_options.executable.c_str()),
+        const_cast<char*>("--fd"),
+        const_cast<char*>(fd_arg.c_str()),
+        const_cast<char*>("--ns"),
+        const_cast<char*>(m_options.param_ns.c_str()),
+        const_cast<char*>(name_arg.c_str()),
+        nullptr,
+    };
+
+    auto pid = fork();
+    if (pid < 0) {
+        ROS_WARN_NAMED(LOG, "Failed to fork planning worker (%s)", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (fds[1] == WORKER_FD) {
+            fcntl(WORKER_FD, F_SETFD, 0);
+        } else {
+            dup2(fds[1], WORKER_FD);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    close(fds[1]);
+    worker.pid = pid;
+    worker.fd = fds[0];
+    worker.state = WorkerState::Starting;
+    return true;
+}
+
+void WorkerPool::kill(Worker& worker)
+{
+    if (worker.pid > 0) {
+        ::kill(worker.pid, SIGKILL);
+        waitpid(worker.pid, nullptr, 0);
+    }
+    if (worker.fd >= 0) {
+        close(worker.fd);
+    }
+    worker.pid = -1;
+    worker.fd = -1;
+    worker.state = WorkerState::Starting;
+}
+
+// Claim the first idle worker, promoting workers that have reported ready
+// since the last call. Return -1 if no worker is idle.
+int WorkerPool::claimWorker()
+{
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        auto& worker = m_workers[i];
+        if (worker.pid < 0) {
+            spawn(worker, (int)i);
+            continue;
+        }
+
+        if (worker.state == WorkerState::Starting) {
+            pollfd pfd = { worker.fd, POLLIN, 0 };
+            if (poll(&pfd, 1, 0) <= 0) {
+                continue;
+            }
+            std::vector<uint8_t> ready;
+            if (!ReadFrame(worker.fd, ready, 0.0)) {
+                ROS_WARN_NAMED(LOG, "Planning worker %zu exited during startup", i);
+                kill(worker);
+                continue;
+            }
+            worker.state = WorkerState::Idle;
+        }
+
+        if (worker.state == WorkerState::Idle) {
+            worker.state = WorkerState::Busy;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Identify a scene without converting its world to a message. Return false if
+// the scene cannot be identified, because its world holds an octree, which is
+// updated in place rather than copied on write.
+bool WorkerPool::GetSceneKey(
+    const planning_scene::PlanningScene& scene,
+    SceneKey& key)
+{
+    auto& world = *scene.getWorld();
+    key.objects.reserve(world.size());
+    for (auto it = world.begin(); it != world.end(); ++it) {
+        for (auto& shape : it->second->shapes_) {
+            if (shape->type == shapes::OCTREE) {
+                return false;
+            }
+        }
+        key.objects.push_back(it->second);
+    }
+    std::sort(begin(key.objects), end(key.objects));
+
+    moveit_msgs::PlanningSceneComponents components;
+    components.components =
+            moveit_msgs::PlanningSceneComponents::SCENE_SETTINGS |
+            moveit_msgs::PlanningSceneComponents::TRANSFORMS |
+            moveit_msgs::PlanningSceneComponents::ALLOWED_COLLISION_MATRIX |
+            moveit_msgs::PlanningSceneComponents::LINK_PADDING_AND_SCALING;
+    scene.getPlanningSceneMsg(key.settings, components);
+    return true;
+}
+
+bool WorkerPool::isCurrentScene(const SceneKey& key) const
+{
+    return !m_snapshots.empty() &&
+            key.objects == m_scene_key.objects &&
+            SerializedEqual(key.settings, m_scene_key.settings);
+}
+
+// Write the serialized scene to a new shared memory segment and make it the
+// current snapshot
+bool WorkerPool::publishScene(const std::vector<uint8_t>& buffer)
+{
+    auto version = m_scene_version + 1;
+    auto name = "/sbpl_scene_" + std::to_string(getpid()) + "_" +
+            std::to_string(version);
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        ROS_WARN_NAMED(LOG, "Failed to create scene snapshot '%s' (%s)", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    void* map = MAP_FAILED;
+    if (!buffer.empty() && ftruncate(fd, buffer.size()) == 0) {
+        map = mmap(
+                nullptr, buffer.size(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        ROS_WARN_NAMED(LOG, "Failed to map scene snapshot '%s'", name.c_str());
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    std::memcpy(map, buffer.data(), buffer.size());
+    munmap(map, buffer.size());
+
+    m_scene_version = version;
+    m_snapshots.push_back(Snapshot{ version, name, 0 });
+    pruneSnapshots();
+    return true;
+}
+
+void WorkerPool::releaseSnapshot(uint64_t version)
+{
+    for (auto& snapshot : m_snapshots) {
+        if (snapshot.version == version) {
+            --snapshot.refs;
+        }
+    }
+    pruneSnapshots();
+}
+
+// Unlink superseded snapshots that are no longer referenced by in-flight
+// requests
+void WorkerPool::pruneSnapshots()
+{
+    auto it = m_snapshots.begin();
+    while (!m_snapshots.empty() && it != m_snapshots.end() - 1) {
+        if (it->refs <= 0) {
+            shm_unlink(it->name.c_str());
+            it = m_snapshots.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static
+bool WriteAll(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        auto n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static
+bool ReadAll(
+    int fd,
+    uint8_t* data,
+    size_t size,
+    std::chrono::steady_clock::time_point deadline,
+    bool wait_forever)
+{
+    while (size > 0) {
+        int timeout_ms = -1;
+        if (!wait_forever) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            timeout_ms = (int)std::max<decltype(remaining)>(remaining, 0);
+        }
+
+        pollfd pfd = { fd, POLLIN, 0 };
+        auto ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (ready == 0) {
+            return false; // timed out
+        }
+
+        auto n = read(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            return false; // peer closed
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool WriteFrame(int fd, const std::vector<uint8_t>& buffer)
+{
+    auto size = (uint32_t)buffer.size();
+    return WriteAll(fd, (const uint8_t*)&size, sizeof(size)) &&
+            WriteAll(fd, buffer.data(), buffer.size());
+}
+
+bool ReadFrame(int fd, std::vector<uint8_t>& buffer, double timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(std::max(timeout, 0.0)));
+    auto wait_forever = timeout < 0.0;
+
+    uint32_t size;
+    if (!ReadAll(fd, (uint8_t*)&size, sizeof(size), deadline, wait_forever)) {
+        return false;
+    }
+    buffer.resize(size);
+    return ReadAll(fd, buffer.data(), size, deadline, wait_forever);
+}
+
+void EncodeRequest(
+    const std::string& snapshot,
+    uint64_t version,
+    const moveit_msgs::MotionPlanRequest& req,
+    std::vector<uint8_t>& buffer)
+{
+    namespace ser = ros::serialization;
+    uint32_t size = ser::serializationLength(snapshot) +
+            ser::serializationLength(version) +
+            ser::serializationLength(req);
+    buffer.resize(size);
+    ser::OStream stream(buffer.data(), size);
+    ser::serialize(stream, snapshot);
+    ser::serialize(stream, version);
+    ser::serialize(stream, req);
+}
+
+bool DecodeRequest(
+    const std::vector<uint8_t>& buffer,
+    std::string& snapshot,
+    uint64_t& version,
+    moveit_msgs::MotionPlanRequest& req)
+{
+    namespace ser = ros::serialization;
+    try {
+        ser::IStream stream(
+                const_cast<uint8_t*>(buffer.data()), (uint32_t)buffer.size());
+        ser::deserialize(stream, snapshot);
+        ser::deserialize(stream, version);
+        ser::deserialize(stream, req);
+    } catch (const ros::Exception&) {
+        return false;
+    }
+    return true;
+}
+
+bool ReadSceneSnapshot(
+    const std::string& name,
+    moveit_msgs::PlanningScene& scene)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        ROS_WARN_NAMED(LOG, "Failed to open scene snapshot '%s' (%s)", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        ROS_WARN_NAMED(LOG, "Failed to map scene snapshot '%s'", name.c_str());
+        return false;
+    }
+
+    namespace ser = ros::serialization;
+    auto ok = true;
+    try {
+        ser::IStream stream((uint8_t*)map, (uint32_t)st.st_size);
+        ser::deserialize(stream, scene);
+    } catch (const ros::Exception&) {
+        ROS_WARN_NAMED(LOG, "Malformed scene snapshot '%s'", name.c_str());
+        ok = false;
+    }
+
+    munmap(map, st.st_size);
+    return ok;
+}
+
+} // namespace sbpl_interface
@@ -0,0 +1,241 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017, Andrew Dornbush
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+////////////////////////////////////////////////////////////////////////////////
+
+/// \author Andrew Dornbush
+
+#ifndef sbpl_interface_worker_pool_h
+#define sbpl_interface_worker_pool_h
+
+// standard includes
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// system includes
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit_msgs/MotionPlanRequest.h>
+#include <moveit_msgs/MotionPlanResponse.h>
+#include <moveit_msgs/PlanningScene.h>
+#include <ros/serialization.h>
+#include <sys/types.h>
+
+namespace sbpl_interface {
+
+/// \brief Pool of local worker processes that solve planning requests
+///
+/// Each worker is an sbpl_planning_worker process running its own planner
+/// manager with the planner configuration of its parent. Planning scenes are
+/// published to the workers through POSIX shared memory, as serialized
+/// planning scene messages mapped read-only by the workers, and versioned so
+/// that a worker rebuilds its scene, and the heuristic grids derived from it,
+/// only when the scene changes. A scene is identified by the addresses of its
+/// world objects, which are copied on write while the pool holds them, and by
+/// its settings other than the world and the robot state, so that it is
+/// converted to a message only when it changes. Requests and responses are exchanged over a
+/// Unix domain socket per worker. A worker that exits or misses its deadline
+/// is killed and restarted.
+class WorkerPool
+{
+public:
+
+    struct Options
+    {
+        // path to the sbpl_planning_worker executable
+        std::string executable;
+
+        // namespace of the planner configuration copied by the workers
+        std::string param_ns;
+
+        int count = 0;
+
+        // time allowed beyond the allowed planning time for a response
+        double timeout_margin = 5.0;
+    };
+
+    WorkerPool();
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    bool init(const Options& options);
+
+    int size() const { return (int)m_workers.size(); }
+
+    /// \brief Solve a request on an idle worker
+    ///
+    /// \return true if a worker answered the request, successfully or not;
+    ///     false if no worker was ready or the worker failed, in which case
+    ///     the request should be solved in-process
+    bool solve(
+        const planning_scene::PlanningScene& scene,
+        const moveit_msgs::MotionPlanRequest& req,
+        moveit_msgs::MotionPlanResponse& res);
+
+private:
+
+    enum class WorkerState
+    {
+        Starting,
+        Idle,
+        Busy,
+    };
+
+    struct Worker
+    {
+        pid_t pid = -1;
+        int fd = -1;
+        WorkerState state = WorkerState::Starting;
+    };
+
+    struct Snapshot
+    {
+        uint64_t version;
+        std::string name;
+        int refs;
+    };
+
+    struct SceneKey
+    {
+        // world objects, sorted by address
+        std::vector<std::shared_ptr<const void>> objects;
+
+        // scene components other than the world and the robot state, which
+        // requests carry in their start state
+        moveit_msgs::PlanningScene settings;
+    };
+
+    Options m_options;
+
+    std::mutex m_mutex;
+    std::vector<Worker> m_workers;
+
+    // published scenes still referenced by in-flight requests, the most
+    // recent last
+    std::vector<Snapshot> m_snapshots;
+    SceneKey m_scene_key;
+    uint64_t m_scene_version;
+
+    bool spawn(Worker& worker, int index);
+    void kill(Worker& worker);
+
+    int claimWorker();
+
+    static bool GetSceneKey(
+        const planning_scene::PlanningScene& scene,
+        SceneKey& key);
+    bool isCurrentScene(const SceneKey& key) const;
+
+    bool publishScene(const std::vector<uint8_t>& buffer);
+    void releaseSnapshot(uint64_t version);
+    void pruneSnapshots();
+};
+
+/// \name Worker Protocol
+///
+/// Messages are framed by a 32-bit length. A worker sends an empty frame once
+/// it is ready for requests. A request frame holds the name and version of the
+/// shared memory scene snapshot followed by the serialized request; a response
+/// frame holds the serialized response.
+///@{
+
+bool WriteFrame(int fd, const std::vector<uint8_t>& buffer);
+
+/// Read a frame, waiting at most \p timeout seconds; a negative timeout waits
+/// indefinitely
+bool ReadFrame(int fd, std::vector<uint8_t>& buffer, double timeout);
+
+void EncodeRequest(
+    const std::string& snapshot,
+    uint64_t version,
+    const moveit_msgs::MotionPlanRequest& req,
+    std::vector<uint8_t>& buffer);
+
+bool DecodeRequest(
+    const std::vector<uint8_t>& buffer,
+    std::string& snapshot,
+    uint64_t& version,
+    moveit_msgs::MotionPlanRequest& req);
+
+/// Map a scene snapshot read-only and deserialize the scene from it in place
+bool ReadSceneSnapshot(
+    const std::string& name,
+    moveit_msgs::PlanningScene& scene);
+
+template <class Message>
+void SerializeMessage(const Message& msg, std::vector<uint8_t>& buffer)
+{
+    namespace ser = ros::serialization;
+    uint32_t size = ser::serializationLength(msg);
+    buffer.resize(size);
+    ser::OStream stream(buffer.data(), size);
+    ser::serialize(stream, msg);
+}
+
+template <class Message>
+bool SerializedEqual(const Message& a, const Message& b)
+{
+    namespace ser = ros::serialization;
+    uint32_t size = ser::serializationLength(a);
+    if (size != ser::serializationLength(b)) {
+        return false;
+    }
+
+    std::vector<uint8_t> abuf(size);
+    std::vector<uint8_t> bbuf(size);
+    ser::OStream astream(abuf.data(), size);
+    ser::OStream bstream(bbuf.data(), size);
+    ser::serialize(astream, a);
+    ser::serialize(bstream, b);
+    return abuf == bbuf;
+}
+
+template <class Message>
+bool DeserializeMessage(const std::vector<uint8_t>& buffer, Message& msg)
+{
+    namespace ser = ros::serialization;
+    try {
+        ser::IStream stream(
+                const_cast<uint8_t*>(buffer.data()), (uint32_t)buffer.size());
+        ser::deserialize(stream, msg);
+    } catch (const ros::Exception&) {
+        return false;
+    }
+    return true;
+}
+
+///@}
+
+} // namespace sbpl_interface
+
+#endif